@@ -0,0 +1,320 @@
+/**
+ * @file asaphus_benchmarks.cpp
+ * @copyright Copyright (c) 2022 Asaphus Vision GmbH
+ *
+ * Microbenchmarks of Box::absorbWeight, Player::takeTurn, play() and the batch engines.
+ * Every benchmark runs over token sequences of 10 to 10^8 tokens from several distributions and is reported in ns/token and tokens/s.
+ *
+ * Usage: asaphus_benchmarks [--filter=<substring>] [--min-length=<tokens>] [--max-length=<tokens>] [--min-time=<seconds>] [--csv]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "asaphus/engine.hpp"
+
+enum class Distribution { FIBONACCI, UNIFORM, SORTED, ADVERSARIAL };
+
+static const char* distributionName(Distribution distribution) {
+	switch (distribution) {
+	case Distribution::FIBONACCI: return "fibonacci";
+	case Distribution::UNIFORM: return "uniform";
+	case Distribution::SORTED: return "sorted";
+	default: return "adversarial";
+	}
+}
+
+//Fibonacci numbers wrap around at 2^32, adversarial sequences alternate between zero and maximal weights
+static std::vector<uint32_t> makeTokens(Distribution distribution, size_t length, uint32_t seed) {
+	std::vector<uint32_t> tokens(length);
+	std::mt19937 generator(seed);
+	std::uniform_int_distribution<uint32_t> uniform(0, 1 << 20);
+	uint32_t previous = 0, current = 1;
+	for (size_t i = 0; i < length; ++i) {
+		switch (distribution) {
+		case Distribution::FIBONACCI:
+			tokens[i] = current;
+			current += previous;
+			previous = tokens[i];
+			break;
+		case Distribution::UNIFORM:
+		case Distribution::SORTED:
+			tokens[i] = uniform(generator);
+			break;
+		case Distribution::ADVERSARIAL:
+			tokens[i] = (i % 4 < 2) ? 0 : std::numeric_limits<uint32_t>::max() - static_cast<uint32_t>(i % 3);
+			break;
+		}
+	}
+	if (distribution == Distribution::SORTED) {
+		std::sort(tokens.begin(), tokens.end());
+	}
+	return tokens;
+}
+
+//Benchmarked code processes a whole token sequence and returns a value depending on all of it, so it cannot be optimized away
+struct Benchmark {
+	std::string name;
+	std::function<double(const std::vector<uint32_t>&)> run;
+};
+
+struct Options {
+	std::string filter;
+	size_t min_length = 10;
+	size_t max_length = 100000000;
+	double min_time = 0.2;
+	bool csv = false;
+};
+
+static volatile double benchmark_sink;
+
+static void report(const Options& options, const std::string& name, const std::string& input, size_t tokens_per_iteration, size_t iterations, double seconds) {
+	double tokens = static_cast<double>(tokens_per_iteration) * static_cast<double>(iterations);
+	double ns_per_token = seconds * 1e9 / tokens;
+	double tokens_per_second = tokens / seconds;
+	if (options.csv) {
+		std::printf("%s,%s,%zu,%zu,%.4f,%.6g\n", name.c_str(), input.c_str(), tokens_per_iteration, iterations, ns_per_token, tokens_per_second);
+	}
+	else {
+		std::printf("%-28s %-24s %12zu %12.3f ns/token %14.6g tokens/s\n", name.c_str(), input.c_str(), iterations, ns_per_token, tokens_per_second);
+	}
+	std::fflush(stdout);
+}
+
+//Repeats function until min_time has passed and returns the number of iterations and the elapsed seconds
+template <typename Function>
+static std::pair<size_t, double> measure(double min_time, Function function) {
+	size_t iterations = 0;
+	auto start = std::chrono::steady_clock::now();
+	double seconds = 0.0;
+	do {
+		function();
+		++iterations;
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while (seconds < min_time);
+	return std::make_pair(iterations, seconds);
+}
+
+static std::vector<Benchmark> makeBenchmarks() {
+	return {
+		{ "Box::absorbWeight/green", [](const std::vector<uint32_t>& tokens) {
+			Box box(0.0, BoxType::GREEN);
+			double scores = 0.0;
+			for (uint32_t token : tokens) {
+				box.absorbWeight(token);
+				scores += box.getScore();
+			}
+			return scores;
+		} },
+		{ "Box::absorbWeight/blue", [](const std::vector<uint32_t>& tokens) {
+			Box box(0.2, BoxType::BLUE);
+			double scores = 0.0;
+			for (uint32_t token : tokens) {
+				box.absorbWeight(token);
+				scores += box.getScore();
+			}
+			return scores;
+		} },
+		{ "Player::takeTurn", [](const std::vector<uint32_t>& tokens) {
+			GameBoxes boxes;
+			Player player;
+			for (uint32_t token : tokens) {
+				player.takeTurn(token, boxes);
+			}
+			return player.getScore();
+		} },
+		{ "play", [](const std::vector<uint32_t>& tokens) {
+			return play(tokens).first;
+		} },
+		{ "playStatic", [](const std::vector<uint32_t>& tokens) {
+			return playStatic(tokens).first;
+		} },
+		{ "GameState::play", [](const std::vector<uint32_t>& tokens) {
+			GameState state;
+			return state.play(tokens.data(), tokens.data() + tokens.size()).first;
+		} },
+		{ "BoxSet::play", [](const std::vector<uint32_t>& tokens) {
+			BoxSet boxes(GameConfig::standard());
+			return boxes.play(tokens.data(), tokens.data() + tokens.size()).first;
+		} },
+		{ "ArenaBoxSet::play", [](const std::vector<uint32_t>& tokens) {
+			GameArena::Scope scope(GameArena::threadLocal());
+			ArenaBoxSet boxes(GameConfig::standard());
+			return boxes.play(tokens.data(), tokens.data() + tokens.size()).first;
+		} },
+		{ "ExactGame::play", [](const std::vector<uint32_t>& tokens) {
+			ExactGame game;
+			return game.play(tokens.data(), tokens.data() + tokens.size()).toDouble().first;
+		} },
+		{ "DeferredScoreGame::play", [](const std::vector<uint32_t>& tokens) {
+			DeferredScoreGame game;
+			game.play(tokens.data(), tokens.data() + tokens.size());
+			return game.getScores().first;
+		} },
+		{ "playWeights", [](const std::vector<uint32_t>& tokens) {
+			return playWeights(tokens).front();
+		} },
+		{ "RunLengthGame::play/equal", [](const std::vector<uint32_t>& tokens) {
+			if (tokens.empty()) {
+				return 0.0;
+			}
+			TokenRun run;
+			run.token = tokens.front();
+			run.count = tokens.size();
+			RunLengthGame game;
+			return game.play(&run, &run + 1).first;
+		} },
+	};
+}
+
+static void runTokenBenchmarks(const Options& options) {
+	auto benchmarks = makeBenchmarks();
+	for (Distribution distribution : { Distribution::FIBONACCI, Distribution::UNIFORM, Distribution::SORTED, Distribution::ADVERSARIAL }) {
+		for (size_t length = options.min_length; length <= options.max_length; length *= 10) {
+			std::vector<uint32_t> tokens;
+			std::string input = std::string(distributionName(distribution)) + "/" + std::to_string(length);
+			for (const auto& benchmark : benchmarks) {
+				if (benchmark.name.find(options.filter) == std::string::npos) {
+					continue;
+				}
+				if (tokens.empty()) {
+					tokens = makeTokens(distribution, length, 1);
+				}
+				auto measurement = measure(options.min_time, [&]() { benchmark_sink = benchmark.run(tokens); });
+				report(options, benchmark.name, input, length, measurement.first, measurement.second);
+			}
+			if (length > options.max_length / 10) {
+				break;
+			}
+		}
+	}
+}
+
+//Batch engines over games of uneven length, including the scaling of the work-stealing runner at 1, 2, 4, ... hardware threads
+static void runBatchBenchmarks(const Options& options) {
+	std::mt19937 generator(7);
+	std::uniform_int_distribution<size_t> length_distribution(0, 2000);
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets{ 0 };
+	for (size_t game = 0; game < 20000; ++game) {
+		auto game_tokens = makeTokens(Distribution::UNIFORM, length_distribution(generator), static_cast<uint32_t>(game));
+		tokens.insert(tokens.end(), game_tokens.begin(), game_tokens.end());
+		offsets.push_back(tokens.size());
+	}
+	std::vector<std::pair<double, double>> scores(offsets.size() - 1);
+	const std::string input = "uniform/20000 games";
+
+	auto runBatch = [&](const std::string& name, const std::function<void()>& play_batch) {
+		if (name.find(options.filter) == std::string::npos) {
+			return;
+		}
+		auto measurement = measure(options.min_time, [&]() {
+			play_batch();
+			benchmark_sink = scores.front().first;
+			});
+		report(options, name, input, tokens.size(), measurement.first, measurement.second);
+	};
+	runBatch("playBatch", [&]() { playBatch(tokens.data(), offsets.data(), scores.size(), scores.data()); });
+	ResultCache cache(scores.size());
+	cache.playBatch(tokens.data(), offsets.data(), scores.size(), scores.data());
+	runBatch("ResultCache::playBatch/hits", [&]() { cache.playBatch(tokens.data(), offsets.data(), scores.size(), scores.data()); });
+	runBatch("reduceBatch", [&]() { scores.front().first = reduceBatch(tokens.data(), offsets.data(), scores.size()).margins.mean; });
+	for (LaneKernel kernel : { LaneKernel::SCALAR, LaneKernel::AVX2, LaneKernel::AVX512 }) {
+		if (isLaneKernelSupported(kernel)) {
+			runBatch(std::string("playBatchLanes/") + laneKernelName(kernel), [&]() { playBatchLanes(tokens.data(), offsets.data(), scores.size(), scores.data(), kernel); });
+		}
+	}
+
+	//Simulated games of the same distributions, generated while they are played
+	SimulationConfig simulation;
+	simulation.min_length = 0;
+	simulation.max_length = 2000;
+	simulation.tokens = TokenDistribution::uniform(0, 1 << 20);
+	size_t simulated_tokens = 0;
+	for (uint64_t game = 0; game < scores.size(); ++game) {
+		simulated_tokens += SimulatedTokens(simulation, game).getLength();
+	}
+	auto runSimulation = [&](const std::string& name, const std::function<double()>& simulate) {
+		if (name.find(options.filter) == std::string::npos) {
+			return;
+		}
+		auto measurement = measure(options.min_time, [&]() { benchmark_sink = simulate(); });
+		report(options, name, "simulated/20000 games", simulated_tokens, measurement.first, measurement.second);
+	};
+	runSimulation("simulateBatch", [&]() { return simulateBatch(simulation, 0, scores.size()).margins.mean; });
+
+	unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned thread_count = 1;; thread_count = std::min(thread_count * 2, max_threads)) {
+		ParallelBatchRunner runner(thread_count);
+		std::string threads = "/threads:" + std::to_string(thread_count);
+		runBatch("ParallelBatchRunner::playBatch" + threads, [&]() { runner.playBatch(tokens.data(), offsets.data(), scores.size(), scores.data()); });
+		runBatch("ParallelBatchRunner::playBatchLanes" + threads, [&]() { runner.playBatchLanes(tokens.data(), offsets.data(), scores.size(), scores.data()); });
+		runBatch("ParallelBatchRunner::reduceBatch" + threads, [&]() { scores.front().first = runner.reduceBatch(tokens.data(), offsets.data(), scores.size()).margins.mean; });
+		runSimulation("ParallelBatchRunner::simulateBatch" + threads, [&]() { return runner.simulateBatch(simulation, 0, scores.size()).margins.mean; });
+		if (thread_count == max_threads) {
+			break;
+		}
+	}
+}
+
+static bool parseOption(const std::string& argument, const std::string& name, std::string& value) {
+	if (argument.compare(0, name.size() + 3, "--" + name + "=") != 0) {
+		return false;
+	}
+	value = argument.substr(name.size() + 3);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	for (int i = 1; i < argc; ++i) {
+		std::string argument = argv[i], value;
+		if (parseOption(argument, "filter", value)) {
+			options.filter = value;
+		}
+		else if (parseOption(argument, "min-length", value)) {
+			//lengths grow tenfold from min_length, an empty game would never grow
+			options.min_length = std::strtoull(value.c_str(), nullptr, 10);
+			if (options.min_length < 1) {
+				std::cerr << argv[0] << ": --min-length must be at least 1" << std::endl;
+				return 1;
+			}
+		}
+		else if (parseOption(argument, "max-length", value)) {
+			options.max_length = std::strtoull(value.c_str(), nullptr, 10);
+		}
+		else if (parseOption(argument, "min-time", value)) {
+			options.min_time = std::strtod(value.c_str(), nullptr);
+		}
+		else if (argument == "--csv") {
+			options.csv = true;
+		}
+		else {
+			std::cerr << "usage: " << argv[0] << " [--filter=<substring>] [--min-length=<tokens>] [--max-length=<tokens>] [--min-time=<seconds>] [--csv]" << std::endl;
+			return 1;
+		}
+	}
+
+#ifndef NDEBUG
+	std::cerr << "warning: benchmarks built without NDEBUG, configure with -DCMAKE_BUILD_TYPE=Release for meaningful numbers" << std::endl;
+#endif
+	if (options.csv) {
+		std::printf("benchmark,input,tokens_per_iteration,iterations,ns_per_token,tokens_per_second\n");
+	}
+	runTokenBenchmarks(options);
+	runBatchBenchmarks(options);
+	if (Instrumentation::isEnabled()) {
+		Instrumentation::collect().writeSummary(std::cerr);
+	}
+	return 0;
+}
@@ -0,0 +1,119 @@
+/**
+ * @file asaphus_cluster.cpp
+ * @copyright Copyright (c) 2022 Asaphus Vision GmbH
+ *
+ * Coordinator and worker of distributed scoring as in asaphus/cluster.hpp. Every node maps the same corpus file.
+ * The coordinator writes the scores to the output file and prints the statistics once all shards are done; with a
+ * checkpoint it resumes an interrupted run, SIGINT and SIGTERM interrupt it after writing a checkpoint.
+ *
+ * Usage: asaphus_cluster coordinator --corpus=<path> --output=<path> [--checkpoint=<path>] [--port=<port>]
+ *                        [--shard-games=<count>] [--straggler-timeout-ms=<milliseconds>] [--frame-timeout-ms=<milliseconds>]
+ *        asaphus_cluster worker --corpus=<path> --host=<IPv4 address> [--port=<port>] [--threads=<count>]
+ */
+
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "asaphus/cluster.hpp"
+
+static ClusterCoordinator* running_coordinator = nullptr;
+
+static void stopCoordinator(int) {
+	if (running_coordinator != nullptr) {
+		running_coordinator->stop();
+	}
+}
+
+static bool parseOption(const std::string& argument, const std::string& name, std::string& value) {
+	if (argument.compare(0, name.size() + 3, "--" + name + "=") != 0) {
+		return false;
+	}
+	value = argument.substr(name.size() + 3);
+	return true;
+}
+
+static int usage(const char* program) {
+	std::cerr << "usage: " << program << " coordinator --corpus=<path> --output=<path> [--checkpoint=<path>] [--port=<port>]"
+		" [--shard-games=<count>] [--straggler-timeout-ms=<milliseconds>] [--frame-timeout-ms=<milliseconds>]\n"
+		"       " << program << " worker --corpus=<path> --host=<IPv4 address> [--port=<port>] [--threads=<count>]" << std::endl;
+	return 1;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		return usage(argv[0]);
+	}
+	const std::string mode = argv[1];
+	std::string corpus_path, output_path, host, value;
+	ClusterCoordinator::Options options;
+	unsigned thread_count = 0;
+	for (int i = 2; i < argc; ++i) {
+		std::string argument = argv[i];
+		if (parseOption(argument, "corpus", value)) {
+			corpus_path = value;
+		}
+		else if (parseOption(argument, "output", value)) {
+			output_path = value;
+		}
+		else if (parseOption(argument, "checkpoint", value)) {
+			options.checkpoint_path = value;
+		}
+		else if (parseOption(argument, "host", value)) {
+			host = value;
+		}
+		else if (parseOption(argument, "port", value)) {
+			options.port = static_cast<uint16_t>(std::strtoul(value.c_str(), nullptr, 10));
+		}
+		else if (parseOption(argument, "shard-games", value)) {
+			options.shard_games = std::strtoull(value.c_str(), nullptr, 10);
+		}
+		else if (parseOption(argument, "straggler-timeout-ms", value)) {
+			options.straggler_timeout = std::chrono::milliseconds(std::strtoull(value.c_str(), nullptr, 10));
+		}
+		else if (parseOption(argument, "frame-timeout-ms", value)) {
+			options.frame_timeout = std::chrono::milliseconds(std::strtoull(value.c_str(), nullptr, 10));
+		}
+		else if (parseOption(argument, "threads", value)) {
+			thread_count = static_cast<unsigned>(std::strtoul(value.c_str(), nullptr, 10));
+		}
+		else {
+			return usage(argv[0]);
+		}
+	}
+
+	std::signal(SIGPIPE, SIG_IGN);
+	try {
+		if (mode == "coordinator" && !corpus_path.empty() && !output_path.empty()) {
+			ClusterCoordinator coordinator(corpus_path, output_path, options);
+			running_coordinator = &coordinator;
+			std::signal(SIGINT, stopCoordinator);
+			std::signal(SIGTERM, stopCoordinator);
+			const ShardScheduler& scheduler = coordinator.getScheduler();
+			std::cerr << "coordinating " << scheduler.getShardCount() - scheduler.getDoneCount() << " of " << scheduler.getShardCount()
+				<< " shards on port " << coordinator.getPort() << std::endl;
+			coordinator.run();
+			running_coordinator = nullptr;
+			if (!scheduler.isDone()) {
+				std::cerr << "interrupted after " << scheduler.getDoneCount() << " of " << scheduler.getShardCount() << " shards" << std::endl;
+				return 1;
+			}
+			std::cerr << scheduler.getRedispatchCount() << " stragglers re-dispatched" << std::endl;
+			coordinator.getStatistics().writeSummary(std::cout);
+		}
+		else if (mode == "worker" && !corpus_path.empty() && !host.empty()) {
+			ClusterWorker worker(host, options.port, corpus_path, thread_count);
+			std::cerr << "played " << worker.run() << " shards" << std::endl;
+		}
+		else {
+			return usage(argv[0]);
+		}
+	}
+	catch (const std::exception& error) {
+		running_coordinator = nullptr;
+		std::cerr << error.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
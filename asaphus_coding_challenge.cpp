@@ -36,133 +36,35 @@
  */
 
 #include <algorithm>
+#include <cmath>
 #include <cstdint>
-#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
 #include <limits>
-#include <list>
 #include <memory>
 #include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <unordered_set>
 #include <vector>
-#include <cmath>
-
-#define CATCH_CONFIG_MAIN
-#include <catch2/catch.hpp>
-
-enum class BoxType { GREEN, BLUE };
-
-class Box {
-public:
-	explicit Box(double initial_weight) : weight_(initial_weight) {}
-	static std::unique_ptr<Box> makeGreenBox(double initial_weight);
-	static std::unique_ptr<Box> makeBlueBox(double initial_weight);
-	bool operator<(const Box& rhs) const { return weight_ < rhs.weight_; }
-
-	double getScore() const { return score_; }
-	double getWeight() const { return weight_; }
-	void absorbWeight(double weight);
-
-	BoxType getBoxType() const { return type_; }
-	void setBoxType(BoxType newType) { type_ = newType; }
-
-protected:
-	double weight_;
-	double score_ = 0.0;
-	std::list<double> absorbed_weights_;
-	BoxType type_ = BoxType::GREEN;
-};
-
-//Method to absorb weight into the box
-void Box::absorbWeight(double weight) {
-	if (this->getBoxType() == BoxType::GREEN) {
-		absorbed_weights_.emplace_back(weight);
-		double mean = 0;
-		auto list_size = absorbed_weights_.size();
-		auto last_item_iter = absorbed_weights_.end();
-		if (list_size >= 3) {
-			auto third_last_item_iter = last_item_iter;
-			std::advance(third_last_item_iter, -3);
-			mean = std::accumulate(third_last_item_iter, last_item_iter, 0.0) / 3; //Calculating mean of last three elements when box absorbed more than 3 weights
-		}
-		else {
-			mean = std::accumulate(absorbed_weights_.begin(), last_item_iter, 0.0) / list_size; //Calculating mean of all elements when box absorbed less than 3 weights
-		}
-		score_ = std::pow(mean, 2);
-		this->weight_ += weight;
-	}
-	else {
-		if (!absorbed_weights_.empty()) {
-			if (absorbed_weights_.front() > weight) { absorbed_weights_.emplace_front(weight); } // adding smallest weight as first element of list
-			else if (absorbed_weights_.back() < weight) { absorbed_weights_.emplace_back(weight); } // adding largest weight as last element of list
-			else {
-				auto insertion_point = absorbed_weights_.end();
-				std::advance(insertion_point, -3);
-				absorbed_weights_.insert(insertion_point, weight); //adding all other weights in the middle of the list
-			}
-		}
-		else {
-			absorbed_weights_.emplace_back(weight);  //adding first element to the list
-		}
-		auto first_item = absorbed_weights_.front();
-		auto last_item = absorbed_weights_.back();
-		double sum = first_item + last_item;
-		score_ = ((sum) * (sum + 1)) / 2 + last_item; //calculating Cantor's pairing function of the smallest and largest weight 
-		this->weight_ += weight;
-	}
-}
 
-//Initializing a green box
-std::unique_ptr<Box> Box::makeGreenBox(double initial_weight) {
-	return std::make_unique<Box>(initial_weight);
-}
+#include "asaphus/async.hpp"
+#include "asaphus/engine.hpp"
+#ifndef _WIN32
+#include "asaphus/cluster.hpp"
+#include "asaphus/service.hpp"
 
-//Initializing a blue box
-std::unique_ptr<Box> Box::makeBlueBox(double initial_weight) {
-	std::unique_ptr<Box> blueBox = std::make_unique<Box>(initial_weight);
-	blueBox->setBoxType(BoxType::BLUE);
-	return blueBox;
-}
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#endif
 
-class Player {
-public:
-	void takeTurn(uint32_t input_weight, std::vector<std::unique_ptr<Box>>& boxes) {
-		//finding the box with the lowest weight
-		auto min_box = std::min_element(boxes.begin(), boxes.end(), [](const auto& a, const auto& b) {
-			return *a < *b;
-			});
-		(*min_box)->absorbWeight(static_cast<double>(input_weight));
-		score_ += (*min_box)->getScore();
-	}
-
-	double getScore() const { return score_; }
-
-private:
-	double score_ = 0.0;
-};
-
-std::pair<double, double> play(const std::vector<uint32_t>& input_weights) {
-	std::vector<std::unique_ptr<Box>> boxes;
-	boxes.emplace_back(Box::makeGreenBox(0.0));
-	boxes.emplace_back(Box::makeGreenBox(0.1));
-	boxes.emplace_back(Box::makeBlueBox(0.2));
-	boxes.emplace_back(Box::makeBlueBox(0.3));
-
-	Player player_A, player_B;
-
-	//Logic for Players taking turns
-	bool is_player_A_turn = true;
-	for (uint32_t weight : input_weights) {
-		if (is_player_A_turn) {
-			player_A.takeTurn(weight, boxes);
-		}
-		else {
-			player_B.takeTurn(weight, boxes);
-		}
-		is_player_A_turn = !is_player_A_turn;
-	}
-
-	std::cout << "Scores: player A " << player_A.getScore() << ", player B " << player_B.getScore() << std::endl;
-	return std::make_pair(player_A.getScore(), player_B.getScore());
-}
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch.hpp>
 
 TEST_CASE("Final scores for first 4 Fibonacci numbers", "[fibonacci4]") {
 	std::vector<uint32_t> inputs{ 1, 1, 2, 3 };
@@ -215,4 +117,1404 @@ TEST_CASE("Test play() function with zero weights", "[play]") {
 	auto result = play(inputs);
 	REQUIRE(result.first == 0.0);
 	REQUIRE(result.second == 0.0);
-}
\ No newline at end of file
+}
+
+TEST_CASE("Test green box scores only the three latest weights", "[green]") {
+	std::unique_ptr<Box> green_box = Box::makeGreenBox(0.0);
+	for (uint32_t weight = 1; weight <= 1000; ++weight) {
+		green_box->absorbWeight(weight);
+	}
+	REQUIRE(green_box->getScore() == 999.0 * 999.0);
+	REQUIRE(green_box->getWeight() == 500500.0);
+}
+
+TEST_CASE("Test blue box keeps the ends of its weight list", "[blue]") {
+	std::vector<uint32_t> inputs{ 1, 5, 3, 2, 4 };
+	std::unique_ptr<Box> blue_box = Box::makeBlueBox(0.0);
+	double expected_scores[] = { 4, 26, 13, 18, 25 };
+
+	for (size_t i = 0; i < inputs.size(); ++i) {
+		blue_box->absorbWeight(inputs[i]);
+		REQUIRE(blue_box->getScore() == expected_scores[i]);
+	}
+	static_assert(std::is_trivially_copyable<Box>::value, "box state must not own heap memory");
+}
+
+TEST_CASE("Test playBatch() matches play() for every game", "[batch]") {
+	std::vector<std::vector<uint32_t>> games{ {}, { 1, 1, 2, 3 }, { 1, 1, 2, 3, 5, 8, 13, 21 }, { 7 }, { 4, 4, 4, 4, 4, 4, 4 } };
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets{ 0 };
+	for (const auto& game : games) {
+		tokens.insert(tokens.end(), game.begin(), game.end());
+		offsets.push_back(tokens.size());
+	}
+
+	auto scores = playBatch(tokens, offsets);
+	REQUIRE(scores.size() == games.size());
+	for (size_t i = 0; i < games.size(); ++i) {
+		REQUIRE(scores[i] == play(games[i]));
+	}
+	REQUIRE(playBatch(tokens, {}).empty());
+	REQUIRE_THROWS_AS(playBatch(tokens, { 0, tokens.size() + 1 }), std::invalid_argument);
+}
+
+//Random corpus whose game lengths vary between 0 and max_length tokens
+static void makeRandomCorpus(size_t game_count, size_t max_length, uint32_t seed, std::vector<uint32_t>& tokens, std::vector<uint64_t>& offsets) {
+	std::mt19937 generator(seed);
+	std::uniform_int_distribution<size_t> length_distribution(0, max_length);
+	std::uniform_int_distribution<uint32_t> token_distribution(0, 1000);
+	tokens.clear();
+	offsets.assign(1, 0);
+	for (size_t game = 0; game < game_count; ++game) {
+		size_t length = length_distribution(generator);
+		for (size_t i = 0; i < length; ++i) {
+			tokens.push_back(token_distribution(generator));
+		}
+		offsets.push_back(tokens.size());
+	}
+}
+
+TEST_CASE("Test parallel playBatch() is independent of the thread count", "[parallel]") {
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets;
+	makeRandomCorpus(500, 200, 42, tokens, offsets);
+	auto expected = playBatch(tokens, offsets);
+
+	for (unsigned thread_count : { 1u, 2u, 3u, 7u }) {
+		ParallelBatchRunner runner(thread_count);
+		REQUIRE(runner.getThreadCount() == thread_count);
+		REQUIRE(runner.playBatch(tokens, offsets) == expected);
+	}
+	REQUIRE(ParallelBatchRunner(4).playBatch(tokens, { 0 }).empty());
+}
+
+TEST_CASE("Test compile-time box configuration matches play()", "[static]") {
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets;
+	makeRandomCorpus(200, 100, 3, tokens, offsets);
+
+	for (size_t game = 0; game + 1 < offsets.size(); ++game) {
+		std::vector<uint32_t> inputs(tokens.begin() + offsets[game], tokens.begin() + offsets[game + 1]);
+		REQUIRE(playStatic(inputs) == play(inputs));
+	}
+
+	StandardStaticGame game;
+	REQUIRE(game.getWeight(1) == 0.1);
+	REQUIRE(game.takeTurn(5) == 25.0);
+	REQUIRE(game.getWeight(0) == 5.0);
+	game.reset();
+	REQUIRE(game.getWeight(0) == 0.0);
+}
+
+TEST_CASE("Test tournament selection picks the same boxes as std::min_element", "[selector]") {
+	std::mt19937 generator(11);
+	std::vector<std::unique_ptr<Box>> boxes, reference_boxes;
+	std::vector<double> weights;
+	for (size_t i = 0; i < 300; ++i) {
+		double weight = static_cast<double>(generator() % 20); //many ties
+		boxes.emplace_back(i % 2 == 0 ? Box::makeGreenBox(weight) : Box::makeBlueBox(weight));
+		reference_boxes.emplace_back(i % 2 == 0 ? Box::makeGreenBox(weight) : Box::makeBlueBox(weight));
+		weights.push_back(weight);
+	}
+	MinWeightSelector selector(weights.data(), weights.size());
+	REQUIRE(selector.size() == 300);
+
+	Player player, reference_player;
+	for (size_t turn = 0; turn < 5000; ++turn) {
+		uint32_t token = generator() % 4;
+		player.takeTurn(token, boxes, selector);
+		reference_player.takeTurn(token, reference_boxes);
+		REQUIRE(player.getScore() == reference_player.getScore());
+	}
+	for (size_t i = 0; i < boxes.size(); ++i) {
+		REQUIRE(boxes[i]->getWeight() == reference_boxes[i]->getWeight());
+		REQUIRE(selector.getWeight(i) == boxes[i]->getWeight());
+	}
+
+	double single_weight = 1.5;
+	MinWeightSelector single(&single_weight, 1);
+	REQUIRE(single.minIndex() == 0);
+	single.update(0, 2.5);
+	REQUIRE(single.minIndex() == 0);
+}
+
+TEST_CASE("Test configurable box sets", "[config]") {
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets;
+	makeRandomCorpus(100, 100, 5, tokens, offsets);
+
+	//the standard configuration of a BoxSet plays like play()
+	BoxSet standard_boxes(GameConfig::standard());
+	for (size_t game = 0; game + 1 < offsets.size(); ++game) {
+		std::vector<uint32_t> inputs(tokens.begin() + offsets[game], tokens.begin() + offsets[game + 1]);
+		standard_boxes.reset();
+		REQUIRE(standard_boxes.play(tokens.data() + offsets[game], tokens.data() + offsets[game + 1]) == play(inputs));
+		REQUIRE(play(inputs, GameConfig::standard()) == play(inputs));
+	}
+
+	//a larger configuration matches runtime boxes selected with std::min_element
+	GameConfig config;
+	std::vector<std::unique_ptr<Box>> boxes;
+	for (size_t i = 0; i < 100; ++i) {
+		double initial_weight = (i % 7) * 0.5;
+		if (i % 3 == 0) {
+			config.addBlueBox(initial_weight);
+			boxes.emplace_back(Box::makeBlueBox(initial_weight));
+		}
+		else {
+			config.addGreenBox(initial_weight);
+			boxes.emplace_back(Box::makeGreenBox(initial_weight));
+		}
+	}
+	REQUIRE(!config.isStandard());
+	Player player_A, player_B;
+	for (size_t i = 0; i < tokens.size(); ++i) {
+		(i % 2 == 0 ? player_A : player_B).takeTurn(tokens[i], boxes);
+	}
+	auto scores = play(tokens, config);
+	REQUIRE(scores.first == player_A.getScore());
+	REQUIRE(scores.second == player_B.getScore());
+
+	auto batch_scores = playBatch(tokens, offsets, config);
+	REQUIRE(ParallelBatchRunner(3).playBatch(tokens, offsets, config) == batch_scores);
+	for (size_t game = 0; game + 1 < offsets.size(); ++game) {
+		std::vector<uint32_t> inputs(tokens.begin() + offsets[game], tokens.begin() + offsets[game + 1]);
+		REQUIRE(batch_scores[game] == play(inputs, config));
+	}
+	REQUIRE_THROWS_AS(BoxSet(GameConfig()), std::invalid_argument);
+}
+
+TEST_CASE("Test result sinks", "[sink]") {
+	std::vector<uint32_t> tokens{ 1, 1, 2, 3, 1, 1, 2, 3, 5, 8, 13, 21 };
+	std::vector<uint64_t> offsets{ 0, 4, 12, 12 };
+
+	std::ostringstream text;
+	{
+		TextSink sink(text, 16);
+		playBatch(tokens.data(), offsets.data(), 3, sink);
+		REQUIRE(text.str().size() >= 16); //writes once the buffer is full
+
+		std::vector<uint32_t> inputs{ 1, 1, 2, 3 };
+		REQUIRE(play(inputs, sink) == play(inputs));
+	}
+	REQUIRE(text.str() == "Scores: player A 13, player B 25\n"
+		"Scores: player A 155, player B 366.25\n"
+		"Scores: player A 0, player B 0\n"
+		"Scores: player A 13, player B 25\n");
+
+	std::ostringstream binary;
+	BinarySink binary_sink(binary);
+	playBatch(tokens.data(), offsets.data(), 3, binary_sink);
+	REQUIRE(binary.str().empty());
+	binary_sink.flush();
+	REQUIRE(binary.str().size() == 3 * 2 * sizeof(double));
+	double scores[6];
+	std::memcpy(scores, binary.str().data(), sizeof(scores));
+	REQUIRE(scores[2] == 155.0);
+	REQUIRE(scores[3] == 366.25);
+
+	size_t games = 0;
+	CallbackSink callback_sink([&](const std::pair<double, double>*, size_t count) { games += count; });
+	playBatch(tokens.data(), offsets.data(), 3, callback_sink);
+	REQUIRE(games == 3);
+
+	ParallelBatchRunner(2).playBatch(tokens.data(), offsets.data(), 3, callback_sink);
+	REQUIRE(games == 6);
+
+	NullSink null_sink;
+	playBatch(tokens.data(), offsets.data(), 3, null_sink);
+}
+
+TEST_CASE("Test streaming sessions match play()", "[stream]") {
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets;
+	makeRandomCorpus(50, 300, 9, tokens, offsets);
+	std::mt19937 generator(9);
+
+	for (size_t game = 0; game + 1 < offsets.size(); ++game) {
+		std::vector<uint32_t> inputs(tokens.begin() + offsets[game], tokens.begin() + offsets[game + 1]);
+		auto expected = play(inputs);
+
+		GameSession session;
+		size_t position = 0;
+		while (position < inputs.size()) {
+			size_t chunk = std::min<size_t>(generator() % 8, inputs.size() - position);
+			session.feed(inputs.data() + position, chunk);
+			position += chunk;
+		}
+		REQUIRE(session.getScores() == expected);
+		REQUIRE(session.isPlayerATurn() == (inputs.size() % 2 == 0));
+
+		std::stringstream stream;
+		for (uint32_t token : inputs) {
+			stream << token << ' ';
+		}
+		REQUIRE(play(std::istream_iterator<uint32_t>(stream), std::istream_iterator<uint32_t>()) == expected);
+
+		size_t next = 0;
+		session.reset();
+		session.feedFrom([&](uint32_t& token) {
+			if (next == inputs.size()) {
+				return false;
+			}
+			token = inputs[next++];
+			return true;
+			});
+		REQUIRE(session.getScores() == expected);
+	}
+}
+
+TEST_CASE("Test memory-mapped token corpus", "[corpus]") {
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets;
+	makeRandomCorpus(300, 50, 13, tokens, offsets);
+	const std::string path = "asaphus_corpus_test.bin";
+	writeTokenCorpus(path, tokens, offsets);
+
+	{
+		TokenCorpus corpus(path);
+		REQUIRE(corpus.getGameCount() == offsets.size() - 1);
+		REQUIRE(corpus.getTokenCount() == tokens.size());
+
+		std::vector<std::pair<double, double>> scores(corpus.getGameCount());
+		ParallelBatchRunner(2).playBatch(corpus.getTokens(), corpus.getOffsets(), corpus.getGameCount(), scores.data());
+		REQUIRE(scores == playBatch(tokens, offsets));
+	}
+
+	//an interior offset past the payload, then one within it going backwards
+	std::vector<uint64_t> corrupted = offsets;
+	corrupted[1] = tokens.size() + 1000;
+	for (int round = 0; round < 2; ++round) {
+		std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+		file.seekp(sizeof(TokenCorpusHeader));
+		file.write(reinterpret_cast<const char*>(corrupted.data()), static_cast<std::streamsize>(corrupted.size() * sizeof(uint64_t)));
+		file.close();
+		REQUIRE_THROWS_AS(TokenCorpus(path), std::runtime_error);
+		corrupted[1] = tokens.size(); //within the payload, but past the start of the next game
+	}
+
+	std::ofstream(path, std::ios::binary | std::ios::trunc) << "not a corpus at all, but long enough for a header";
+	REQUIRE_THROWS_AS(TokenCorpus(path), std::runtime_error);
+	std::remove(path.c_str());
+	REQUIRE_THROWS_AS(TokenCorpus(path), std::runtime_error);
+	REQUIRE_THROWS_AS(writeTokenCorpus(path, tokens, {}), std::invalid_argument);
+	REQUIRE_THROWS_AS(writeTokenCorpus(path, {}, {}), std::invalid_argument);
+}
+
+TEST_CASE("Test lane-parallel engine matches play()", "[lanes]") {
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets;
+	makeRandomCorpus(333, 120, 17, tokens, offsets);
+	std::vector<uint32_t> large_tokens{ 0, 0, 4294967295u, 4294967295u, 7, 0, 4294967295u, 3, 3, 3 };
+	tokens.insert(tokens.end(), large_tokens.begin(), large_tokens.end());
+	offsets.push_back(tokens.size());
+	auto expected = playBatch(tokens, offsets);
+	size_t game_count = offsets.size() - 1;
+
+	std::vector<std::pair<double, double>> scores(game_count);
+	LaneBatchEngine<ScalarLanes> scalar_lanes;
+	scalar_lanes.playBatch(tokens.data(), offsets.data(), game_count, scores.data());
+	REQUIRE(scores == expected);
+	LaneBatchEngine<DefaultLanes> default_lanes;
+	default_lanes.playBatch(tokens.data(), offsets.data(), 3, scores.data()); //possibly fewer games than lanes
+	REQUIRE(std::equal(scores.begin(), scores.begin() + 3, expected.begin()));
+
+	std::fill(scores.begin(), scores.end(), std::make_pair(-1.0, -1.0));
+	playBatchLanes(tokens.data(), offsets.data(), game_count, scores.data());
+	REQUIRE(scores == expected);
+	std::fill(scores.begin(), scores.end(), std::make_pair(-1.0, -1.0));
+	ParallelBatchRunner(3).playBatchLanes(tokens.data(), offsets.data(), game_count, scores.data());
+	REQUIRE(scores == expected);
+
+	//every kernel the CPU runs plays like the reference, the others refuse to run
+	REQUIRE(isLaneKernelSupported(LaneKernel::SCALAR));
+	REQUIRE(isLaneKernelSupported(selectLaneKernel()));
+	for (LaneKernel kernel : { LaneKernel::SCALAR, LaneKernel::AVX2, LaneKernel::AVX512 }) {
+		std::fill(scores.begin(), scores.end(), std::make_pair(-1.0, -1.0));
+		if (isLaneKernelSupported(kernel)) {
+			playBatchLanes(tokens.data(), offsets.data(), game_count, scores.data(), kernel);
+			REQUIRE(scores == expected);
+		}
+		else {
+			REQUIRE_THROWS_AS(playBatchLanes(tokens.data(), offsets.data(), game_count, scores.data(), kernel), std::invalid_argument);
+		}
+	}
+}
+
+TEST_CASE("Test exact integer engine", "[exact]") {
+	std::vector<uint32_t> fibonacci{ 1, 1, 2, 3, 5, 8, 13, 21 };
+	ExactGame game;
+	auto scores = game.play(fibonacci.data(), fibonacci.data() + 4);
+	REQUIRE(scores.numerator_A == 13 * 36);
+	REQUIRE(scores.numerator_B == 25 * 36);
+	game.reset();
+	scores = game.play(fibonacci.data(), fibonacci.data() + fibonacci.size());
+	REQUIRE(scores.toDouble() == std::make_pair(155.0, 366.25));
+	REQUIRE(!scores.overflow);
+
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets;
+	makeRandomCorpus(200, 100, 21, tokens, offsets);
+	GameConfig config;
+	config.addBlueBox(1.5).addGreenBox(0.25).addGreenBox(2.0).addBlueBox(0.25).addGreenBox(0.75);
+	for (const GameConfig& game_config : { GameConfig::standard(), config }) {
+		std::vector<ExactScores> exact_scores(offsets.size() - 1);
+		playBatchExact(tokens.data(), offsets.data(), exact_scores.size(), exact_scores.data(), game_config);
+		auto expected = playBatch(tokens, offsets, game_config);
+		for (size_t i = 0; i < exact_scores.size(); ++i) {
+			REQUIRE(!exact_scores[i].overflow);
+			REQUIRE(exact_scores[i].toDouble().first == Approx(expected[i].first).epsilon(1e-12));
+			REQUIRE(exact_scores[i].toDouble().second == Approx(expected[i].second).epsilon(1e-12));
+		}
+	}
+
+	std::vector<uint32_t> large(8, 4294967295u);
+	game.reset();
+	game.play(large.data(), large.data() + large.size());
+	REQUIRE(game.getScores().overflow == (sizeof(ExactInt) == sizeof(uint64_t)));
+	REQUIRE_THROWS_AS(ExactGame(GameConfig().addGreenBox(-1.0)), std::invalid_argument);
+}
+
+TEST_CASE("Test resuming games from a snapshot", "[snapshot]") {
+	static_assert(std::is_trivially_copyable<GameSnapshot>::value, "snapshots are copied with the game state");
+	std::vector<uint32_t> prefix{ 1, 1, 2, 3, 5, 8, 13 };
+	GameSession session;
+	session.feed(prefix.data(), prefix.size());
+	GameSnapshot snapshot = session.snapshot();
+	REQUIRE(!snapshot.is_player_A_turn);
+
+	std::vector<std::vector<uint32_t>> suffixes{ {}, { 21 }, { 0, 0, 0 }, { 34, 55, 89, 144 }, { 7, 1, 7, 1, 7 } };
+	for (const auto& suffix : suffixes) {
+		std::vector<uint32_t> inputs(prefix);
+		inputs.insert(inputs.end(), suffix.begin(), suffix.end());
+		REQUIRE(resume(snapshot, suffix) == play(inputs));
+	}
+	REQUIRE(resume(snapshot, { 21 }) == std::make_pair(155.0, 366.25));
+	REQUIRE(session.getScores() == resume(snapshot, {}));
+}
+
+TEST_CASE("Test prefix-sharing batch matches playBatch()", "[prefix]") {
+	std::mt19937 generator(23);
+	std::vector<std::vector<uint32_t>> prefixes(5);
+	for (auto& prefix : prefixes) {
+		for (size_t i = generator() % 200; i > 0; --i) {
+			prefix.push_back(generator() % 50);
+		}
+	}
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets{ 0 };
+	for (size_t game = 0; game < 300; ++game) {
+		const auto& prefix = prefixes[generator() % prefixes.size()];
+		size_t prefix_length = generator() % (prefix.size() + 1);
+		tokens.insert(tokens.end(), prefix.begin(), prefix.begin() + prefix_length);
+		for (size_t i = generator() % 4; i > 0; --i) {
+			tokens.push_back(generator() % 3);
+		}
+		offsets.push_back(tokens.size());
+	}
+	offsets.push_back(tokens.size()); //empty game
+
+	auto expected = playBatch(tokens, offsets);
+	std::vector<std::pair<double, double>> scores(expected.size());
+	size_t played_tokens = playBatchPrefixShared(tokens.data(), offsets.data(), scores.size(), scores.data());
+	REQUIRE(scores == expected);
+	REQUIRE(played_tokens < tokens.size() / 4);
+	REQUIRE(playBatchPrefixShared(tokens.data(), offsets.data(), 0, scores.data()) == 0);
+}
+
+//Best score difference for the player to move by trying every tied box
+static double bruteForceTieMargin(std::vector<Box> boxes, const std::vector<uint32_t>& tokens, size_t turn) {
+	if (turn == tokens.size()) {
+		return 0.0;
+	}
+	double min_weight = std::min_element(boxes.begin(), boxes.end())->getWeight();
+	double best = -std::numeric_limits<double>::infinity();
+	for (size_t box = 0; box < boxes.size(); ++box) {
+		if (boxes[box].getWeight() == min_weight) {
+			std::vector<Box> child = boxes;
+			child[box].absorbWeight(tokens[turn]);
+			best = std::max(best, child[box].getScore() - bruteForceTieMargin(child, tokens, turn + 1));
+		}
+	}
+	return best;
+}
+
+TEST_CASE("Test tie search", "[ties]") {
+	SECTION("standard boxes are never tied") {
+		std::vector<uint32_t> inputs{ 1, 1, 2, 3, 5, 8, 13, 21, 0, 0, 7 };
+		auto result = TieSearch().search(inputs);
+		REQUIRE(result.scores == play(inputs));
+		REQUIRE(result.boxes.size() == inputs.size());
+	}
+	SECTION("tied boxes") {
+		GameConfig config;
+		config.addGreenBox(0.0).addGreenBox(0.0).addBlueBox(0.0).addBlueBox(0.0);
+		std::mt19937 generator(29);
+		for (int sequence = 0; sequence < 40; ++sequence) {
+			std::vector<uint32_t> inputs(generator() % 9);
+			for (auto& input : inputs) {
+				input = generator() % 3;
+			}
+			std::vector<Box> boxes{ Box(0.0), Box(0.0), Box(0.0, BoxType::BLUE), Box(0.0, BoxType::BLUE) };
+			double margin = bruteForceTieMargin(boxes, inputs, 0);
+
+			for (size_t thread_count : { 1, 3 }) {
+				auto result = TieSearch(config, thread_count).search(inputs);
+				REQUIRE(result.scores.first - result.scores.second == Approx(margin));
+				//the reported boxes are a legal line with the reported scores
+				std::pair<double, double> scores(0.0, 0.0);
+				for (size_t turn = 0; turn < inputs.size(); ++turn) {
+					Box& box = boxes[result.boxes[turn]];
+					REQUIRE(box.getWeight() == std::min_element(boxes.begin(), boxes.end())->getWeight());
+					box.absorbWeight(inputs[turn]);
+					(turn % 2 == 0 ? scores.first : scores.second) += box.getScore();
+				}
+				REQUIRE(scores == result.scores);
+				boxes = { Box(0.0), Box(0.0), Box(0.0, BoxType::BLUE), Box(0.0, BoxType::BLUE) };
+			}
+		}
+	}
+	REQUIRE_THROWS_AS(TieSearch(GameConfig()), std::invalid_argument);
+}
+
+TEST_CASE("Test game arena", "[arena]") {
+	GameArena arena(256);
+	SECTION("allocations are aligned and rewinding reuses the blocks") {
+		GameArena::Mark start = arena.mark();
+		void* first = arena.allocate(3, 1);
+		void* aligned = arena.allocate(sizeof(double), alignof(double));
+		REQUIRE(reinterpret_cast<uintptr_t>(aligned) % alignof(double) == 0);
+		REQUIRE(arena.allocate(1000, 64) != nullptr);
+		size_t capacity = arena.getCapacity();
+		REQUIRE(capacity >= 1256);
+		arena.rewind(start);
+		REQUIRE(arena.allocate(3, 1) == first);
+		arena.allocate(1000, 64);
+		REQUIRE(arena.getCapacity() == capacity);
+	}
+	SECTION("arena box sets play like box sets") {
+		GameConfig config;
+		config.addGreenBox(0.5).addBlueBox(0.25).addGreenBox(0.0);
+		std::vector<uint32_t> inputs{ 4, 9, 1, 0, 7, 7, 3, 12, 5 };
+		BoxSet boxes(config);
+		auto expected = boxes.play(inputs.data(), inputs.data() + inputs.size());
+		size_t capacity = 0;
+		for (int game = 0; game < 3; ++game) {
+			GameArena::Scope scope(arena);
+			ArenaBoxSet arena_boxes(config, ArenaAllocator<double>(arena));
+			REQUIRE(arena_boxes.play(inputs.data(), inputs.data() + inputs.size()) == expected);
+			if (game == 0) {
+				capacity = arena.getCapacity();
+			}
+			REQUIRE(arena.getCapacity() == capacity);
+		}
+		REQUIRE(play(inputs, config) == expected);
+	}
+	SECTION("arena allocators work with standard containers") {
+		std::vector<uint64_t, ArenaAllocator<uint64_t>> values{ ArenaAllocator<uint64_t>(arena) };
+		for (uint64_t value = 0; value < 100; ++value) {
+			values.push_back(value);
+		}
+		REQUIRE(std::accumulate(values.begin(), values.end(), uint64_t(0)) == 4950);
+		REQUIRE(values.get_allocator() == ArenaAllocator<double>(arena));
+		REQUIRE(values.get_allocator() != ArenaAllocator<double>(GameArena::threadLocal()));
+	}
+}
+
+TEST_CASE("Test instrumentation", "[instrumentation]") {
+	GameCounters counters;
+	counters.recordTurn(2, 4.0, true, 10);
+	GameCounters other;
+	other.recordTurn(0, 1.5, false, 20);
+	other.recordTurn(2, 0.5, false, 30);
+	counters.merge(other);
+	REQUIRE(counters.turns == 3);
+	REQUIRE(counters.tied_turns == 1);
+	REQUIRE(counters.turn_cycles == 60);
+	REQUIRE(counters.absorptions == std::vector<uint64_t>{ 1, 0, 2 });
+	REQUIRE(counters.contributions == std::vector<double>{ 1.5, 0.0, 4.5 });
+	std::ostringstream summary;
+	counters.writeSummary(summary);
+	REQUIRE(summary.str().find("box 2: 2 tokens, score contribution 4.5\n") != std::string::npos);
+
+	Instrumentation::reset();
+	std::vector<uint32_t> inputs{ 1, 1, 2, 3, 5, 8, 13, 21 };
+	auto scores = play(inputs);
+	std::vector<uint32_t> tokens{ 0, 0, 4, 4 };
+	std::vector<uint64_t> offsets{ 0, 4 };
+	ParallelBatchRunner(2).playBatch(tokens, offsets, GameConfig().addGreenBox(0.0).addGreenBox(0.0));
+	GameCounters total = Instrumentation::collect();
+	if (Instrumentation::isEnabled()) {
+		REQUIRE(total.turns == inputs.size() + tokens.size());
+		REQUIRE(total.absorb_calls == inputs.size());
+		//both green boxes weigh 0 until the first one absorbs 4 with a window of { 0, 0, 4 }, then the second one absorbs 4
+		REQUIRE(total.tied_turns == 3);
+		REQUIRE(total.contributions[0] + total.contributions[1] + total.contributions[2] + total.contributions[3] ==
+			Approx(scores.first + scores.second + 16.0 / 9 + 16.0));
+	}
+	else {
+		REQUIRE(total.turns == 0);
+	}
+}
+
+TEST_CASE("Test run-length-encoded games match play()", "[runs]") {
+	std::vector<uint32_t> tokens{ 3, 3, 3, 0, 8, 8 };
+	auto runs = encodeRuns(tokens);
+	REQUIRE(runs.size() == 3);
+	REQUIRE((runs[0].token == 3 && runs[0].count == 3 && runs[1].token == 0 && runs[1].count == 1 && runs[2].count == 2));
+
+	GameConfig config;
+	config.addGreenBox(1.0).addBlueBox(1.0).addGreenBox(0.5).addBlueBox(40.25).addGreenBox(1e6);
+	std::mt19937 generator(23);
+	std::vector<uint32_t> values{ 0, 1, 2, 7, 1000, 1 << 20, 4294967295u };
+	std::uniform_int_distribution<size_t> value_distribution(0, values.size() - 1);
+	std::uniform_int_distribution<uint64_t> count_distribution(1, 5000);
+	for (int game = 0; game < 20; ++game) {
+		runs.clear();
+		tokens.clear();
+		for (int run = 0; run < 6; ++run) {
+			TokenRun token_run;
+			token_run.token = values[value_distribution(generator)];
+			token_run.count = count_distribution(generator);
+			runs.push_back(token_run);
+			tokens.insert(tokens.end(), token_run.count, token_run.token);
+		}
+		REQUIRE(playRuns(runs) == play(tokens, GameConfig::standard()));
+		REQUIRE(playRuns(runs, config) == play(tokens, config));
+	}
+
+	//a long run of equal tokens settles into a period of one visit of every box, which is skipped
+	runs.assign(1, TokenRun());
+	runs[0].token = 5;
+	runs[0].count = 100000;
+	RunLengthGame game;
+	REQUIRE(game.play(runs.data(), runs.data() + 1) == play(std::vector<uint32_t>(100000, 5)));
+	REQUIRE(game.getSkippedTurns() > 90000);
+	game.reset();
+	runs[0].token = 1;
+	runs[0].count = 1000000000000;
+	auto scores = game.play(runs.data(), runs.data() + 1);
+	REQUIRE(game.getSkippedTurns() > runs[0].count - 100000);
+	//green boxes settle at a score of 1 and blue ones at 4, and each player visits one box of each type every 4 turns
+	REQUIRE(scores.first == Approx(1.25e12).epsilon(1e-9));
+	REQUIRE(scores.second == Approx(1.25e12).epsilon(1e-9));
+
+	//runs with a step settle into rotations over the lightest boxes, which are skipped with scores close to play()
+	REQUIRE(encodeProgressions({ 3, 3, 3, 0, 8, 8 }).size() == 3);
+	tokens = { 4, 7, 10, 13, 9, 9, 13, 9, 5, 1, 1 };
+	runs = encodeProgressions(tokens);
+	REQUIRE(runs.size() == 4);
+	REQUIRE((runs[0].token == 4 && runs[0].count == 4 && runs[0].step == 3 && runs[1].token == 9 && runs[1].count == 2));
+	REQUIRE((runs[2].token == 13 && runs[2].count == 4 && runs[2].step == -4 && runs[3].token == 1 && runs[3].step == 0));
+	REQUIRE(playRuns(runs) == play(tokens, GameConfig::standard()));
+	GameConfig odd_config;
+	odd_config.addBlueBox(0.0).addGreenBox(3.5).addBlueBox(7.0);
+	const GameConfig configs[] = { GameConfig::standard(), config, odd_config };
+	for (const GameConfig& step_config : configs) {
+		runs.assign(3, TokenRun());
+		runs[0].token = 10;
+		runs[0].count = 50;
+		runs[0].step = 3;
+		runs[1].token = 200000;
+		runs[1].count = 40000;
+		runs[1].step = -4;
+		runs[2].token = 7;
+		runs[2].count = 300000;
+		runs[2].step = 11;
+		tokens.clear();
+		for (const TokenRun& run : runs) {
+			for (uint64_t i = 0; i < run.count; ++i) {
+				tokens.push_back(static_cast<uint32_t>(run.token + static_cast<int64_t>(i) * run.step));
+			}
+		}
+		RunLengthGame step_game(step_config);
+		auto step_scores = step_game.play(runs.data(), runs.data() + runs.size());
+		auto expected = play(tokens, step_config);
+		REQUIRE(step_game.getSkippedTurns() > 250000);
+		REQUIRE(step_scores.first == Approx(expected.first).epsilon(RunLengthGame::maxRelativeError(tokens.size())));
+		REQUIRE(step_scores.second == Approx(expected.second).epsilon(RunLengthGame::maxRelativeError(tokens.size())));
+	}
+	runs.assign(2, TokenRun());
+	runs[0].token = 10;
+	runs[0].count = 50;
+	runs[0].step = 3;
+	runs[1].token = 200;
+	runs[1].count = 51;
+	runs[1].step = -4;
+	REQUIRE_NOTHROW(playRuns(runs));
+	runs[1].count = 52;
+	REQUIRE_THROWS_AS(playRuns(runs), std::invalid_argument);
+	REQUIRE_THROWS_AS(RunLengthGame(GameConfig()), std::invalid_argument);
+}
+
+TEST_CASE("Test deferred scoring matches play()", "[deferred]") {
+	std::vector<uint32_t> fibonacci{ 1, 1, 2, 3, 5, 8, 13, 21 };
+	DeferredScoreGame game;
+	game.play(fibonacci.data(), fibonacci.data() + fibonacci.size());
+	REQUIRE(game.getScores() == std::make_pair(155.0, 366.25));
+	REQUIRE(game.getWinner() == Winner::PLAYER_B);
+	REQUIRE(playWinner({}) == Winner::NONE);
+
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets;
+	makeRandomCorpus(200, 300, 31, tokens, offsets);
+	GameConfig config;
+	config.addBlueBox(1.5).addGreenBox(0.25).addGreenBox(2.0).addBlueBox(0.25).addGreenBox(0.75);
+	for (const GameConfig& game_config : { GameConfig::standard(), config }) {
+		DeferredScoreGame deferred(game_config);
+		BoxSet boxes(game_config);
+		for (size_t i = 0; i + 1 < offsets.size(); ++i) {
+			const uint32_t* first = tokens.data() + offsets[i];
+			const uint32_t* last = tokens.data() + offsets[i + 1];
+			deferred.reset();
+			deferred.play(first, last);
+			boxes.reset();
+			auto expected = boxes.play(first, last);
+			auto scores = deferred.getScores();
+			REQUIRE(scores.first == Approx(expected.first).epsilon(1e-12));
+			REQUIRE(scores.second == Approx(expected.second).epsilon(1e-12));
+			if (std::fabs(expected.first - expected.second) > 1e-9 * (expected.first + expected.second)) {
+				REQUIRE(deferred.getWinner() == (expected.first > expected.second ? Winner::PLAYER_A : Winner::PLAYER_B));
+			}
+			auto weights = playWeights(first, last, game_config);
+			for (size_t box = 0; box < game_config.size(); ++box) {
+				REQUIRE(weights[box] == boxes.getWeight(box));
+				REQUIRE(deferred.getWeight(box) == boxes.getWeight(box));
+			}
+		}
+	}
+	REQUIRE_THROWS_AS(playWeights(fibonacci, GameConfig()), std::invalid_argument);
+}
+
+TEST_CASE("Test batch backends match play()", "[backends]") {
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets;
+	makeRandomCorpus(1000, 300, 43, tokens, offsets);
+	REQUIRE(isBatchBackendAvailable(selectBatchBackend()));
+	for (BatchBackend backend : { BatchBackend::CPU, BatchBackend::CUDA }) {
+		std::vector<std::pair<double, double>> scores(offsets.size() - 1);
+		if (!isBatchBackendAvailable(backend)) {
+			WARN("skipping the " << batchBackendName(backend) << " backend, it is not available");
+			REQUIRE_THROWS_AS(playBatch(tokens.data(), offsets.data(), scores.size(), scores.data(), backend), std::invalid_argument);
+			continue;
+		}
+		playBatch(tokens.data(), offsets.data(), scores.size(), scores.data(), backend);
+		for (size_t i = 0; i < scores.size(); ++i) {
+			std::vector<uint32_t> game(tokens.begin() + offsets[i], tokens.begin() + offsets[i + 1]);
+			REQUIRE(scores[i] == play(game, GameConfig::standard()));
+		}
+	}
+	if (isBatchBackendAvailable(BatchBackend::CUDA)) {
+		GameConfig config;
+		config.addGreenBox(0.5);
+		std::vector<std::pair<double, double>> scores(offsets.size() - 1);
+		REQUIRE_THROWS_AS(playBatch(tokens.data(), offsets.data(), scores.size(), scores.data(), BatchBackend::CUDA, config), std::invalid_argument);
+	}
+}
+
+TEST_CASE("Test packed game state", "[state]") {
+	REQUIRE(std::is_trivially_copyable<GameState>::value);
+	REQUIRE(sizeof(GameState) <= 128);
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets;
+	makeRandomCorpus(500, 300, 45, tokens, offsets);
+	for (size_t game = 0; game + 1 < offsets.size(); ++game) {
+		std::vector<uint32_t> game_tokens(tokens.begin() + offsets[game], tokens.begin() + offsets[game + 1]);
+		GameState state;
+		REQUIRE(state.play(game_tokens.data(), game_tokens.data() + game_tokens.size()) == play(game_tokens, GameConfig::standard()));
+		REQUIRE(state.is_player_A_turn == (game_tokens.size() % 2 == 0 ? 1 : 0));
+	}
+	REQUIRE(playBatchPrefixShared(tokens.data(), offsets.data(), offsets.size() - 1, std::vector<std::pair<double, double>>(offsets.size() - 1).data()) > 0);
+
+	//Every prefix of a game with positive tokens leaves another state, copies of a state are equal to it
+	std::vector<uint32_t> fibonacci{ 1, 1 };
+	while (fibonacci.size() < 40) {
+		fibonacci.push_back(fibonacci[fibonacci.size() - 1] + fibonacci[fibonacci.size() - 2]);
+	}
+	std::unordered_set<GameState, GameState::Hash> states;
+	GameState state;
+	for (uint32_t token : fibonacci) {
+		REQUIRE(states.insert(state).second);
+		GameState copy;
+		std::memcpy(&copy, &state, sizeof(GameState));
+		REQUIRE(copy == state);
+		REQUIRE(copy.hash() == state.hash());
+		state.takeTurn(token);
+		REQUIRE(copy != state);
+		copy.takeTurn(token);
+		REQUIRE(copy == state);
+	}
+	REQUIRE(states.size() == fibonacci.size());
+	REQUIRE(states.count(GameState()) == 1);
+	state.reset();
+	REQUIRE(state == GameState());
+}
+
+TEST_CASE("Test aggregate statistics", "[statistics]") {
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets;
+	makeRandomCorpus(2000, 300, 44, tokens, offsets);
+	std::vector<std::pair<double, double>> scores(offsets.size() - 1);
+	playBatch(tokens.data(), offsets.data(), scores.size(), scores.data());
+
+	BatchStatistics expected(GameConfig::standard().size());
+	double total_score = 0.0;
+	for (const auto& game_scores : scores) {
+		expected.add(game_scores);
+		total_score += game_scores.first + game_scores.second;
+	}
+	auto checkStatistics = [&](const BatchStatistics& statistics) {
+		REQUIRE(statistics.games == scores.size());
+		REQUIRE(statistics.wins_A == expected.wins_A);
+		REQUIRE(statistics.wins_B == expected.wins_B);
+		REQUIRE(statistics.draws == expected.draws);
+		REQUIRE(statistics.wins_A + statistics.wins_B + statistics.draws == statistics.games);
+		REQUIRE(statistics.margins.count == scores.size());
+		REQUIRE(statistics.margins.mean == Approx(expected.margins.mean));
+		REQUIRE(statistics.margins.getVariance() == Approx(expected.margins.getVariance()));
+		REQUIRE(statistics.margin_quantiles.getCount() == scores.size());
+		REQUIRE(statistics.margin_quantiles.getMin() == expected.margin_quantiles.getMin());
+		REQUIRE(statistics.margin_quantiles.getMax() == expected.margin_quantiles.getMax());
+		REQUIRE(statistics.box_contributions.size() == GameConfig::standard().size());
+		double contributions = 0.0;
+		for (double contribution : statistics.box_contributions) {
+			REQUIRE(contribution >= 0.0);
+			contributions += contribution;
+		}
+		REQUIRE(contributions == Approx(total_score));
+	};
+	checkStatistics(reduceBatch(tokens.data(), offsets.data(), scores.size()));
+	ParallelBatchRunner runner(2);
+	checkStatistics(runner.reduceBatch(tokens.data(), offsets.data(), scores.size()));
+	REQUIRE_THROWS_AS(reduceBatch(tokens.data(), offsets.data(), scores.size(), GameConfig()), std::invalid_argument);
+
+	RunningMoments all, first, second;
+	for (size_t i = 0; i < 1000; ++i) {
+		double value = std::sin(static_cast<double>(i)) * 100.0 + static_cast<double>(i % 7);
+		all.add(value);
+		(i < 300 ? first : second).add(value);
+	}
+	first.merge(second);
+	REQUIRE(first.count == all.count);
+	REQUIRE(first.mean == Approx(all.mean));
+	REQUIRE(first.getVariance() == Approx(all.getVariance()));
+
+	QuantileSketch sketch, left(200, 2), right(200, 3);
+	REQUIRE(std::isnan(sketch.getQuantile(0.5)));
+	const size_t value_count = 100000;
+	std::vector<double> values(value_count);
+	std::mt19937 generator(5);
+	std::normal_distribution<double> normal(0.0, 1000.0);
+	for (size_t i = 0; i < value_count; ++i) {
+		values[i] = normal(generator);
+		sketch.add(values[i]);
+		(i % 2 == 0 ? left : right).add(values[i]);
+	}
+	left.merge(right);
+	std::vector<double> sorted = values;
+	std::sort(sorted.begin(), sorted.end());
+	for (const QuantileSketch* quantiles : { &sketch, &left }) {
+		REQUIRE(quantiles->getCount() == value_count);
+		REQUIRE(quantiles->getRetainedCount() < 4 * quantiles->getK());
+		REQUIRE(quantiles->getQuantile(0.0) == sorted.front());
+		REQUIRE(quantiles->getQuantile(1.0) == sorted.back());
+		for (double fraction : { 0.01, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99 }) {
+			double rank = static_cast<double>(std::lower_bound(sorted.begin(), sorted.end(), quantiles->getQuantile(fraction)) - sorted.begin());
+			REQUIRE(std::abs(rank / value_count - fraction) < 0.02);
+		}
+	}
+	REQUIRE_THROWS_AS(sketch.merge(QuantileSketch(100)), std::invalid_argument);
+	REQUIRE_THROWS_AS(QuantileSketch(1), std::invalid_argument);
+}
+
+TEST_CASE("Test asynchronous scoring", "[async]") {
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets;
+	makeRandomCorpus(300, 500, 47, tokens, offsets);
+	AsyncScorer::Options options;
+	options.thread_count = 2;
+	options.chunk_tokens = 64;
+	{
+		AsyncScorer scorer(options);
+		REQUIRE(scorer.getThreadCount() == 2);
+		std::vector<std::future<std::pair<double, double>>> futures;
+		for (size_t game = 0; game + 1 < offsets.size(); ++game) {
+			futures.push_back(scorer.play(std::vector<uint32_t>(tokens.begin() + offsets[game], tokens.begin() + offsets[game + 1])));
+		}
+		auto expected = playBatch(tokens, offsets);
+		for (size_t game = 0; game < futures.size(); ++game) {
+			REQUIRE(futures[game].get() == expected[game]);
+		}
+		REQUIRE(scorer.play(std::vector<uint32_t>()).get() == std::make_pair(0.0, 0.0));
+		REQUIRE(scorer.getYieldCount() > 0);
+	}
+
+	//A small game submitted after a huge one is not held up until the huge one is done
+	options.thread_count = 1;
+	options.chunk_tokens = 1000;
+	std::vector<uint32_t> huge(2000000, 7);
+	std::mutex mutex;
+	std::vector<std::string> finished;
+	std::pair<double, double> huge_scores, small_scores;
+	std::exception_ptr huge_error;
+	{
+		AsyncScorer scorer(options);
+		scorer.play(huge, [&](const std::pair<double, double>& scores, std::exception_ptr error) {
+			std::lock_guard<std::mutex> lock(mutex);
+			finished.push_back("huge");
+			huge_scores = scores;
+			huge_error = error;
+			});
+		scorer.play({ 1, 1, 2, 3 }, [&](const std::pair<double, double>& scores, std::exception_ptr) {
+			std::lock_guard<std::mutex> lock(mutex);
+			finished.push_back("small");
+			small_scores = scores;
+			});
+	}
+	REQUIRE(finished == std::vector<std::string>{ "small", "huge" });
+	REQUIRE(!huge_error);
+	REQUIRE(small_scores == std::make_pair(13.0, 25.0));
+	REQUIRE(huge_scores == play(huge));
+
+	options.chunk_tokens = 0;
+	REQUIRE_THROWS_AS(AsyncScorer(options), std::invalid_argument);
+}
+
+TEST_CASE("Test Monte Carlo simulation", "[simulation]") {
+	//Known answers of the Random123 reference implementation
+	auto zero = Philox4x32::block({ { 0, 0, 0, 0 } }, { { 0, 0 } });
+	REQUIRE(zero == (std::array<uint32_t, 4>{ { 0x6627e8d5u, 0xe169c58du, 0xbc57ac4cu, 0x9b00dbd8u } }));
+	auto ones = Philox4x32::block({ { 0xffffffffu, 0xffffffffu, 0xffffffffu, 0xffffffffu } }, { { 0xffffffffu, 0xffffffffu } });
+	REQUIRE(ones == (std::array<uint32_t, 4>{ { 0x408f276du, 0x41c83b0eu, 0xa20bc7c6u, 0x6d5451fdu } }));
+
+	SimulationConfig simulation;
+	simulation.seed = 12345;
+	simulation.min_length = 10;
+	simulation.max_length = 400;
+	simulation.tokens = TokenDistribution::uniform(100, 200);
+	const uint64_t game_count = 500;
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets{ 0 };
+	for (uint64_t game = 0; game < game_count; ++game) {
+		auto game_tokens = SimulatedTokens(simulation, game).materialize();
+		REQUIRE(game_tokens == SimulatedTokens(simulation, game).materialize());
+		REQUIRE(game_tokens.size() >= simulation.min_length);
+		REQUIRE(game_tokens.size() <= simulation.max_length);
+		for (uint32_t token : game_tokens) {
+			REQUIRE(token >= 100);
+			REQUIRE(token <= 200);
+		}
+		REQUIRE(simulateGame(simulation, game) == play(game_tokens, GameConfig::standard()));
+		tokens.insert(tokens.end(), game_tokens.begin(), game_tokens.end());
+		offsets.push_back(tokens.size());
+	}
+	REQUIRE(SimulatedTokens(simulation, 0).materialize() != SimulatedTokens(simulation, 1).materialize());
+
+	BatchStatistics expected = reduceBatch(tokens.data(), offsets.data(), game_count);
+	BatchStatistics simulated = simulateBatch(simulation, 0, game_count);
+	REQUIRE(simulated.games == game_count);
+	REQUIRE(simulated.wins_A == expected.wins_A);
+	REQUIRE(simulated.wins_B == expected.wins_B);
+	REQUIRE(simulated.margins.mean == expected.margins.mean);
+	REQUIRE(simulated.box_contributions == expected.box_contributions);
+
+	//Shards of a simulation, on any number of threads, add up to the whole simulation
+	BatchStatistics sharded = simulateBatch(simulation, 0, 200);
+	ParallelBatchRunner runner(2);
+	sharded.merge(runner.simulateBatch(simulation, 200, game_count - 200));
+	REQUIRE(sharded.games == game_count);
+	REQUIRE(sharded.wins_A == expected.wins_A);
+	REQUIRE(sharded.draws == expected.draws);
+	REQUIRE(sharded.margins.mean == Approx(expected.margins.mean));
+
+	SimulatedTokens exponential({ 7, 0, 0, TokenDistribution::exponential(1000.0) }, 3);
+	double sum = 0.0;
+	const size_t sample_count = 100000;
+	for (size_t i = 0; i < sample_count; ++i) {
+		sum += exponential.next();
+	}
+	REQUIRE(sum / sample_count == Approx(999.5).epsilon(0.02));
+	REQUIRE(exponential.getLength() == 0);
+
+	REQUIRE_THROWS_AS(TokenDistribution::uniform(2, 1), std::invalid_argument);
+	REQUIRE_THROWS_AS(TokenDistribution::exponential(0.0), std::invalid_argument);
+	simulation.min_length = simulation.max_length + 1;
+	REQUIRE_THROWS_AS(simulateBatch(simulation, 0, 1), std::invalid_argument);
+}
+
+TEST_CASE("Test result cache", "[cache]") {
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets;
+	makeRandomCorpus(1000, 200, 46, tokens, offsets);
+	GameConfig config;
+	config.addGreenBox(0.5).addBlueBox(0.0).addGreenBox(0.25);
+	Instrumentation::reset();
+
+	struct alignas(64) Line {
+		char byte = 1;
+	};
+	AlignedArray<Line> lines;
+	for (size_t count : { 1, 3, 16 }) {
+		lines.reset(count);
+		REQUIRE(lines.size() == count);
+		for (size_t line = 0; line < count; ++line) {
+			REQUIRE(reinterpret_cast<uintptr_t>(&lines[line]) % 64 == 0);
+			REQUIRE(lines[line].byte == 1);
+		}
+	}
+
+	ResultCache cache(4096, 8);
+	REQUIRE(cache.getCapacity() >= 4096);
+	for (int pass = 0; pass < 2; ++pass) {
+		for (size_t game = 0; game + 1 < offsets.size(); ++game) {
+			std::vector<uint32_t> game_tokens(tokens.begin() + offsets[game], tokens.begin() + offsets[game + 1]);
+			REQUIRE(cache.play(game_tokens) == play(game_tokens, GameConfig::standard()));
+			REQUIRE(cache.play(game_tokens, config) == play(game_tokens, config));
+		}
+	}
+	ResultCache::Statistics statistics = cache.getStatistics();
+	REQUIRE(statistics.evictions == 0);
+	REQUIRE(statistics.hits + statistics.misses == 4 * (offsets.size() - 1));
+	REQUIRE(statistics.misses == statistics.size);
+	REQUIRE(statistics.hits >= 2 * (offsets.size() - 1));
+
+	std::vector<std::pair<double, double>> scores(offsets.size() - 1);
+	ResultCache batch_cache(4096);
+	for (int pass = 0; pass < 2; ++pass) {
+		batch_cache.playBatch(tokens.data(), offsets.data(), scores.size(), scores.data(), config);
+		REQUIRE(scores == playBatch(tokens, offsets, config));
+		ParallelBatchRunner runner(2);
+		batch_cache.playBatch(tokens.data(), offsets.data(), scores.size(), scores.data(), GameConfig::standard(),
+			[&](const uint32_t* miss_tokens, const uint64_t* miss_offsets, size_t miss_count, std::pair<double, double>* miss_scores) {
+				runner.playBatchLanes(miss_tokens, miss_offsets, miss_count, miss_scores);
+			});
+		REQUIRE(scores == playBatch(tokens, offsets));
+	}
+	REQUIRE(batch_cache.getStatistics().hits == 2 * scores.size());
+	if (Instrumentation::isEnabled()) {
+		GameCounters counters = Instrumentation::collect();
+		REQUIRE(counters.cache_hits == statistics.hits + batch_cache.getStatistics().hits);
+		REQUIRE(counters.cache_misses == statistics.misses + batch_cache.getStatistics().misses);
+	}
+
+	//Keys tell apart sequences that only differ in length, order or configuration
+	std::vector<uint32_t> sequences[] = { {}, { 0 }, { 0, 0 }, { 1, 2 }, { 2, 1 }, { 1, 2, 3, 4 }, { 1, 2, 3, 4, 0 }, { 3, 4, 1, 2 } };
+	std::vector<ResultKey> keys;
+	for (const auto& sequence : sequences) {
+		keys.push_back(cache.hashGame(sequence.data(), sequence.data() + sequence.size(), GameConfig::standard()));
+		keys.push_back(cache.hashGame(sequence.data(), sequence.data() + sequence.size(), config));
+	}
+	for (size_t i = 0; i < keys.size(); ++i) {
+		for (size_t j = i + 1; j < keys.size(); ++j) {
+			REQUIRE(keys[i] != keys[j]);
+		}
+	}
+	//and are keyed by a secret of their cache
+	REQUIRE(cache.hashGame(sequences[5].data(), sequences[5].data() + 4, config) != batch_cache.hashGame(sequences[5].data(), sequences[5].data() + 4, config));
+
+	//A game whose key collides with a cached one misses instead of getting the scores of the other game
+	const std::vector<uint32_t> fibonacci{ 1, 1, 2, 3, 5, 8, 13, 21 };
+	const std::vector<uint32_t> colliding{ 4294967295u, 0, 4294967295u, 0, 4294967295u, 0, 4294967295u, 0 };
+	const uint64_t standard_hash = ResultCache::hashConfig(GameConfig::standard());
+	ResultCache poisoned(64);
+	ResultKey fibonacci_key = poisoned.hashGame(fibonacci.data(), fibonacci.data() + fibonacci.size(), standard_hash);
+	poisoned.insert(fibonacci_key, colliding.data(), colliding.data() + colliding.size(), standard_hash, play(colliding));
+	std::pair<double, double> cached;
+	REQUIRE_FALSE(poisoned.lookup(fibonacci_key, fibonacci.data(), fibonacci.data() + fibonacci.size(), standard_hash, cached));
+	REQUIRE_FALSE(poisoned.lookup(fibonacci_key, colliding.data(), colliding.data() + colliding.size(), ResultCache::hashConfig(config), cached));
+	REQUIRE(poisoned.play(fibonacci) == std::make_pair(155.0, 366.25));
+	REQUIRE(poisoned.play(fibonacci) == std::make_pair(155.0, 366.25));
+	REQUIRE(poisoned.getStatistics().hits == 1);
+	REQUIRE_FALSE(poisoned.lookup(fibonacci_key, colliding.data(), colliding.data() + colliding.size(), standard_hash, cached));
+
+	//CLOCK eviction spares an entry hit since the hand last passed it
+	ResultCache small(4, 1);
+	const uint32_t games[5][1] = { { 0 }, { 1 }, { 2 }, { 3 }, { 4 } };
+	for (uint64_t key = 0; key < 4; ++key) {
+		small.insert(ResultKey{ key, 0 }, games[key], games[key] + 1, standard_hash, std::make_pair(static_cast<double>(key), 0.0));
+	}
+	REQUIRE(small.lookup(ResultKey{ 0, 0 }, games[0], games[0] + 1, standard_hash, cached));
+	REQUIRE(cached.first == 0.0);
+	small.insert(ResultKey{ 4, 0 }, games[4], games[4] + 1, standard_hash, std::make_pair(4.0, 0.0));
+	REQUIRE(small.lookup(ResultKey{ 0, 0 }, games[0], games[0] + 1, standard_hash, cached));
+	REQUIRE_FALSE(small.lookup(ResultKey{ 1, 0 }, games[1], games[1] + 1, standard_hash, cached));
+	REQUIRE(small.lookup(ResultKey{ 4, 0 }, games[4], games[4] + 1, standard_hash, cached));
+	REQUIRE(cached.first == 4.0);
+	REQUIRE(small.getStatistics().size == 4);
+	REQUIRE(small.getStatistics().evictions == 1);
+	small.clear();
+	REQUIRE(small.getStatistics().size == 0);
+	REQUIRE_THROWS_AS(ResultCache(0), std::invalid_argument);
+
+	//Threads sharing a cache get the scores of play()
+	ResultCache shared(256, 4);
+	std::vector<std::thread> threads;
+	std::vector<int> mismatches(4, 0);
+	for (size_t thread = 0; thread < 4; ++thread) {
+		threads.emplace_back([&, thread]() {
+			for (size_t game = thread; game + 1 < offsets.size(); game += 2) {
+				const uint32_t* first = tokens.data() + offsets[game];
+				const uint32_t* last = tokens.data() + offsets[game + 1];
+				if (shared.play(first, last) != playStatic(std::vector<uint32_t>(first, last))) {
+					++mismatches[thread];
+				}
+			}
+			});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	REQUIRE(mismatches == std::vector<int>(4, 0));
+	REQUIRE(shared.getStatistics().size <= shared.getCapacity());
+}
+
+#ifndef _WIN32
+TEST_CASE("Test micro-batching", "[service]") {
+	std::mutex mutex;
+	std::condition_variable completed;
+	std::vector<ScoringTicket> tickets;
+	std::vector<std::pair<double, double>> scores;
+	auto completion = [&](const std::vector<ScoringTicket>& batch_tickets, const std::vector<std::pair<double, double>>& batch_scores) {
+		std::lock_guard<std::mutex> lock(mutex);
+		tickets.insert(tickets.end(), batch_tickets.begin(), batch_tickets.end());
+		scores.insert(scores.end(), batch_scores.begin(), batch_scores.end());
+		completed.notify_all();
+	};
+	std::vector<uint32_t> inputs{ 1, 1, 2, 3, 5, 8, 13, 21 };
+	auto waitForScores = [&](size_t count) {
+		std::unique_lock<std::mutex> lock(mutex);
+		return completed.wait_for(lock, std::chrono::seconds(10), [&]() { return scores.size() >= count; });
+	};
+
+	SECTION("full batches are played at once") {
+		MicroBatcher::Policy policy;
+		policy.max_requests = 3;
+		policy.max_delay = std::chrono::hours(1);
+		MicroBatcher batcher(policy, 2, completion);
+		for (uint64_t request = 0; request < 6; ++request) {
+			batcher.submit(ScoringTicket{ 7, request }, inputs.data(), request);
+			if (request % 3 == 2) {
+				REQUIRE(waitForScores(request + 1));
+			}
+		}
+		REQUIRE(batcher.getBatchCount() == 2);
+		for (uint64_t request = 0; request < 6; ++request) {
+			REQUIRE(tickets[request].request_id == request);
+			REQUIRE(scores[request] == play(std::vector<uint32_t>(inputs.begin(), inputs.begin() + request)));
+		}
+	}
+	SECTION("partial batches are played after the delay") {
+		MicroBatcher::Policy policy;
+		policy.max_delay = std::chrono::milliseconds(1);
+		MicroBatcher batcher(policy, 1, completion);
+		batcher.submit(ScoringTicket{ 0, 0 }, inputs.data(), inputs.size());
+		REQUIRE(waitForScores(1));
+		REQUIRE(scores[0] == play(inputs));
+	}
+	SECTION("stopping plays the pending requests") {
+		MicroBatcher::Policy policy;
+		policy.max_delay = std::chrono::hours(1);
+		MicroBatcher batcher(policy, 1, completion);
+		batcher.submit(ScoringTicket{ 0, 0 }, inputs.data(), inputs.size());
+		batcher.stop();
+		REQUIRE(scores.size() == 1);
+	}
+}
+
+TEST_CASE("Test scoring service", "[service]") {
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets;
+	makeRandomCorpus(200, 100, 13, tokens, offsets);
+	auto expected = playBatch(tokens, offsets);
+	for (size_t cache_capacity : { 0, 1000 }) {
+		ScoringServer::Options options;
+		options.port = 0;
+		options.compute_threads = 2;
+		options.cache_capacity = cache_capacity;
+		ScoringServer server(options);
+		std::thread serving([&]() { server.run(); });
+
+		//A second session of the same games is answered from the cache
+		for (int session = 0; session < 2; ++session) {
+			ScoringClient client("127.0.0.1", server.getPort());
+			for (uint64_t game = 0; game + 1 < offsets.size(); ++game) {
+				client.send(game, std::vector<uint32_t>(tokens.begin() + offsets[game], tokens.begin() + offsets[game + 1]));
+			}
+			client.finishSending();
+			for (uint64_t game = 0; game < expected.size(); ++game) {
+				auto response = client.receive();
+				REQUIRE(response.first == game);
+				REQUIRE(response.second == expected[game]);
+			}
+		}
+		server.stop();
+		serving.join();
+		if (cache_capacity == 0) {
+			REQUIRE(server.getCache() == nullptr);
+		}
+		else {
+			ResultCache::Statistics statistics = server.getCache()->getStatistics();
+			REQUIRE(statistics.hits + statistics.misses == 2 * expected.size());
+			REQUIRE(statistics.hits >= expected.size());
+		}
+	}
+}
+
+TEST_CASE("Test scoring service backpressure", "[service]") {
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets;
+	makeRandomCorpus(200, 100, 14, tokens, offsets);
+	auto expected = playBatch(tokens, offsets);
+	ScoringServer::Options options;
+	options.port = 0;
+	options.compute_threads = 1;
+	options.max_outstanding = 3;
+	options.max_output_bytes = scoring_response_size;
+	ScoringServer server(options);
+	std::thread serving([&]() { server.run(); });
+
+	//every request is held back until the ones before it are answered and their responses read, and none is lost
+	ScoringClient client("127.0.0.1", server.getPort());
+	for (uint64_t game = 0; game + 1 < offsets.size(); ++game) {
+		client.send(game, std::vector<uint32_t>(tokens.begin() + offsets[game], tokens.begin() + offsets[game + 1]));
+	}
+	client.finishSending();
+	for (uint64_t game = 0; game < expected.size(); ++game) {
+		auto response = client.receive();
+		REQUIRE(response.first == game);
+		REQUIRE(response.second == expected[game]);
+	}
+	REQUIRE_THROWS_AS(client.receive(), std::runtime_error);
+	server.stop();
+	serving.join();
+	options.max_outstanding = 0;
+	REQUIRE_THROWS_AS(ScoringServer(options), std::invalid_argument);
+}
+
+TEST_CASE("Test scoring service startup failure", "[service]") {
+	ScoringServer::Options options;
+	options.port = 0;
+	options.io_threads = 4;
+	{
+		ScoringServer server(options);
+
+		//with room for one more pipe at most, run() fails and the server can still be destroyed
+		int lowest_free = ::dup(0);
+		REQUIRE(lowest_free >= 0);
+		::close(lowest_free);
+		rlimit original;
+		REQUIRE(::getrlimit(RLIMIT_NOFILE, &original) == 0);
+		rlimit lowered = original;
+		lowered.rlim_cur = static_cast<rlim_t>(lowest_free + 2);
+		REQUIRE(::setrlimit(RLIMIT_NOFILE, &lowered) == 0);
+		bool failed = false;
+		try {
+			server.run();
+		}
+		catch (const std::runtime_error&) {
+			failed = true;
+		}
+		REQUIRE(::setrlimit(RLIMIT_NOFILE, &original) == 0);
+		REQUIRE(failed);
+
+		//no pipe of the failed run() was left open
+		int next_free = ::dup(0);
+		::close(next_free);
+		REQUIRE(next_free == lowest_free);
+	}
+}
+
+TEST_CASE("Test scoring service request limit", "[service]") {
+	ScoringServer::Options options;
+	options.port = 0;
+	options.compute_threads = 1;
+	options.policy.max_tokens = 8;
+	ScoringServer server(options);
+	std::thread serving([&]() { server.run(); });
+
+	//a request filling a batch on its own is played, a larger one closes the connection
+	std::vector<uint32_t> inputs{ 3, 4, 5, 6, 7, 8, 9, 10 };
+	ScoringClient client("127.0.0.1", server.getPort());
+	client.send(1, inputs);
+	auto response = client.receive();
+	REQUIRE(response.first == 1);
+	REQUIRE(response.second == play(inputs));
+	inputs.push_back(11);
+	client.send(2, inputs);
+	REQUIRE_THROWS_AS(client.receive(), std::runtime_error);
+	server.stop();
+	serving.join();
+	REQUIRE_THROWS_AS(client.send(3, std::vector<uint32_t>(max_scoring_request_tokens + 1)), std::invalid_argument);
+}
+
+TEST_CASE("Test shard scheduling", "[cluster]") {
+	using Clock = ShardScheduler::Clock;
+	const Clock::time_point start = Clock::now();
+	ShardScheduler scheduler(10, 4, std::chrono::seconds(10));
+	REQUIRE(scheduler.getShardCount() == 3);
+	ShardScheduler::Shard shard;
+	REQUIRE(scheduler.assign(1, start, shard));
+	REQUIRE((shard.index == 0 && shard.first_game == 0 && shard.game_count == 4));
+	REQUIRE(scheduler.assign(2, start + std::chrono::seconds(1), shard));
+	REQUIRE(scheduler.assign(2, start + std::chrono::seconds(1), shard));
+	REQUIRE((shard.index == 2 && shard.first_game == 8 && shard.game_count == 2));
+	REQUIRE(scheduler.getNextStragglerTime() == start + std::chrono::seconds(10));
+
+	//nothing is pending and nobody straggles yet, then the oldest straggler, shard 0 of worker 1, is handed out again
+	REQUIRE(!scheduler.assign(3, start + std::chrono::seconds(5), shard));
+	REQUIRE(scheduler.assign(3, start + std::chrono::seconds(12), shard));
+	REQUIRE(shard.index == 0);
+	REQUIRE(scheduler.getRedispatchCount() == 1);
+	REQUIRE(scheduler.complete(3, 0));
+	REQUIRE(!scheduler.complete(1, 0));
+
+	//worker 2 fails, its shards are pending again and go to the next worker asking. Only the worker a shard is assigned
+	//to may complete it.
+	scheduler.release(2);
+	REQUIRE(!scheduler.complete(1, 1));
+	REQUIRE(scheduler.assign(1, start + std::chrono::seconds(13), shard));
+	REQUIRE(scheduler.assign(3, start + std::chrono::seconds(13), shard));
+	REQUIRE(!scheduler.complete(3, 1));
+	REQUIRE(!scheduler.isDone(1));
+	REQUIRE(scheduler.complete(1, 1));
+	REQUIRE(scheduler.complete(3, 2));
+	REQUIRE(scheduler.isDone());
+	REQUIRE(!scheduler.assign(1, start + std::chrono::seconds(60), shard));
+	REQUIRE_THROWS_AS(ShardScheduler(10, 0, std::chrono::seconds(1)), std::invalid_argument);
+
+	ScoreStatistics statistics, other;
+	statistics.add(std::make_pair(0.5, 0.5));
+	statistics.add(std::make_pair(4.0, 3.0));
+	other.add(std::make_pair(1.0, 1e300));
+	statistics.merge(other);
+	REQUIRE((statistics.games == 3 && statistics.wins_A == 1 && statistics.wins_B == 1 && statistics.ties == 1));
+	REQUIRE((statistics.histogram_A[0] == 1 && statistics.histogram_A[1] == 1 && statistics.histogram_A[3] == 1));
+	REQUIRE((statistics.histogram_B[2] == 1 && statistics.histogram_B[ScoreStatistics::bucket_count - 1] == 1));
+	std::stringstream stream;
+	statistics.write(stream);
+	ScoreStatistics restored;
+	restored.read(stream);
+	REQUIRE(restored == statistics);
+}
+
+//Connects, takes a shard and disconnects without returning it, as a node failing mid-shard
+static void abandonShard(uint16_t port) {
+	int socket = ::socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	::inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+	REQUIRE(::connect(socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+	uint32_t request = 1;
+	char assignment[28];
+	REQUIRE(::send(socket, &request, sizeof(request), 0) == sizeof(request));
+	REQUIRE(::recv(socket, assignment, sizeof(assignment), MSG_WAITALL) == sizeof(assignment));
+	::close(socket);
+}
+
+TEST_CASE("Test distributed scoring", "[cluster]") {
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets;
+	makeRandomCorpus(1000, 100, 17, tokens, offsets);
+	const std::string corpus_path = "asaphus_cluster_corpus.bin", output_path = "asaphus_cluster_scores.bin";
+	const std::string checkpoint_path = "asaphus_cluster.checkpoint";
+	writeTokenCorpus(corpus_path, tokens, offsets);
+	std::remove(checkpoint_path.c_str());
+	auto expected = playBatch(tokens, offsets);
+	ScoreStatistics expected_statistics;
+	for (const auto& scores : expected) {
+		expected_statistics.add(scores);
+	}
+
+	ClusterCoordinator::Options options;
+	options.port = 0;
+	options.shard_games = 64;
+	options.checkpoint_path = checkpoint_path;
+	options.checkpoint_interval = 1;
+	{
+		//the first coordinator is stopped after a failed node and a worker leaving after 5 shards
+		ClusterCoordinator coordinator(corpus_path, output_path, options);
+		std::thread coordinating([&]() { coordinator.run(); });
+		abandonShard(coordinator.getPort());
+		REQUIRE(ClusterWorker("127.0.0.1", coordinator.getPort(), corpus_path, 1).run(5) == 5);
+		coordinator.stop();
+		coordinating.join();
+		REQUIRE(coordinator.getScheduler().getDoneCount() == 5);
+		REQUIRE(!coordinator.getScheduler().isDone());
+	}
+	{
+		ClusterCoordinator coordinator(corpus_path, output_path, options);
+		REQUIRE(coordinator.getScheduler().getDoneCount() == 5);
+		std::thread coordinating([&]() { coordinator.run(); });
+		uint64_t played[2] = {};
+		std::thread second_worker([&]() { played[1] = ClusterWorker("127.0.0.1", coordinator.getPort(), corpus_path, 1).run(); });
+		played[0] = ClusterWorker("127.0.0.1", coordinator.getPort(), corpus_path, 1).run();
+		second_worker.join();
+		coordinating.join();
+		REQUIRE(coordinator.getScheduler().isDone());
+		REQUIRE(played[0] + played[1] == coordinator.getScheduler().getShardCount() - 5);
+		REQUIRE(coordinator.getStatistics() == expected_statistics);
+	}
+	std::ifstream output(output_path, std::ios::binary);
+	std::vector<double> doubles(2 * expected.size());
+	output.read(reinterpret_cast<char*>(doubles.data()), doubles.size() * sizeof(double));
+	REQUIRE(output.gcount() == static_cast<std::streamsize>(doubles.size() * sizeof(double)));
+	for (size_t game = 0; game < expected.size(); ++game) {
+		REQUIRE(std::make_pair(doubles[2 * game], doubles[2 * game + 1]) == expected[game]);
+	}
+
+	options.shard_games = 100;
+	REQUIRE_THROWS_AS(ClusterCoordinator(corpus_path, output_path, options), std::runtime_error);
+	std::remove(corpus_path.c_str());
+	std::remove(output_path.c_str());
+	std::remove(checkpoint_path.c_str());
+}
+
+TEST_CASE("Test coordinator failures", "[cluster]") {
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets;
+	makeRandomCorpus(1000, 100, 18, tokens, offsets);
+	const std::string corpus_path = "asaphus_cluster_failure_corpus.bin", output_path = "asaphus_cluster_failure_scores.bin";
+	writeTokenCorpus(corpus_path, tokens, offsets);
+
+	//checkpoints cannot be written into a missing directory, and one node stops within a result frame
+	ClusterCoordinator::Options options;
+	options.port = 0;
+	options.shard_games = 64;
+	options.frame_timeout = std::chrono::milliseconds(200);
+	options.checkpoint_path = "asaphus_missing_directory/asaphus_cluster.checkpoint";
+	options.checkpoint_interval = 1;
+	ClusterCoordinator coordinator(corpus_path, output_path, options);
+	std::exception_ptr error;
+	std::thread coordinating([&]() {
+		try {
+			coordinator.run();
+		}
+		catch (...) {
+			error = std::current_exception();
+		}
+		});
+	int stalled = ::socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(coordinator.getPort());
+	::inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+	REQUIRE(::connect(stalled, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+	const uint32_t half_result[2] = { 2, 0 };
+	REQUIRE(::send(stalled, half_result, sizeof(half_result), 0) == sizeof(half_result));
+	REQUIRE(ClusterWorker("127.0.0.1", coordinator.getPort(), corpus_path, 1).run(1) == 1);
+	coordinating.join();
+
+	REQUIRE(error);
+	REQUIRE_THROWS_AS(std::rethrow_exception(error), std::runtime_error);
+	//the results are kept although their checkpoint failed, and the stalled node was disconnected
+	const ShardScheduler& scheduler = coordinator.getScheduler();
+	REQUIRE(scheduler.getDoneCount() == 1);
+	REQUIRE(coordinator.getStatistics().games == options.shard_games);
+	char byte;
+	REQUIRE(::recv(stalled, &byte, 1, 0) == 0);
+	::close(stalled);
+	std::remove(corpus_path.c_str());
+	std::remove(output_path.c_str());
+}
+#endif
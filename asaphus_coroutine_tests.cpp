@@ -0,0 +1,151 @@
+/**
+ * @file asaphus_coroutine_tests.cpp
+ * @copyright Copyright (c) 2022 Asaphus Vision GmbH
+ *
+ * Tests of the C++20 awaitable of asaphus/coroutine.hpp. Built as C++20 against the C++14 library, only by compilers
+ * with coroutine support.
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "asaphus/coroutine.hpp"
+#include "asaphus/engine.hpp"
+
+#ifndef ASAPHUS_HAVE_COROUTINES
+#error "asaphus_coroutine_tests needs coroutine support"
+#endif
+
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch.hpp>
+
+//Coroutine that starts at once and is not awaited, the caller learns of its end through the awaited values
+struct DetachedTask {
+	struct promise_type {
+		DetachedTask get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+static std::vector<std::vector<uint32_t>> makeRandomGames(size_t game_count, size_t max_length, uint32_t token_limit, uint32_t seed) {
+	std::mt19937 generator(seed);
+	std::uniform_int_distribution<size_t> length_distribution(0, max_length);
+	std::uniform_int_distribution<uint32_t> token_distribution(0, token_limit);
+	std::vector<std::vector<uint32_t>> games(game_count);
+	for (auto& game : games) {
+		game.resize(length_distribution(generator));
+		for (auto& token : game) {
+			token = token_distribution(generator);
+		}
+	}
+	return games;
+}
+
+//Awaits the games one after the other, every game is submitted from where the coroutine resumed after the previous one,
+//the thread it resumed on is added to resume_threads
+static DetachedTask scoreInSequence(AsyncScorer& scorer, const std::vector<std::vector<uint32_t>>& games,
+	std::vector<std::pair<double, double>>& scores, std::promise<void>& done, ScoreAwaitable::Resumer resume_on = nullptr,
+	std::vector<std::thread::id>* resume_threads = nullptr) {
+	for (const auto& game : games) {
+		scores.push_back(co_await asyncPlay(scorer, game, resume_on));
+		if (resume_threads != nullptr) {
+			resume_threads->push_back(std::this_thread::get_id());
+		}
+	}
+	done.set_value();
+}
+
+static DetachedTask scoreOne(AsyncScorer& scorer, std::vector<uint32_t> game, std::promise<std::pair<double, double>>& scores) {
+	scores.set_value(co_await asyncPlay(scorer, std::move(game)));
+}
+
+TEST_CASE("Test awaiting games in sequence", "[coroutine]") {
+	AsyncScorer::Options options;
+	options.thread_count = 2;
+	options.chunk_tokens = 64;
+	AsyncScorer scorer(options);
+	std::vector<std::vector<uint32_t>> corpora[] = {
+		{ {}, { 1, 1, 2, 3 }, { 0 }, { 4294967295u, 4294967295u, 0 } },
+		makeRandomGames(100, 500, 1000, 48),
+		makeRandomGames(20, 300, 4294967295u, 49),
+	};
+	for (const auto& games : corpora) {
+		std::vector<std::pair<double, double>> scores;
+		std::promise<void> done;
+		scoreInSequence(scorer, games, scores, done);
+		done.get_future().get();
+		REQUIRE(scores.size() == games.size());
+		for (size_t game = 0; game < games.size(); ++game) {
+			REQUIRE(scores[game] == play(games[game]));
+		}
+	}
+	REQUIRE(scorer.getYieldCount() > 0);
+}
+
+TEST_CASE("Test awaiting games concurrently", "[coroutine]") {
+	AsyncScorer::Options options;
+	options.thread_count = 3;
+	options.chunk_tokens = 100;
+	AsyncScorer scorer(options);
+	auto games = makeRandomGames(200, 1000, 1000, 50);
+	games.push_back(std::vector<uint32_t>(200000, 7));
+	std::vector<std::promise<std::pair<double, double>>> scores(games.size());
+	for (size_t game = 0; game < games.size(); ++game) {
+		scoreOne(scorer, games[game], scores[game]);
+	}
+	for (size_t game = 0; game < games.size(); ++game) {
+		REQUIRE(scores[game].get_future().get() == play(games[game]));
+	}
+}
+
+TEST_CASE("Test resuming on an event loop", "[coroutine]") {
+	AsyncScorer::Options options;
+	options.thread_count = 2;
+	options.chunk_tokens = 32;
+	AsyncScorer scorer(options);
+	auto games = makeRandomGames(50, 200, 1000, 51);
+
+	//The loop runs the resumptions the scorer posts on this thread until the coroutine is done
+	std::mutex mutex;
+	std::condition_variable posted;
+	std::deque<std::function<void()>> queue;
+	auto post = [&](std::function<void()> resume) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.push_back(std::move(resume));
+		}
+		posted.notify_one();
+	};
+	std::vector<std::pair<double, double>> scores;
+	std::promise<void> done;
+	std::future<void> finished = done.get_future();
+	std::vector<std::thread::id> resume_threads;
+	scoreInSequence(scorer, games, scores, done, post, &resume_threads);
+	while (finished.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+		std::function<void()> resume;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			posted.wait(lock, [&]() { return !queue.empty(); });
+			resume = std::move(queue.front());
+			queue.pop_front();
+		}
+		resume();
+	}
+	REQUIRE(resume_threads == std::vector<std::thread::id>(games.size(), std::this_thread::get_id()));
+	REQUIRE(scores.size() == games.size());
+	for (size_t game = 0; game < games.size(); ++game) {
+		REQUIRE(scores[game] == play(games[game]));
+	}
+}
@@ -0,0 +1,469 @@
+/**
+ * @file asaphus_differential.cpp
+ * @copyright Copyright (c) 2022 Asaphus Vision GmbH
+ *
+ * Differential harness: plays random and adversarial corpora with every engine of the library side by side, checks each
+ * against a reference and times each in the same run. The reference is the original std::list implementation of the boxes,
+ * including the insertion of a blue box's middle weights three positions before the end of its list.
+ *
+ * Prints a correctness matrix of engines and corpora and a table of the speedup of every engine over the reference.
+ * Returns 1 if any engine disagrees with the reference.
+ *
+ * Usage: asaphus_differential [--games=<per corpus>] [--max-length=<tokens>] [--seed=<seed>]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "asaphus/engine.hpp"
+
+//Box of the original implementation, which kept the absorbed weights in a std::list
+class ReferenceBox {
+public:
+	ReferenceBox(double initial_weight, BoxType type) : weight_(initial_weight), type_(type) {}
+
+	double getScore() const { return score_; }
+	double getWeight() const { return weight_; }
+
+	void absorbWeight(double weight) {
+		if (type_ == BoxType::GREEN) {
+			absorbed_weights_.emplace_back(weight);
+			double mean = 0;
+			auto list_size = absorbed_weights_.size();
+			auto last_item_iter = absorbed_weights_.end();
+			if (list_size >= 3) {
+				auto third_last_item_iter = last_item_iter;
+				std::advance(third_last_item_iter, -3);
+				mean = std::accumulate(third_last_item_iter, last_item_iter, 0.0) / 3;
+			}
+			else {
+				mean = std::accumulate(absorbed_weights_.begin(), last_item_iter, 0.0) / list_size;
+			}
+			score_ = std::pow(mean, 2);
+		}
+		else {
+			if (!absorbed_weights_.empty()) {
+				if (absorbed_weights_.front() > weight) { absorbed_weights_.emplace_front(weight); }
+				else if (absorbed_weights_.back() < weight) { absorbed_weights_.emplace_back(weight); }
+				else { absorbed_weights_.insert(retreat(absorbed_weights_.end(), 3), weight); }
+			}
+			else {
+				absorbed_weights_.emplace_back(weight);
+			}
+			double sum = absorbed_weights_.front() + absorbed_weights_.back();
+			score_ = ((sum) * (sum + 1)) / 2 + absorbed_weights_.back();
+		}
+		weight_ += weight;
+	}
+
+private:
+	//std::advance(position, -steps) on the ring of a circular list, where stepping back from begin() reaches end().
+	//The original code relied on this for lists of fewer than three weights; spelled out, it is defined behavior.
+	std::list<double>::iterator retreat(std::list<double>::iterator position, size_t steps) {
+		for (; steps > 0; --steps) {
+			position = position == absorbed_weights_.begin() ? absorbed_weights_.end() : std::prev(position);
+		}
+		return position;
+	}
+
+	double weight_;
+	double score_ = 0.0;
+	BoxType type_;
+	std::list<double> absorbed_weights_;
+};
+
+struct Outcome {
+	std::pair<double, double> scores;
+	std::vector<double> weights;
+	//Turns the engine skipped instead of playing them
+	uint64_t skipped_turns = 0;
+};
+
+static Outcome playReference(const uint32_t* first, const uint32_t* last) {
+	std::vector<ReferenceBox> boxes{ { 0.0, BoxType::GREEN }, { 0.1, BoxType::GREEN }, { 0.2, BoxType::BLUE }, { 0.3, BoxType::BLUE } };
+	Outcome outcome{ { 0.0, 0.0 }, {} };
+	bool is_player_A_turn = true;
+	for (const uint32_t* token = first; token != last; ++token) {
+		auto min_box = std::min_element(boxes.begin(), boxes.end(), [](const ReferenceBox& a, const ReferenceBox& b) { return a.getWeight() < b.getWeight(); });
+		min_box->absorbWeight(static_cast<double>(*token));
+		(is_player_A_turn ? outcome.scores.first : outcome.scores.second) += min_box->getScore();
+		is_player_A_turn = !is_player_A_turn;
+	}
+	for (const auto& box : boxes) {
+		outcome.weights.push_back(box.getWeight());
+	}
+	return outcome;
+}
+
+struct Corpus {
+	std::string name;
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets{ 0 };
+
+	size_t size() const { return offsets.size() - 1; }
+	const uint32_t* begin(size_t game) const { return tokens.data() + offsets[game]; }
+	const uint32_t* end(size_t game) const { return tokens.data() + offsets[game + 1]; }
+};
+
+static const uint32_t max_token = std::numeric_limits<uint32_t>::max();
+
+//Corpora of games_per_corpus games each, of lengths up to max_length
+static std::vector<Corpus> makeCorpora(size_t games_per_corpus, size_t max_length, uint32_t seed) {
+	std::mt19937 generator(seed);
+	auto uniform = [&](uint32_t low, uint32_t high) { return std::uniform_int_distribution<uint32_t>(low, high)(generator); };
+	auto make = [&](const std::string& name, size_t min_length, size_t length_limit, const std::function<uint32_t(size_t index)>& token) {
+		Corpus corpus;
+		corpus.name = name;
+		std::uniform_int_distribution<size_t> length_distribution(min_length, std::max(min_length, length_limit));
+		for (size_t game = 0; game < games_per_corpus; ++game) {
+			for (size_t length = length_distribution(generator), index = 0; index < length; ++index) {
+				corpus.tokens.push_back(token(index));
+			}
+			corpus.offsets.push_back(corpus.tokens.size());
+		}
+		return corpus;
+	};
+
+	std::vector<Corpus> corpora;
+	corpora.push_back(make("short", 0, 3, [&](size_t) { return uniform(0, 3) == 0 ? max_token : uniform(0, 4); }));
+	corpora.push_back(make("uniform", 0, max_length, [&](size_t) { return uniform(0, 1000); }));
+	corpora.push_back(make("full-range", 0, max_length, [&](size_t) { return uniform(0, max_token); }));
+	//Few distinct small tokens keep boxes tied and blue boxes absorbing weights equal to their ends
+	corpora.push_back(make("ties", 0, max_length, [&](size_t) { return uniform(0, 2); }));
+	corpora.push_back(make("huge", 0, max_length, [&](size_t) { return max_token - uniform(0, 3); }));
+	//Fibonacci numbers wrap around at 2^32, alternating zeros and maximal tokens drive the weights apart
+	std::vector<uint32_t> fibonacci{ 1, 1 };
+	while (fibonacci.size() < max_length) {
+		fibonacci.push_back(fibonacci[fibonacci.size() - 1] + fibonacci[fibonacci.size() - 2]);
+	}
+	corpora.push_back(make("fibonacci", 0, max_length, [&](size_t index) { return fibonacci[index]; }));
+	corpora.push_back(make("adversarial", 0, max_length, [&](size_t index) { return index % 4 < 2 ? 0 : max_token - static_cast<uint32_t>(index % 3); }));
+	//Few long games of maximal tokens, whose weights grow until doubles no longer hold the fractions of the initial weights
+	size_t long_games = games_per_corpus / 20 + 1;
+	std::swap(games_per_corpus, long_games);
+	corpora.push_back(make("overflow", 50 * max_length, 100 * max_length, [&](size_t) { return max_token - uniform(0, 1); }));
+	std::swap(games_per_corpus, long_games);
+	//Runs of equal tokens and arithmetic progressions up and down, long enough to be skipped, for the run-length engines
+	corpora.push_back([&]() {
+		Corpus corpus;
+		corpus.name = "runs";
+		for (size_t game = 0; game < games_per_corpus; ++game) {
+			size_t length = std::uniform_int_distribution<size_t>(0, max_length)(generator);
+			while (corpus.tokens.size() - corpus.offsets.back() < length) {
+				const uint32_t steps[] = { 0, 0, 1, 3, static_cast<uint32_t>(-2) };
+				uint32_t step = steps[uniform(0, 4)];
+				size_t count = step == 0 ? uniform(1, 200) : uniform(1, static_cast<uint32_t>(std::max<size_t>(max_length, 200)));
+				uint32_t token = uniform(0, 3) == 0 ? max_token - uniform(0, 1) : uniform(0, 50);
+				//Falling runs start high enough to stay above 0, rising ones near the maximum wrap to 0
+				if (step == static_cast<uint32_t>(-2) && token < 2 * count) {
+					token += static_cast<uint32_t>(2 * count);
+				}
+				for (; count > 0 && corpus.tokens.size() - corpus.offsets.back() < length; --count, token += step) {
+					corpus.tokens.push_back(token);
+				}
+			}
+			corpus.offsets.push_back(corpus.tokens.size());
+		}
+		return corpus;
+		}());
+	return corpora;
+}
+
+//How an engine's results are compared with the reference
+enum class Check { SCORES, CLOSE_SCORES, PROGRESSION_SCORES, WEIGHTS, WINNER };
+
+struct Engine {
+	std::string name;
+	Check check;
+	//Fills one Outcome per game of corpus, or returns false if the engine is not available on this host
+	std::function<bool(const Corpus& corpus, std::vector<Outcome>& outcomes)> run;
+	//Corpus on which the engine has to skip turns, so that the check covers its fast-forward
+	std::string skips_on;
+};
+
+static std::vector<Outcome> fromScores(const std::vector<std::pair<double, double>>& scores) {
+	std::vector<Outcome> outcomes(scores.size());
+	for (size_t game = 0; game < scores.size(); ++game) {
+		outcomes[game].scores = scores[game];
+	}
+	return outcomes;
+}
+
+//Engine playing the corpus as one batch with play_batch(tokens, offsets, game_count, scores)
+static Engine batchEngine(const std::string& name, const std::function<bool(const Corpus&, std::pair<double, double>*)>& play_batch) {
+	return { name, Check::SCORES, [play_batch](const Corpus& corpus, std::vector<Outcome>& outcomes) {
+		std::vector<std::pair<double, double>> scores(corpus.size());
+		if (!play_batch(corpus, scores.data())) {
+			return false;
+		}
+		outcomes = fromScores(scores);
+		return true;
+	}, std::string() };
+}
+
+//Engine playing the games one by one with play_game(first, last)
+static Engine gameEngine(const std::string& name, Check check, const std::function<Outcome(const uint32_t*, const uint32_t*)>& play_game) {
+	return { name, check, [play_game](const Corpus& corpus, std::vector<Outcome>& outcomes) {
+		outcomes.resize(corpus.size());
+		for (size_t game = 0; game < corpus.size(); ++game) {
+			outcomes[game] = play_game(corpus.begin(game), corpus.end(game));
+		}
+		return true;
+	}, std::string() };
+}
+
+static Outcome scoresOnly(const std::pair<double, double>& scores) {
+	return Outcome{ scores, {} };
+}
+
+static std::vector<Engine> makeEngines() {
+	std::vector<Engine> engines;
+	engines.push_back(gameEngine("play", Check::SCORES, [](const uint32_t* first, const uint32_t* last) {
+		GameBoxes boxes;
+		return scoresOnly(playGame(first, last, boxes));
+	}));
+	engines.push_back(gameEngine("GameSession", Check::SCORES, [](const uint32_t* first, const uint32_t* last) {
+		GameSession session;
+		session.feed(first, static_cast<size_t>(last - first));
+		return scoresOnly(session.getScores());
+	}));
+	engines.push_back(gameEngine("playStatic", Check::SCORES, [](const uint32_t* first, const uint32_t* last) {
+		StandardStaticGame game;
+		return scoresOnly(game.play(first, last));
+	}));
+	engines.push_back(gameEngine("BoxSet", Check::SCORES, [](const uint32_t* first, const uint32_t* last) {
+		BoxSet boxes(GameConfig::standard());
+		return scoresOnly(boxes.play(first, last));
+	}));
+	engines.push_back(gameEngine("ArenaBoxSet", Check::SCORES, [](const uint32_t* first, const uint32_t* last) {
+		return scoresOnly(play(std::vector<uint32_t>(first, last), GameConfig::standard()));
+	}));
+	engines.push_back(gameEngine("GameState", Check::SCORES, [](const uint32_t* first, const uint32_t* last) {
+		GameState state;
+		return scoresOnly(state.play(first, last));
+	}));
+	//The run-length engines played on the runs of equal tokens and on the arithmetic progressions of a game
+	auto runLengthEngine = [](const std::string& name, Check check, std::vector<TokenRun> (*encode)(const std::vector<uint32_t>&)) {
+		Engine engine = gameEngine(name, check, [encode](const uint32_t* first, const uint32_t* last) {
+			auto runs = encode(std::vector<uint32_t>(first, last));
+			RunLengthGame game;
+			Outcome outcome = scoresOnly(game.play(runs.data(), runs.data() + runs.size()));
+			outcome.skipped_turns = game.getSkippedTurns();
+			return outcome;
+		});
+		engine.skips_on = "runs";
+		return engine;
+	};
+	engines.push_back(runLengthEngine("RunLengthGame", Check::SCORES, encodeRuns));
+	engines.push_back(runLengthEngine("RunLengthGame/progressions", Check::PROGRESSION_SCORES, encodeProgressions));
+	engines.push_back(gameEngine("ExactGame", Check::CLOSE_SCORES, [](const uint32_t* first, const uint32_t* last) {
+		ExactGame game;
+		const ExactScores& scores = game.play(first, last);
+		//Overflowed games are not comparable, NaN marks them as skipped
+		double nan = std::numeric_limits<double>::quiet_NaN();
+		return scoresOnly(scores.overflow ? std::make_pair(nan, nan) : scores.toDouble());
+	}));
+	engines.push_back(gameEngine("DeferredScoreGame", Check::CLOSE_SCORES, [](const uint32_t* first, const uint32_t* last) {
+		DeferredScoreGame game;
+		game.play(first, last);
+		return scoresOnly(game.getScores());
+	}));
+	engines.push_back(gameEngine("DeferredScoreGame/winner", Check::WINNER, [](const uint32_t* first, const uint32_t* last) {
+		DeferredScoreGame game;
+		game.play(first, last);
+		Winner winner = game.getWinner();
+		return scoresOnly(std::make_pair(winner == Winner::PLAYER_A ? 1.0 : 0.0, winner == Winner::PLAYER_B ? 1.0 : 0.0));
+	}));
+	engines.push_back(gameEngine("playWeights", Check::WEIGHTS, [](const uint32_t* first, const uint32_t* last) {
+		return Outcome{ { 0.0, 0.0 }, playWeights(first, last) };
+	}));
+
+	engines.push_back(batchEngine("playBatch", [](const Corpus& corpus, std::pair<double, double>* scores) {
+		playBatch(corpus.tokens.data(), corpus.offsets.data(), corpus.size(), scores);
+		return true;
+	}));
+	engines.push_back(batchEngine("playBatchPrefixShared", [](const Corpus& corpus, std::pair<double, double>* scores) {
+		playBatchPrefixShared(corpus.tokens.data(), corpus.offsets.data(), corpus.size(), scores);
+		return true;
+	}));
+	for (LaneKernel kernel : { LaneKernel::SCALAR, LaneKernel::AVX2, LaneKernel::AVX512 }) {
+		engines.push_back(batchEngine(std::string("playBatchLanes/") + laneKernelName(kernel), [kernel](const Corpus& corpus, std::pair<double, double>* scores) {
+			if (!isLaneKernelSupported(kernel)) {
+				return false;
+			}
+			playBatchLanes(corpus.tokens.data(), corpus.offsets.data(), corpus.size(), scores, kernel);
+			return true;
+		}));
+	}
+	engines.push_back(batchEngine("playBatch/cuda", [](const Corpus& corpus, std::pair<double, double>* scores) {
+		if (!isBatchBackendAvailable(BatchBackend::CUDA)) {
+			return false;
+		}
+		playBatch(corpus.tokens.data(), corpus.offsets.data(), corpus.size(), scores, BatchBackend::CUDA);
+		return true;
+	}));
+	engines.push_back(batchEngine("ParallelBatchRunner", [](const Corpus& corpus, std::pair<double, double>* scores) {
+		ParallelBatchRunner runner;
+		runner.playBatchLanes(corpus.tokens.data(), corpus.offsets.data(), corpus.size(), scores);
+		return true;
+	}));
+	engines.push_back(batchEngine("ResultCache", [](const Corpus& corpus, std::pair<double, double>* scores) {
+		//Played twice, so the second pass is answered from the cache
+		ResultCache cache(std::max<size_t>(corpus.size(), 1));
+		cache.playBatch(corpus.tokens.data(), corpus.offsets.data(), corpus.size(), scores);
+		cache.playBatch(corpus.tokens.data(), corpus.offsets.data(), corpus.size(), scores);
+		return true;
+	}));
+	return engines;
+}
+
+//Whether outcome of a game of turn_count turns agrees with the reference, set skipped for a result the engine marked as
+//not comparable
+static bool agrees(Check check, const Outcome& outcome, const Outcome& reference, uint64_t turn_count, bool& skipped) {
+	skipped = false;
+	auto closeWithin = [](double value, double expected, double tolerance) {
+		return value == expected || std::abs(value - expected) <= tolerance * std::max(std::abs(value), std::abs(expected));
+	};
+	auto close = [&](double value, double expected) { return closeWithin(value, expected, 1e-12); };
+	switch (check) {
+	case Check::SCORES:
+		return outcome.scores == reference.scores;
+	case Check::CLOSE_SCORES:
+		if (std::isnan(outcome.scores.first)) {
+			skipped = true;
+			return true;
+		}
+		return close(outcome.scores.first, reference.scores.first) && close(outcome.scores.second, reference.scores.second);
+	case Check::PROGRESSION_SCORES: {
+		double tolerance = RunLengthGame::maxRelativeError(turn_count);
+		return closeWithin(outcome.scores.first, reference.scores.first, tolerance) &&
+			closeWithin(outcome.scores.second, reference.scores.second, tolerance);
+	}
+	case Check::WEIGHTS:
+		return outcome.weights == reference.weights;
+	default:
+		//Scores equal up to rounding may be told apart either way
+		if (close(reference.scores.first, reference.scores.second)) {
+			skipped = true;
+			return true;
+		}
+		return (outcome.scores.first == 1.0) == (reference.scores.first > reference.scores.second) &&
+			(outcome.scores.second == 1.0) == (reference.scores.second > reference.scores.first);
+	}
+}
+
+static bool parseOption(const std::string& argument, const std::string& name, unsigned long long& value) {
+	if (argument.compare(0, name.size() + 3, "--" + name + "=") != 0) {
+		return false;
+	}
+	value = std::strtoull(argument.c_str() + name.size() + 3, nullptr, 10);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	unsigned long long games = 200, max_length = 2000, seed = 1;
+	for (int i = 1; i < argc; ++i) {
+		std::string argument = argv[i];
+		if (!parseOption(argument, "games", games) && !parseOption(argument, "max-length", max_length) && !parseOption(argument, "seed", seed)) {
+			std::cerr << "usage: " << argv[0] << " [--games=<per corpus>] [--max-length=<tokens>] [--seed=<seed>]" << std::endl;
+			return 1;
+		}
+	}
+
+	auto corpora = makeCorpora(static_cast<size_t>(games), static_cast<size_t>(max_length), static_cast<uint32_t>(seed));
+	auto engines = makeEngines();
+	using Clock = std::chrono::steady_clock;
+	auto seconds = [](Clock::time_point start) { return std::chrono::duration<double>(Clock::now() - start).count(); };
+
+	//cells[engine][corpus] holds the mismatch count, -1 if the engine is not available
+	std::vector<std::vector<long long>> cells(engines.size(), std::vector<long long>(corpora.size(), 0));
+	std::vector<std::vector<long long>> skipped(engines.size(), std::vector<long long>(corpora.size(), 0));
+	std::vector<double> engine_seconds(engines.size(), 0.0);
+	double reference_seconds = 0.0;
+	size_t total_tokens = 0;
+	bool all_agree = true;
+	for (size_t corpus_index = 0; corpus_index < corpora.size(); ++corpus_index) {
+		const Corpus& corpus = corpora[corpus_index];
+		total_tokens += corpus.tokens.size();
+		std::vector<Outcome> reference(corpus.size());
+		auto start = Clock::now();
+		for (size_t game = 0; game < corpus.size(); ++game) {
+			reference[game] = playReference(corpus.begin(game), corpus.end(game));
+		}
+		reference_seconds += seconds(start);
+
+		for (size_t engine = 0; engine < engines.size(); ++engine) {
+			std::vector<Outcome> outcomes;
+			start = Clock::now();
+			bool available = engines[engine].run(corpus, outcomes);
+			engine_seconds[engine] += seconds(start);
+			if (!available) {
+				cells[engine][corpus_index] = -1;
+				continue;
+			}
+			uint64_t skipped_turns = 0;
+			for (size_t game = 0; game < corpus.size(); ++game) {
+				bool is_skipped;
+				uint64_t turn_count = static_cast<uint64_t>(corpus.end(game) - corpus.begin(game));
+				skipped_turns += outcomes[game].skipped_turns;
+				if (!agrees(engines[engine].check, outcomes[game], reference[game], turn_count, is_skipped)) {
+					if (cells[engine][corpus_index] == 0) {
+						std::fprintf(stderr, "%s disagrees on %s game %zu of %zu tokens\n", engines[engine].name.c_str(), corpus.name.c_str(),
+							game, static_cast<size_t>(corpus.end(game) - corpus.begin(game)));
+					}
+					++cells[engine][corpus_index];
+					all_agree = false;
+				}
+				skipped[engine][corpus_index] += is_skipped ? 1 : 0;
+			}
+			if (engines[engine].skips_on == corpus.name && !corpus.tokens.empty() && skipped_turns == 0) {
+				std::fprintf(stderr, "%s skipped no turns of %s\n", engines[engine].name.c_str(), corpus.name.c_str());
+				cells[engine][corpus_index] = std::max<long long>(cells[engine][corpus_index], 1);
+				all_agree = false;
+			}
+		}
+	}
+
+	std::printf("correctness against the std::list reference, %llu games per corpus (ok, mismatching games, - unavailable, +n skipped)\n", games);
+	std::printf("%-26s", "engine");
+	for (const auto& corpus : corpora) {
+		std::printf(" %12s", corpus.name.c_str());
+	}
+	std::printf("\n");
+	for (size_t engine = 0; engine < engines.size(); ++engine) {
+		std::printf("%-26s", engines[engine].name.c_str());
+		for (size_t corpus = 0; corpus < corpora.size(); ++corpus) {
+			std::string cell = cells[engine][corpus] < 0 ? "-" : cells[engine][corpus] == 0 ? "ok" : "FAIL " + std::to_string(cells[engine][corpus]);
+			if (skipped[engine][corpus] != 0) {
+				cell += " +" + std::to_string(skipped[engine][corpus]);
+			}
+			std::printf(" %12s", cell.c_str());
+		}
+		std::printf("\n");
+	}
+
+	std::printf("\ntimings over all corpora, %zu tokens\n", total_tokens);
+	std::printf("%-26s %14s %10s\n", "engine", "ns/token", "speedup");
+	auto nsPerToken = [&](double time) { return total_tokens == 0 ? 0.0 : time * 1e9 / static_cast<double>(total_tokens); };
+	std::printf("%-26s %14.3f %10.2f\n", "reference", nsPerToken(reference_seconds), 1.0);
+	for (size_t engine = 0; engine < engines.size(); ++engine) {
+		bool available = std::any_of(cells[engine].begin(), cells[engine].end(), [](long long cell) { return cell >= 0; });
+		if (available) {
+			std::printf("%-26s %14.3f %10.2f\n", engines[engine].name.c_str(), nsPerToken(engine_seconds[engine]),
+				engine_seconds[engine] > 0.0 ? reference_seconds / engine_seconds[engine] : 0.0);
+		}
+	}
+	return all_agree ? 0 : 1;
+}
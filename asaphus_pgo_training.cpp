@@ -0,0 +1,84 @@
+/**
+ * @file asaphus_pgo_training.cpp
+ * @copyright Copyright (c) 2022 Asaphus Vision GmbH
+ *
+ * Training workload of profile-guided builds: Fibonacci and random corpora played through play(), the batch engines,
+ * every supported lane kernel and the parallel runner.
+ *
+ * Usage: asaphus_pgo_training [--scale=<factor>]
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "asaphus/engine.hpp"
+
+//Games of uniform random length in [0, max_length] with tokens below max_token
+static void makeCorpus(size_t game_count, size_t max_length, uint32_t max_token, uint32_t seed,
+	std::vector<uint32_t>& tokens, std::vector<uint64_t>& offsets) {
+	std::mt19937 generator(seed);
+	std::uniform_int_distribution<size_t> length_distribution(0, max_length);
+	std::uniform_int_distribution<uint32_t> token_distribution(0, max_token - 1);
+	tokens.clear();
+	offsets.assign(1, 0);
+	for (size_t game = 0; game < game_count; ++game) {
+		for (size_t length = length_distribution(generator); length > 0; --length) {
+			tokens.push_back(token_distribution(generator));
+		}
+		offsets.push_back(tokens.size());
+	}
+}
+
+int main(int argc, char** argv) {
+	size_t scale = 1;
+	for (int i = 1; i < argc; ++i) {
+		std::string argument = argv[i];
+		if (argument.compare(0, 8, "--scale=") == 0) {
+			scale = std::max<size_t>(1, std::strtoull(argument.c_str() + 8, nullptr, 10));
+		}
+		else {
+			std::cerr << "usage: " << argv[0] << " [--scale=<factor>]" << std::endl;
+			return 1;
+		}
+	}
+
+	double checksum = 0.0;
+	std::vector<uint32_t> fibonacci{ 1, 1 };
+	while (fibonacci.size() < 100000 * scale) {
+		fibonacci.push_back(fibonacci[fibonacci.size() - 1] + fibonacci[fibonacci.size() - 2]);
+	}
+	for (size_t length = 10; length <= fibonacci.size(); length *= 10) {
+		std::vector<uint32_t> prefix(fibonacci.begin(), fibonacci.begin() + length);
+		checksum += play(prefix).first + playStatic(prefix).second;
+	}
+
+	std::vector<uint32_t> tokens;
+	std::vector<uint64_t> offsets;
+	GameConfig custom;
+	custom.addGreenBox(0.0).addBlueBox(0.15).addGreenBox(0.25).addBlueBox(0.4).addGreenBox(0.5);
+	ParallelBatchRunner runner;
+	for (uint32_t max_token : { 2u, 1000u, 1u << 20 }) {
+		makeCorpus(2000 * scale, 1000, max_token, max_token, tokens, offsets);
+		std::vector<std::pair<double, double>> scores(offsets.size() - 1);
+		playBatch(tokens.data(), offsets.data(), scores.size(), scores.data());
+		playBatch(tokens.data(), offsets.data(), scores.size(), scores.data(), custom);
+		for (LaneKernel kernel : { LaneKernel::SCALAR, LaneKernel::AVX2, LaneKernel::AVX512 }) {
+			if (isLaneKernelSupported(kernel)) {
+				playBatchLanes(tokens.data(), offsets.data(), scores.size(), scores.data(), kernel);
+			}
+		}
+		runner.playBatchLanes(tokens.data(), offsets.data(), scores.size(), scores.data());
+		runner.playBatch(tokens.data(), offsets.data(), scores.size(), scores.data(), custom);
+		for (size_t game = 0; game + 1 < offsets.size(); ++game) {
+			checksum += play(std::vector<uint32_t>(tokens.begin() + offsets[game], tokens.begin() + offsets[game + 1])).first;
+		}
+		checksum += scores.back().first;
+	}
+	std::printf("training checksum %g\n", checksum);
+	return 0;
+}
@@ -0,0 +1,95 @@
+/**
+ * @file asaphus_service.cpp
+ * @copyright Copyright (c) 2022 Asaphus Vision GmbH
+ *
+ * Scoring service serving the framed requests of asaphus/service.hpp until it receives SIGINT or SIGTERM.
+ *
+ * Usage: asaphus_service [--port=<port>] [--io-threads=<count>] [--compute-threads=<count>] [--max-batch-requests=<count>]
+ *                        [--max-batch-tokens=<count>] [--max-delay-us=<microseconds>] [--cache-capacity=<games>]
+ *                        [--max-outstanding=<requests>] [--max-output-bytes=<bytes>]
+ */
+
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "asaphus/service.hpp"
+
+static ScoringServer* running_server = nullptr;
+
+static void stopServer(int) {
+	if (running_server != nullptr) {
+		running_server->stop();
+	}
+}
+
+static bool parseOption(const std::string& argument, const std::string& name, unsigned long long& value) {
+	if (argument.compare(0, name.size() + 3, "--" + name + "=") != 0) {
+		return false;
+	}
+	value = std::strtoull(argument.c_str() + name.size() + 3, nullptr, 10);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	ScoringServer::Options options;
+	for (int i = 1; i < argc; ++i) {
+		std::string argument = argv[i];
+		unsigned long long value = 0;
+		if (parseOption(argument, "port", value)) {
+			options.port = static_cast<uint16_t>(value);
+		}
+		else if (parseOption(argument, "io-threads", value)) {
+			options.io_threads = static_cast<unsigned>(value);
+		}
+		else if (parseOption(argument, "compute-threads", value)) {
+			options.compute_threads = static_cast<unsigned>(value);
+		}
+		else if (parseOption(argument, "max-batch-requests", value)) {
+			options.policy.max_requests = static_cast<size_t>(value);
+		}
+		else if (parseOption(argument, "max-batch-tokens", value)) {
+			options.policy.max_tokens = static_cast<size_t>(value);
+		}
+		else if (parseOption(argument, "max-delay-us", value)) {
+			options.policy.max_delay = std::chrono::microseconds(value);
+		}
+		else if (parseOption(argument, "cache-capacity", value)) {
+			options.cache_capacity = static_cast<size_t>(value);
+		}
+		else if (parseOption(argument, "max-outstanding", value)) {
+			options.max_outstanding = static_cast<size_t>(value);
+		}
+		else if (parseOption(argument, "max-output-bytes", value)) {
+			options.max_output_bytes = static_cast<size_t>(value);
+		}
+		else {
+			std::cerr << "usage: " << argv[0] << " [--port=<port>] [--io-threads=<count>] [--compute-threads=<count>]"
+				" [--max-batch-requests=<count>] [--max-batch-tokens=<count>] [--max-delay-us=<microseconds>] [--cache-capacity=<games>]"
+				" [--max-outstanding=<requests>] [--max-output-bytes=<bytes>]" << std::endl;
+			return 1;
+		}
+	}
+
+	try {
+		ScoringServer server(options);
+		running_server = &server;
+		std::signal(SIGINT, stopServer);
+		std::signal(SIGTERM, stopServer);
+		std::signal(SIGPIPE, SIG_IGN);
+		std::cerr << "serving on port " << server.getPort() << std::endl;
+		server.run();
+		running_server = nullptr;
+		if (server.getCache() != nullptr) {
+			ResultCache::Statistics statistics = server.getCache()->getStatistics();
+			std::cerr << "result cache: " << statistics.hits << " hits, " << statistics.misses << " misses, "
+				<< statistics.evictions << " evictions" << std::endl;
+		}
+	}
+	catch (const std::exception& error) {
+		std::cerr << error.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
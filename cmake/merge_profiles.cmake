@@ -0,0 +1,9 @@
+# Merges the raw profiles Clang wrote to PROFILE_DIRECTORY into the default.profdata that -fprofile-use reads
+file(GLOB raw_profiles ${PROFILE_DIRECTORY}/*.profraw)
+if(NOT raw_profiles)
+  message(FATAL_ERROR "No raw profiles in ${PROFILE_DIRECTORY}")
+endif()
+execute_process(COMMAND ${LLVM_PROFDATA} merge -output=${PROFILE_DIRECTORY}/default.profdata ${raw_profiles} RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "llvm-profdata failed to merge the profiles")
+endif()
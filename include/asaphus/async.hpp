@@ -0,0 +1,88 @@
+/**
+ * @file async.hpp
+ * @copyright Copyright (c) 2022 Asaphus Vision GmbH
+ *
+ * Asynchronous scoring for event-loop services. An AsyncScorer plays submitted games on a persistent pool of threads and
+ * reports their scores through a callback or a future, so the caller never blocks on a game. Games are played in chunks of
+ * a GameSession: after every chunk a game that is not finished goes back to the end of the queue, so a huge game delays the
+ * games submitted after it by at most one chunk per thread instead of by all of its tokens.
+ *
+ * asaphus/coroutine.hpp adds a C++20 awaitable on top of it.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "asaphus/engine.hpp"
+
+//Persistent pool playing standard games in chunks, fairly interleaving the games in flight
+class AsyncScorer {
+public:
+	struct Options {
+		unsigned thread_count = 0;    //0 uses one thread per hardware thread
+		size_t chunk_tokens = 1 << 16; //tokens a thread plays of a game before it turns to the next one
+	};
+
+	//Called on a thread of the pool with the scores of the game, or with an exception if it could not be played; must not throw
+	using Callback = std::function<void(const std::pair<double, double>& scores, std::exception_ptr error)>;
+
+	AsyncScorer() : AsyncScorer(Options()) {}
+	explicit AsyncScorer(const Options& options);
+	AsyncScorer(const AsyncScorer&) = delete;
+	AsyncScorer& operator=(const AsyncScorer&) = delete;
+	//Plays the games still queued, then stops the threads
+	~AsyncScorer();
+
+	//Queues the game and returns at once, throws if the scorer is stopping
+	void play(std::vector<uint32_t> tokens, Callback callback);
+
+	std::future<std::pair<double, double>> play(std::vector<uint32_t> tokens) {
+		auto promise = std::make_shared<std::promise<std::pair<double, double>>>();
+		std::future<std::pair<double, double>> future = promise->get_future();
+		play(std::move(tokens), [promise](const std::pair<double, double>& scores, std::exception_ptr error) {
+			if (error) {
+				promise->set_exception(error);
+			}
+			else {
+				promise->set_value(scores);
+			}
+		});
+		return future;
+	}
+
+	unsigned getThreadCount() const { return static_cast<unsigned>(threads_.size()); }
+	//Games queued or being played
+	size_t getPendingCount() const;
+	//Times an unfinished game went back to the queue
+	uint64_t getYieldCount() const;
+
+private:
+	struct Game {
+		std::vector<uint32_t> tokens;
+		size_t played = 0;
+		GameSession session;
+		Callback callback;
+	};
+
+	void work();
+
+	Options options_;
+	mutable std::mutex mutex_;
+	std::condition_variable queued_;
+	std::deque<std::unique_ptr<Game>> queue_;
+	size_t pending_ = 0;
+	uint64_t yields_ = 0;
+	bool stopping_ = false;
+	std::vector<std::thread> threads_;
+};
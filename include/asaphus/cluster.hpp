@@ -0,0 +1,214 @@
+/**
+ * @file cluster.hpp
+ * @copyright Copyright (c) 2022 Asaphus Vision GmbH
+ *
+ * Distributed scoring of a TokenCorpus. A coordinator splits the games of the corpus into shards of consecutive games and
+ * hands them to workers, which map the same corpus file, play their shards with a ParallelBatchRunner and return the scores.
+ * The coordinator writes the scores to an output file of two host-order doubles per game, as BinarySink does, merges the
+ * statistics of the scores and checkpoints which shards are done, so a restarted coordinator continues where the last one
+ * stopped. A shard a worker has held for longer than the straggler timeout is handed to a second worker as well, the first
+ * result wins; the shards of a worker whose connection breaks go back to the pending ones.
+ *
+ * Frames are little-endian. A worker sends a shard request, a uint32 1, or a shard result, a uint32 2 followed by the uint64
+ * shard index, the uint64 game count and the score doubles of the games. The coordinator answers a request with an
+ * assignment, a uint32 1 followed by the uint64 shard index, first game and game count, or with a uint32 2 once all shards
+ * are done.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <istream>
+#include <limits>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "asaphus/engine.hpp"
+
+//Hands out shards of consecutive games and tracks which ones are done, without any I/O
+class ShardScheduler {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	struct Shard {
+		uint64_t index;
+		uint64_t first_game;
+		uint64_t game_count;
+	};
+
+	ShardScheduler(uint64_t game_count, uint64_t shard_games, Clock::duration straggler_timeout);
+
+	//Next shard for worker: the first pending one, or else a straggler, a shard only another worker has been playing for
+	//longer than the straggler timeout. Returns false if there is none.
+	bool assign(uint64_t worker, Clock::time_point now, Shard& shard);
+
+	//Records that worker finished shard, returns false if it was done already or is not assigned to worker
+	bool complete(uint64_t worker, uint64_t shard);
+
+	bool isAssigned(uint64_t worker, uint64_t shard) const;
+
+	//Forgets the assignments of worker, shards nobody else is playing become pending again
+	void release(uint64_t worker);
+
+	//Marks a shard done without an assignment, as when restoring a checkpoint
+	void markDone(uint64_t shard);
+
+	bool isDone(uint64_t shard) const { return done_[shard] != 0; }
+	bool isDone() const { return done_count_ == done_.size(); }
+	uint64_t getShardCount() const { return done_.size(); }
+	uint64_t getDoneCount() const { return done_count_; }
+	uint64_t getRedispatchCount() const { return redispatch_count_; }
+	uint64_t getGameCount() const { return game_count_; }
+	uint64_t getShardGames() const { return shard_games_; }
+	Shard getShard(uint64_t index) const;
+
+	//Earliest time a shard in flight becomes a straggler, Clock::time_point::max() if none can
+	Clock::time_point getNextStragglerTime() const;
+
+private:
+	struct Assignment {
+		uint64_t worker;
+		Clock::time_point start;
+	};
+
+	uint64_t game_count_;
+	uint64_t shard_games_;
+	Clock::duration straggler_timeout_;
+	std::vector<uint8_t> done_;
+	uint64_t done_count_ = 0;
+	uint64_t redispatch_count_ = 0;
+	std::deque<uint64_t> pending_;
+	std::unordered_map<uint64_t, std::vector<Assignment>> in_flight_; //assignments of every shard in flight
+};
+
+//Win counts and histograms of the scores of both players, which merge across shards.
+//Bucket 0 counts scores below 1, bucket b scores in [2^(b - 1), 2^b), the last bucket larger and non-finite scores.
+struct ScoreStatistics {
+	static const size_t bucket_count = 130;
+
+	uint64_t games = 0;
+	uint64_t wins_A = 0;
+	uint64_t wins_B = 0;
+	uint64_t ties = 0;
+	std::array<uint64_t, bucket_count> histogram_A{};
+	std::array<uint64_t, bucket_count> histogram_B{};
+
+	static size_t getBucket(double score);
+
+	void add(const std::pair<double, double>& scores) {
+		++games;
+		if (scores.first > scores.second) {
+			++wins_A;
+		}
+		else if (scores.second > scores.first) {
+			++wins_B;
+		}
+		else {
+			++ties;
+		}
+		++histogram_A[getBucket(scores.first)];
+		++histogram_B[getBucket(scores.second)];
+	}
+
+	void merge(const ScoreStatistics& other);
+
+	//Binary form in host byte order, as stored in checkpoints
+	void write(std::ostream& stream) const;
+	void read(std::istream& stream);
+
+	//Win counts and the non-empty buckets as text
+	void writeSummary(std::ostream& stream) const;
+
+	bool operator==(const ScoreStatistics& rhs) const {
+		return games == rhs.games && wins_A == rhs.wins_A && wins_B == rhs.wins_B && ties == rhs.ties &&
+			histogram_A == rhs.histogram_A && histogram_B == rhs.histogram_B;
+	}
+	bool operator!=(const ScoreStatistics& rhs) const { return !(*this == rhs); }
+};
+
+//Coordinator serving workers on a port of all interfaces until every shard of the corpus is scored
+class ClusterCoordinator {
+public:
+	struct Options {
+		uint16_t port = 7412; //0 picks a free port
+		uint64_t shard_games = 1 << 16;
+		std::chrono::milliseconds straggler_timeout = std::chrono::milliseconds(60000);
+		std::chrono::milliseconds frame_timeout = std::chrono::milliseconds(10000); //a worker sending a frame slower is disconnected
+		std::string checkpoint_path; //no checkpoints if empty
+		uint64_t checkpoint_interval = 16; //shards between checkpoints
+	};
+
+	//Resumes from the checkpoint if options.checkpoint_path names one, which must be of the same corpus and shard size
+	ClusterCoordinator(const std::string& corpus_path, const std::string& output_path, const Options& options);
+	ClusterCoordinator(const ClusterCoordinator&) = delete;
+	ClusterCoordinator& operator=(const ClusterCoordinator&) = delete;
+	~ClusterCoordinator();
+
+	uint16_t getPort() const { return port_; }
+
+	//Serves workers until every shard is done or stop() is called, then writes a checkpoint. Throws the error of a checkpoint
+	//that could not be written once the workers are disconnected, the results stored until then are kept.
+	void run();
+
+	//Only writes to a pipe, so it may be called from a signal handler
+	void stop() {
+		char byte = 0;
+		ssize_t written = ::write(stop_pipe_[1], &byte, 1);
+		(void)written;
+	}
+
+	//Statistics and progress, only while run() is not running
+	const ScoreStatistics& getStatistics() const { return statistics_; }
+	const ShardScheduler& getScheduler() const { return scheduler_; }
+
+private:
+	void serveWorker(int socket, uint64_t worker);
+	bool storeResult(uint64_t worker, uint64_t shard, const std::vector<std::pair<double, double>>& scores);
+	void loadCheckpoint();
+	void writeCheckpoint();
+
+	Options options_;
+	ShardScheduler scheduler_;
+	int output_file_ = -1;
+	int listen_socket_ = -1;
+	uint16_t port_ = 0;
+	int stop_pipe_[2] = { -1, -1 };
+	std::mutex mutex_;
+	std::condition_variable progress_;
+	bool finished_ = false;
+	ShardScheduler::Clock::time_point finish_deadline_; //connections are closed after it once finished
+	ScoreStatistics statistics_;
+	uint64_t unsaved_shards_ = 0; //done since the last checkpoint
+	std::exception_ptr checkpoint_error_; //of the first checkpoint that failed during run()
+	std::vector<int> worker_sockets_;
+	std::vector<std::thread> worker_threads_;
+};
+
+//Worker playing the shards a coordinator assigns, on thread_count threads
+class ClusterWorker {
+public:
+	ClusterWorker(const std::string& host, uint16_t port, const std::string& corpus_path, unsigned thread_count = 0);
+	ClusterWorker(const ClusterWorker&) = delete;
+	ClusterWorker& operator=(const ClusterWorker&) = delete;
+	~ClusterWorker() { ::close(socket_); }
+
+	//Plays shards until the coordinator has none left or max_shards are played, returns the number of shards played
+	uint64_t run(uint64_t max_shards = std::numeric_limits<uint64_t>::max());
+
+private:
+	TokenCorpus corpus_;
+	ParallelBatchRunner runner_;
+	int socket_ = -1;
+};
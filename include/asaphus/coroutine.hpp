@@ -0,0 +1,70 @@
+/**
+ * @file coroutine.hpp
+ * @copyright Copyright (c) 2022 Asaphus Vision GmbH
+ *
+ * C++20 coroutine interface of AsyncScorer: inside a coroutine of any task type,
+ *
+ *     std::pair<double, double> scores = co_await asyncPlay(scorer, tokens);
+ *
+ * suspends until the game is played. The library itself is C++14, so everything below is only declared when the including
+ * translation unit is compiled with coroutine support.
+ */
+
+#pragma once
+
+#include "asaphus/async.hpp"
+
+#if defined(__has_include)
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#define ASAPHUS_HAVE_COROUTINES 1
+#endif
+#endif
+
+#ifdef ASAPHUS_HAVE_COROUTINES
+
+#include <coroutine>
+
+//Awaitable of the scores of a game. The awaiting coroutine resumes on the thread of the scorer that finished the game or,
+//given resume_on, wherever resume_on runs the function it is passed, such as the thread of an event loop.
+class ScoreAwaitable {
+public:
+	using Resumer = std::function<void(std::function<void()> resume)>;
+
+	ScoreAwaitable(AsyncScorer& scorer, std::vector<uint32_t> tokens, Resumer resume_on = nullptr)
+		: scorer_(scorer), tokens_(std::move(tokens)), resume_on_(std::move(resume_on)) {}
+
+	bool await_ready() const noexcept { return false; }
+
+	void await_suspend(std::coroutine_handle<> handle) {
+		scorer_.play(std::move(tokens_), [this, handle](const std::pair<double, double>& scores, std::exception_ptr error) {
+			scores_ = scores;
+			error_ = error;
+			if (resume_on_) {
+				resume_on_([handle]() { handle.resume(); });
+			}
+			else {
+				handle.resume();
+			}
+		});
+	}
+
+	std::pair<double, double> await_resume() {
+		if (error_) {
+			std::rethrow_exception(error_);
+		}
+		return scores_;
+	}
+
+private:
+	AsyncScorer& scorer_;
+	std::vector<uint32_t> tokens_;
+	Resumer resume_on_;
+	std::pair<double, double> scores_;
+	std::exception_ptr error_;
+};
+
+inline ScoreAwaitable asyncPlay(AsyncScorer& scorer, std::vector<uint32_t> tokens, ScoreAwaitable::Resumer resume_on = nullptr) {
+	return ScoreAwaitable(scorer, std::move(tokens), std::move(resume_on));
+}
+
+#endif
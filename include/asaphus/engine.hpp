@@ -0,0 +1,2369 @@
+/**
+ * @file engine.hpp
+ * @copyright Copyright (c) 2022 Asaphus Vision GmbH
+ *
+ * Public header of the asaphus library, the game engine of the coding challenge: boxes, players, play() and the batch,
+ * streaming and corpus engines built on them. Everything the hot loops inline stays in this header, the batch entry points,
+ * searches and file handling are compiled into the library from src/engine.cpp.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <numeric>
+#include <ostream>
+#include <ratio>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+//Functions the CUDA backend shares with the host engines, so the device plays with the very same operations
+#if defined(__CUDACC__)
+#define ASAPHUS_HOST_DEVICE __host__ __device__
+#else
+#define ASAPHUS_HOST_DEVICE
+#endif
+
+//Instrumentation of the engines, off unless ASAPHUS_INSTRUMENTATION is defined to 1 for the library and its users alike,
+//as the asaphus_instrumented target does. When off, ASAPHUS_INSTRUMENT() removes its statement so the hot paths are
+//compiled exactly as without it.
+#ifndef ASAPHUS_INSTRUMENTATION
+#define ASAPHUS_INSTRUMENTATION 0
+#endif
+
+#if ASAPHUS_INSTRUMENTATION
+#define ASAPHUS_INSTRUMENT(...) __VA_ARGS__
+#else
+#define ASAPHUS_INSTRUMENT(...)
+#endif
+
+//Time stamp counter on x86, nanoseconds of the steady clock elsewhere
+inline uint64_t readCycleCounter() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	return __rdtsc();
+#elif defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+//Counters of the turns played by Player::takeTurn(), BoxSet and StaticGame, and of ResultCache lookups
+struct GameCounters {
+	uint64_t turns = 0;
+	uint64_t tied_turns = 0;            //turns with more than one box of the smallest weight
+	uint64_t turn_cycles = 0;
+	uint64_t absorb_calls = 0;          //calls of Box::absorbWeight()
+	uint64_t absorb_cycles = 0;
+	uint64_t cache_hits = 0;            //lookups of a ResultCache
+	uint64_t cache_misses = 0;
+	std::vector<uint64_t> absorptions;  //tokens absorbed by each box index
+	std::vector<double> contributions;  //scores each box index added to the players' scores
+
+	void recordTurn(size_t box, double score, bool tied, uint64_t cycles) {
+		if (box >= absorptions.size()) {
+			absorptions.resize(box + 1, 0);
+			contributions.resize(box + 1, 0.0);
+		}
+		++turns;
+		tied_turns += tied ? 1 : 0;
+		turn_cycles += cycles;
+		++absorptions[box];
+		contributions[box] += score;
+	}
+
+	void merge(const GameCounters& other);
+	void writeSummary(std::ostream& stream) const;
+};
+
+//Counters of every thread. Threads count into their own counters, which are merged into the retired ones when the thread
+//exits, so the workers of the parallel engine never share a cache line. collect() must not run concurrently with games.
+class Instrumentation {
+public:
+	static bool isEnabled() { return ASAPHUS_INSTRUMENTATION != 0; }
+
+	static GameCounters& threadCounters() {
+		static thread_local ThreadCounters counters;
+		return counters.counters;
+	}
+
+	//Counters of the exited threads merged with those of the running ones
+	static GameCounters collect() {
+		Registry& registry = getRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		GameCounters total = registry.retired;
+		for (const GameCounters* counters : registry.running) {
+			total.merge(*counters);
+		}
+		return total;
+	}
+
+	static void reset() {
+		Registry& registry = getRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		registry.retired = GameCounters();
+		for (GameCounters* counters : registry.running) {
+			*counters = GameCounters();
+		}
+	}
+
+private:
+	struct Registry {
+		std::mutex mutex;
+		std::vector<GameCounters*> running;
+		GameCounters retired;
+	};
+
+	struct ThreadCounters {
+		GameCounters counters;
+
+		ThreadCounters() {
+			Registry& registry = getRegistry();
+			std::lock_guard<std::mutex> lock(registry.mutex);
+			registry.running.push_back(&counters);
+		}
+		~ThreadCounters() {
+			Registry& registry = getRegistry();
+			std::lock_guard<std::mutex> lock(registry.mutex);
+			registry.retired.merge(counters);
+			registry.running.erase(std::find(registry.running.begin(), registry.running.end(), &counters));
+		}
+	};
+
+	static Registry& getRegistry() {
+		static Registry registry;
+		return registry;
+	}
+};
+
+//Whether another box than chosen weighs as little as it
+template <typename WeightFunction>
+bool isTiedTurn(size_t box_count, size_t chosen, WeightFunction weight) {
+	for (size_t box = 0; box < box_count; ++box) {
+		if (box != chosen && weight(box) == weight(chosen)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+enum class BoxType { GREEN, BLUE };
+
+//Window over the 3 weights a green box absorbed most recently
+struct GreenWindow {
+	double weights[3] = { 0.0, 0.0, 0.0 };
+	uint32_t count = 0; //number of valid slots, saturates at 3
+	uint32_t next = 0;  //slot the next absorbed weight is written to
+
+	ASAPHUS_HOST_DEVICE void absorb(double weight) {
+		weights[next] = weight;
+		next = (next == 2) ? 0 : next + 1;
+		if (count < 3) {
+			++count;
+		}
+	}
+
+	//Sum of the window in absorption order, so rounding matches summing the weights one after another
+	ASAPHUS_HOST_DEVICE double sum() const {
+		if (count < 3) {
+			return count == 1 ? 0.0 + weights[0] : (0.0 + weights[0]) + weights[1];
+		}
+		uint32_t second = (next == 2) ? 0 : next + 1;
+		uint32_t third = (second == 2) ? 0 : second + 1;
+		return ((0.0 + weights[next]) + weights[second]) + weights[third];
+	}
+
+	//mean * mean is what optimizing compilers make of std::pow(mean, 2), spelled out so that unoptimized builds
+	//and the lane-parallel engine round the same way
+	ASAPHUS_HOST_DEVICE double score() const {
+		double mean = sum() / count;
+		return mean * mean;
+	}
+};
+
+//Ends of the weight list a blue box pairs its score from.
+//Weights that are neither a new smallest nor a new largest one were inserted three positions before the end of that list,
+//which wraps around to the back for two and to the front for three absorbed weights; this is kept so scores stay unchanged.
+template <typename Weight>
+struct BasicBlueRange {
+	Weight front = 0;
+	Weight back = 0;
+	uint32_t count = 0; //number of absorbed weights, saturates at 4
+
+	ASAPHUS_HOST_DEVICE void absorb(Weight weight) {
+		if (count == 0) {
+			front = weight;
+			back = weight;
+		}
+		else if (front > weight) { front = weight; }
+		else if (back < weight) { back = weight; }
+		else if (count == 2) { back = weight; }
+		else if (count == 3) { front = weight; }
+		if (count < 4) {
+			++count;
+		}
+	}
+};
+
+struct BlueRange : BasicBlueRange<double> {
+	ASAPHUS_HOST_DEVICE double score() const {
+		double sum = front + back;
+		return ((sum) * (sum + 1)) / 2 + back; //Cantor's pairing function of the smallest and largest weight
+	}
+};
+
+class Box {
+public:
+	explicit Box(double initial_weight) : weight_(initial_weight) {}
+	Box(double initial_weight, BoxType type) : weight_(initial_weight), type_(type) {}
+	static std::unique_ptr<Box> makeGreenBox(double initial_weight);
+	static std::unique_ptr<Box> makeBlueBox(double initial_weight);
+	bool operator<(const Box& rhs) const { return weight_ < rhs.weight_; }
+
+	double getScore() const { return score_; }
+	double getWeight() const { return weight_; }
+	void absorbWeight(double weight);
+
+	BoxType getBoxType() const { return type_; }
+	void setBoxType(BoxType newType) { type_ = newType; }
+
+protected:
+	double weight_;
+	double score_ = 0.0;
+	GreenWindow green_window_;
+	BlueRange blue_range_;
+	BoxType type_ = BoxType::GREEN;
+};
+
+//Method to absorb weight into the box
+inline void Box::absorbWeight(double weight) {
+	ASAPHUS_INSTRUMENT(uint64_t start_cycles = readCycleCounter());
+	if (this->getBoxType() == BoxType::GREEN) {
+		green_window_.absorb(weight);
+		score_ = green_window_.score();
+	}
+	else {
+		blue_range_.absorb(weight);
+		score_ = blue_range_.score();
+	}
+	this->weight_ += weight;
+	ASAPHUS_INSTRUMENT(GameCounters& counters = Instrumentation::threadCounters();
+		++counters.absorb_calls;
+		counters.absorb_cycles += readCycleCounter() - start_cycles);
+}
+
+//Initializing a green box
+inline std::unique_ptr<Box> Box::makeGreenBox(double initial_weight) {
+	return std::make_unique<Box>(initial_weight);
+}
+
+//Initializing a blue box
+inline std::unique_ptr<Box> Box::makeBlueBox(double initial_weight) {
+	return std::make_unique<Box>(initial_weight, BoxType::BLUE);
+}
+
+//The boxes a game is played with, held by value so they can be reset between games
+class GameBoxes {
+public:
+	GameBoxes() : boxes_(initialBoxes()) {}
+	void reset() { boxes_ = initialBoxes(); }
+
+	//First box with the smallest weight
+	Box& minWeightBox() { return *std::min_element(boxes_.begin(), boxes_.end()); }
+
+	const Box& operator[](size_t index) const { return boxes_[index]; }
+	size_t size() const { return boxes_.size(); }
+
+private:
+	static std::array<Box, 4> initialBoxes() {
+		return { { Box(0.0, BoxType::GREEN), Box(0.1, BoxType::GREEN), Box(0.2, BoxType::BLUE), Box(0.3, BoxType::BLUE) } };
+	}
+
+	std::array<Box, 4> boxes_;
+};
+
+//Bump allocator for the state of games. Memory is handed out from blocks which are kept until the arena is destroyed,
+//rewinding to a mark makes everything allocated after it available again, so a game is allocated by moving a pointer and
+//freed with a single rewind. An arena must not be shared between threads, threadLocal() returns one for every thread.
+class GameArena {
+public:
+	//Position of the arena, allocations after it are freed by rewinding to it
+	struct Mark {
+		size_t block = 0;
+		size_t used = 0;
+	};
+
+	//Rewinds the arena when leaving the scope
+	class Scope {
+	public:
+		explicit Scope(GameArena& arena) : arena_(arena), mark_(arena.mark()) {}
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+		~Scope() { arena_.rewind(mark_); }
+
+	private:
+		GameArena& arena_;
+		Mark mark_;
+	};
+
+	explicit GameArena(size_t block_size = 1 << 16) : block_size_(block_size) {}
+	GameArena(const GameArena&) = delete;
+	GameArena& operator=(const GameArena&) = delete;
+
+	void* allocate(size_t size, size_t alignment);
+	Mark mark() const { return Mark{ current_, used_ }; }
+	void rewind(const Mark& mark) {
+		current_ = mark.block;
+		used_ = mark.used;
+	}
+	void reset() { rewind(Mark()); }
+
+	//Bytes held in blocks, allocated or not
+	size_t getCapacity() const {
+		size_t capacity = 0;
+		for (const Block& block : blocks_) {
+			capacity += block.size;
+		}
+		return capacity;
+	}
+
+	static GameArena& threadLocal() {
+		static thread_local GameArena arena;
+		return arena;
+	}
+
+private:
+	struct Block {
+		std::unique_ptr<unsigned char[]> data;
+		size_t size;
+	};
+
+	std::vector<Block> blocks_;
+	size_t current_ = 0; //block allocated from
+	size_t used_ = 0;    //bytes allocated from the current block
+	size_t block_size_;
+};
+
+//Standard allocator handing out memory of a GameArena, deallocating does nothing as the arena is rewound instead
+template <typename T>
+class ArenaAllocator {
+public:
+	using value_type = T;
+
+	explicit ArenaAllocator(GameArena& arena = GameArena::threadLocal()) noexcept : arena_(&arena) {}
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) noexcept : arena_(other.getArena()) {}
+
+	T* allocate(size_t count) {
+		if (count > std::numeric_limits<size_t>::max() / sizeof(T)) {
+			throw std::bad_alloc();
+		}
+		return static_cast<T*>(arena_->allocate(count * sizeof(T), alignof(T)));
+	}
+	void deallocate(T*, size_t) noexcept {}
+
+	GameArena* getArena() const { return arena_; }
+
+private:
+	GameArena* arena_;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs) { return lhs.getArena() == rhs.getArena(); }
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs) { return !(lhs == rhs); }
+
+//Tournament tree over box weights whose root is the first box with the smallest weight.
+//When a box changes its weight only the matches on the path from its leaf to the root are replayed.
+template <typename Allocator = std::allocator<double>>
+class BasicMinWeightSelector {
+public:
+	explicit BasicMinWeightSelector(const Allocator& allocator = Allocator()) : weights_(allocator), winners_(allocator) {}
+	BasicMinWeightSelector(const double* weights, size_t count, const Allocator& allocator = Allocator())
+		: weights_(allocator), winners_(allocator) {
+		build(weights, count);
+	}
+
+	void build(const double* weights, size_t count);
+	void update(size_t index, double weight);
+
+	//Index of the first box with the smallest weight, the selector must not be empty
+	size_t minIndex() const { return winners_[1]; }
+	double getWeight(size_t index) const { return weights_[index]; }
+	size_t size() const { return box_count_; }
+
+private:
+	//Winner of a match, boxes left of the right one win ties
+	uint32_t playMatch(uint32_t left, uint32_t right) const { return weights_[right] < weights_[left] ? right : left; }
+
+	template <typename T>
+	using Vector = std::vector<T, typename std::allocator_traits<Allocator>::template rebind_alloc<T>>;
+
+	size_t box_count_ = 0;
+	size_t leaf_count_ = 0;      //box count rounded up to a power of two
+	Vector<double> weights_;     //weights of the leaves, unused leaves weigh infinity
+	Vector<uint32_t> winners_;   //winner of every node, node n plays the winners of 2n and 2n + 1, leaves start at leaf_count_
+};
+
+template <typename Allocator>
+inline void BasicMinWeightSelector<Allocator>::build(const double* weights, size_t count) {
+	box_count_ = count;
+	leaf_count_ = 1;
+	while (leaf_count_ < count) {
+		leaf_count_ *= 2;
+	}
+	weights_.assign(leaf_count_, std::numeric_limits<double>::infinity());
+	std::copy(weights, weights + count, weights_.begin());
+	winners_.resize(2 * leaf_count_);
+	for (size_t leaf = 0; leaf < leaf_count_; ++leaf) {
+		winners_[leaf_count_ + leaf] = static_cast<uint32_t>(leaf);
+	}
+	for (size_t node = leaf_count_ - 1; node >= 1; --node) {
+		winners_[node] = playMatch(winners_[2 * node], winners_[2 * node + 1]);
+	}
+}
+
+template <typename Allocator>
+inline void BasicMinWeightSelector<Allocator>::update(size_t index, double weight) {
+	weights_[index] = weight;
+	for (size_t node = (leaf_count_ + index) / 2; node >= 1; node /= 2) {
+		winners_[node] = playMatch(winners_[2 * node], winners_[2 * node + 1]);
+	}
+}
+
+using MinWeightSelector = BasicMinWeightSelector<>;
+
+class Player {
+public:
+	void takeTurn(uint32_t input_weight, std::vector<std::unique_ptr<Box>>& boxes) {
+		ASAPHUS_INSTRUMENT(uint64_t start_cycles = readCycleCounter());
+		//finding the box with the lowest weight
+		auto min_box = std::min_element(boxes.begin(), boxes.end(), [](const auto& a, const auto& b) {
+			return *a < *b;
+			});
+		ASAPHUS_INSTRUMENT(size_t min_index = static_cast<size_t>(min_box - boxes.begin());
+			bool tied = isTiedTurn(boxes.size(), min_index, [&](size_t box) { return boxes[box]->getWeight(); }));
+		(*min_box)->absorbWeight(static_cast<double>(input_weight));
+		score_ += (*min_box)->getScore();
+		ASAPHUS_INSTRUMENT(Instrumentation::threadCounters().recordTurn(min_index, (*min_box)->getScore(), tied, readCycleCounter() - start_cycles));
+	}
+
+	//Same as takeTurn() above, with selector holding the current weights of boxes
+	void takeTurn(uint32_t input_weight, std::vector<std::unique_ptr<Box>>& boxes, MinWeightSelector& selector) {
+		ASAPHUS_INSTRUMENT(uint64_t start_cycles = readCycleCounter());
+		size_t min_index = selector.minIndex();
+		ASAPHUS_INSTRUMENT(bool tied = isTiedTurn(selector.size(), min_index, [&](size_t box) { return selector.getWeight(box); }));
+		Box& min_box = *boxes[min_index];
+		min_box.absorbWeight(static_cast<double>(input_weight));
+		selector.update(min_index, min_box.getWeight());
+		score_ += min_box.getScore();
+		ASAPHUS_INSTRUMENT(Instrumentation::threadCounters().recordTurn(min_index, min_box.getScore(), tied, readCycleCounter() - start_cycles));
+	}
+
+	void takeTurn(uint32_t input_weight, GameBoxes& boxes) {
+		ASAPHUS_INSTRUMENT(uint64_t start_cycles = readCycleCounter());
+		Box& min_box = boxes.minWeightBox();
+		ASAPHUS_INSTRUMENT(size_t min_index = static_cast<size_t>(&min_box - &boxes[0]);
+			bool tied = isTiedTurn(boxes.size(), min_index, [&](size_t box) { return boxes[box].getWeight(); }));
+		min_box.absorbWeight(static_cast<double>(input_weight));
+		score_ += min_box.getScore();
+		ASAPHUS_INSTRUMENT(Instrumentation::threadCounters().recordTurn(min_index, min_box.getScore(), tied, readCycleCounter() - start_cycles));
+	}
+
+	double getScore() const { return score_; }
+
+private:
+	double score_ = 0.0;
+};
+
+//Plays one game with the tokens in [first, last) on boxes that are in their initial state
+inline std::pair<double, double> playGame(const uint32_t* first, const uint32_t* last, GameBoxes& boxes) {
+	Player player_A, player_B;
+
+	//Logic for Players taking turns
+	bool is_player_A_turn = true;
+	for (const uint32_t* token = first; token != last; ++token) {
+		if (is_player_A_turn) {
+			player_A.takeTurn(*token, boxes);
+		}
+		else {
+			player_B.takeTurn(*token, boxes);
+		}
+		is_player_A_turn = !is_player_A_turn;
+	}
+	return std::make_pair(player_A.getScore(), player_B.getScore());
+}
+
+//Complete state of a game in progress: the boxes, both players and whose turn is next.
+//It is trivially copyable and of fixed size, so taking a snapshot after a shared prefix and branching off it is cheap.
+struct GameSnapshot {
+	GameBoxes boxes;
+	Player player_A, player_B;
+	bool is_player_A_turn = true;
+};
+
+//Game that receives its tokens in chunks. Box state and turn order carry over from one chunk to the next,
+//so feeding a sequence in any split gives the scores play() gives for the whole sequence.
+class GameSession {
+public:
+	GameSession() = default;
+	//Continues the game a snapshot was taken of
+	explicit GameSession(const GameSnapshot& snapshot) : state_(snapshot) {}
+
+	void reset() { state_ = GameSnapshot(); }
+
+	void feed(uint32_t token) {
+		(state_.is_player_A_turn ? state_.player_A : state_.player_B).takeTurn(token, state_.boxes);
+		state_.is_player_A_turn = !state_.is_player_A_turn;
+	}
+
+	void feed(const uint32_t* tokens, size_t count) {
+		for (size_t i = 0; i < count; ++i) {
+			feed(tokens[i]);
+		}
+	}
+
+	template <typename InputIterator>
+	void feed(InputIterator first, InputIterator last) {
+		for (; first != last; ++first) {
+			feed(static_cast<uint32_t>(*first));
+		}
+	}
+
+	//Pulls tokens until source, called as bool source(uint32_t& token), returns false
+	template <typename TokenSource>
+	void feedFrom(TokenSource&& source) {
+		uint32_t token;
+		while (source(token)) {
+			feed(token);
+		}
+	}
+
+	std::pair<double, double> getScores() const { return std::make_pair(state_.player_A.getScore(), state_.player_B.getScore()); }
+	bool isPlayerATurn() const { return state_.is_player_A_turn; }
+	const GameBoxes& getBoxes() const { return state_.boxes; }
+	const GameSnapshot& snapshot() const { return state_; }
+
+private:
+	GameSnapshot state_;
+};
+
+//Plays the tokens of an input range without storing them
+template <typename InputIterator>
+std::pair<double, double> play(InputIterator first, InputIterator last) {
+	GameSession session;
+	session.feed(first, last);
+	return session.getScores();
+}
+
+//Final scores of the game a snapshot was taken of, continued with the suffix tokens
+inline std::pair<double, double> resume(const GameSnapshot& snapshot, const uint32_t* suffix, size_t count) {
+	GameSession session(snapshot);
+	session.feed(suffix, count);
+	return session.getScores();
+}
+
+inline std::pair<double, double> resume(const GameSnapshot& snapshot, const std::vector<uint32_t>& suffix) {
+	return resume(snapshot, suffix.data(), suffix.size());
+}
+
+//Packed state of a game of the standard configuration: box weights, the green windows oldest weight first, the blue ranges,
+//both scores and whose turn is next, in 104 bytes without pointers. Tokens are integers, so windows and ranges hold them
+//as uint32. Windows are stored in absorption order instead of as a ring, so equal game states are equal byte for byte and
+//GameState can key hash tables as it is; copying it is a memcpy, so it can be checkpointed as raw bytes.
+struct GameState {
+	double weights[4] = { 0.0, 0.1, 0.2, 0.3 };
+	double scores[2] = { 0.0, 0.0 };
+	uint32_t green_windows[2][3] = { { 0, 0, 0 }, { 0, 0, 0 } };
+	BasicBlueRange<uint32_t> blue_ranges[2];
+	uint8_t green_counts[2] = { 0, 0 };
+	uint8_t is_player_A_turn = 1;
+	uint8_t reserved[5] = { 0, 0, 0, 0, 0 }; //keeps the bytes after the fields defined
+
+	struct Hash {
+		size_t operator()(const GameState& state) const { return static_cast<size_t>(state.hash()); }
+	};
+
+	void reset() { *this = GameState(); }
+
+	//Lets the first box with the smallest weight absorb token, adds its score to the player on turn and returns the score
+	double takeTurn(uint32_t token) {
+		size_t box = 0;
+		for (size_t other = 1; other < 4; ++other) {
+			if (weights[other] < weights[box]) {
+				box = other;
+			}
+		}
+		double score = box < 2 ? absorbGreen(green_windows[box], green_counts[box], token) : absorbBlue(blue_ranges[box - 2], token);
+		weights[box] += static_cast<double>(token);
+		scores[is_player_A_turn ? 0 : 1] += score;
+		is_player_A_turn ^= 1;
+		return score;
+	}
+
+	//Plays the tokens in [first, last) from the current state and returns the scores after them
+	std::pair<double, double> play(const uint32_t* first, const uint32_t* last) {
+		for (const uint32_t* token = first; token != last; ++token) {
+			takeTurn(*token);
+		}
+		return getScores();
+	}
+
+	std::pair<double, double> getScores() const { return std::make_pair(scores[0], scores[1]); }
+
+	uint64_t hash() const {
+		uint64_t words[sizeof(GameState) / sizeof(uint64_t)];
+		std::memcpy(words, this, sizeof(words));
+		uint64_t hash = 0x9E3779B97F4A7C15ull;
+		for (uint64_t word : words) {
+			hash = (hash ^ word) * 0xBF58476D1CE4E5B9ull;
+			hash ^= hash >> 31;
+		}
+		return hash;
+	}
+
+	bool operator==(const GameState& rhs) const { return std::memcmp(this, &rhs, sizeof(GameState)) == 0; }
+	bool operator!=(const GameState& rhs) const { return !(*this == rhs); }
+
+private:
+	//Same sums and rounding as GreenWindow
+	static double absorbGreen(uint32_t (&window)[3], uint8_t& count, uint32_t token) {
+		if (count < 3) {
+			window[count++] = token;
+		}
+		else {
+			window[0] = window[1];
+			window[1] = window[2];
+			window[2] = token;
+		}
+		double sum = 0.0 + static_cast<double>(window[0]);
+		for (uint8_t slot = 1; slot < count; ++slot) {
+			sum += static_cast<double>(window[slot]);
+		}
+		double mean = sum / count;
+		return mean * mean;
+	}
+
+	static double absorbBlue(BasicBlueRange<uint32_t>& range, uint32_t token) {
+		range.absorb(token);
+		double sum = static_cast<double>(range.front) + static_cast<double>(range.back);
+		return ((sum) * (sum + 1)) / 2 + static_cast<double>(range.back);
+	}
+};
+
+static_assert(sizeof(GameState) == 104, "GameState must stay packed");
+static_assert(std::is_trivially_copyable<GameState>::value, "GameState is copied as raw bytes");
+
+//Same scores as playBatch() for the standard configuration, playing every token of a prefix that games share only once.
+//Sorted lexicographically, the games sharing a prefix form a contiguous range whose common prefix is the one of its first
+//and last game. Walking these ranges depth first with a GameState copy at every branch point visits every node of the prefix trie
+//of the games once. Returns the number of tokens played.
+size_t playBatchPrefixShared(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores);
+
+//Receives the scores of played games, in blocks of count games
+class ResultSink {
+public:
+	virtual ~ResultSink() = default;
+	virtual void consume(const std::pair<double, double>* scores, size_t count) = 0;
+	//Hands on everything consumed so far
+	virtual void flush() {}
+};
+
+//Drops all scores
+class NullSink : public ResultSink {
+public:
+	void consume(const std::pair<double, double>*, size_t) override {}
+};
+
+//Collects output in a buffer and writes it to a stream in one call once buffer_size bytes are reached
+class BufferedStreamSink : public ResultSink {
+public:
+	explicit BufferedStreamSink(std::ostream& stream, size_t buffer_size = 1 << 20) : stream_(stream), buffer_size_(buffer_size) {
+		buffer_.reserve(buffer_size_);
+	}
+	~BufferedStreamSink() override { writeBuffer(); }
+
+	void flush() override {
+		writeBuffer();
+		stream_.flush();
+	}
+
+protected:
+	void append(const char* data, size_t size) {
+		buffer_.append(data, size);
+		if (buffer_.size() >= buffer_size_) {
+			writeBuffer();
+		}
+	}
+
+private:
+	void writeBuffer() {
+		stream_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+		buffer_.clear();
+	}
+
+	std::ostream& stream_;
+	size_t buffer_size_;
+	std::string buffer_;
+};
+
+//Writes one "Scores: player A <score>, player B <score>" line per game
+class TextSink : public BufferedStreamSink {
+public:
+	using BufferedStreamSink::BufferedStreamSink;
+
+	void consume(const std::pair<double, double>* scores, size_t count) override {
+		char line[96];
+		for (size_t game = 0; game < count; ++game) {
+			int size = std::snprintf(line, sizeof(line), "Scores: player A %g, player B %g\n", scores[game].first, scores[game].second);
+			append(line, static_cast<size_t>(size));
+		}
+	}
+};
+
+//Writes the scores of player A and B of every game as two doubles in host byte order
+class BinarySink : public BufferedStreamSink {
+public:
+	using BufferedStreamSink::BufferedStreamSink;
+
+	void consume(const std::pair<double, double>* scores, size_t count) override {
+		for (size_t game = 0; game < count; ++game) {
+			double pair[2] = { scores[game].first, scores[game].second };
+			append(reinterpret_cast<const char*>(pair), sizeof(pair));
+		}
+	}
+};
+
+//Passes every block of scores to a user function
+class CallbackSink : public ResultSink {
+public:
+	using Callback = std::function<void(const std::pair<double, double>* scores, size_t count)>;
+	explicit CallbackSink(Callback callback) : callback_(std::move(callback)) {}
+
+	void consume(const std::pair<double, double>* scores, size_t count) override { callback_(scores, count); }
+
+private:
+	Callback callback_;
+};
+
+inline std::pair<double, double> play(const std::vector<uint32_t>& input_weights) {
+	GameBoxes boxes;
+	return playGame(input_weights.data(), input_weights.data() + input_weights.size(), boxes);
+}
+
+//Same as play(), additionally handing the scores to sink
+inline std::pair<double, double> play(const std::vector<uint32_t>& input_weights, ResultSink& sink) {
+	auto scores = play(input_weights);
+	sink.consume(&scores, 1);
+	return scores;
+}
+
+//Green box of a game configuration that is fixed at compile time, InitialWeight is a std::ratio
+template <typename InitialWeight>
+struct StaticGreenBox {
+	static constexpr double initialWeight() { return static_cast<double>(InitialWeight::num) / InitialWeight::den; }
+
+	double absorb(double token) {
+		window.absorb(token);
+		weight += token;
+		return window.score();
+	}
+
+	double weight = initialWeight();
+	GreenWindow window;
+};
+
+//Blue box of a game configuration that is fixed at compile time, InitialWeight is a std::ratio
+template <typename InitialWeight>
+struct StaticBlueBox {
+	static constexpr double initialWeight() { return static_cast<double>(InitialWeight::num) / InitialWeight::den; }
+
+	double absorb(double token) {
+		range.absorb(token);
+		weight += token;
+		return range.score();
+	}
+
+	double weight = initialWeight();
+	BlueRange range;
+};
+
+//Game whose boxes are fixed at compile time and stored inline, so turns need neither pointer chasing nor a runtime box type
+template <typename... Boxes>
+class StaticGame {
+public:
+	static constexpr size_t box_count = sizeof...(Boxes);
+
+	void reset() { boxes_ = std::tuple<Boxes...>(); }
+
+	//Lets the first box with the smallest weight absorb token and returns its score
+	double takeTurn(uint32_t token) {
+#if ASAPHUS_INSTRUMENTATION
+		uint64_t start_cycles = readCycleCounter();
+		size_t box = minWeightIndex();
+		bool tied = isTiedTurn(sizeof...(Boxes), box, [&](size_t other) { return getWeight(other); });
+		double score = absorbAt(box, static_cast<double>(token), std::index_sequence_for<Boxes...>());
+		Instrumentation::threadCounters().recordTurn(box, score, tied, readCycleCounter() - start_cycles);
+		return score;
+#else
+		return absorbAt(minWeightIndex(), static_cast<double>(token), std::index_sequence_for<Boxes...>());
+#endif
+	}
+
+	double getWeight(size_t index) const { return weights(std::index_sequence_for<Boxes...>())[index]; }
+
+	//Plays the tokens in [first, last) from the current state
+	std::pair<double, double> play(const uint32_t* first, const uint32_t* last) {
+		double score_A = 0.0, score_B = 0.0;
+		const uint32_t* token = first;
+		for (; last - token >= 2; token += 2) {
+			score_A += takeTurn(token[0]);
+			score_B += takeTurn(token[1]);
+		}
+		if (token != last) {
+			score_A += takeTurn(*token);
+		}
+		return std::make_pair(score_A, score_B);
+	}
+
+private:
+	template <size_t... I>
+	std::array<double, box_count> weights(std::index_sequence<I...>) const { return { { std::get<I>(boxes_).weight... } }; }
+
+	size_t minWeightIndex() const {
+		auto box_weights = weights(std::index_sequence_for<Boxes...>());
+		size_t min_index = 0;
+		for (size_t i = 1; i < box_count; ++i) {
+			if (box_weights[i] < box_weights[min_index]) {
+				min_index = i;
+			}
+		}
+		return min_index;
+	}
+
+	template <size_t... I>
+	double absorbAt(size_t index, double token, std::index_sequence<I...>) {
+		double score = 0.0;
+		(void)std::initializer_list<int>{ (index == I ? (score = std::get<I>(boxes_).absorb(token), 0) : 0)... };
+		return score;
+	}
+
+	std::tuple<Boxes...> boxes_;
+};
+
+//The game of the rules: two green boxes with initial weights 0.0 and 0.1, two blue boxes with 0.2 and 0.3
+using StandardStaticGame = StaticGame<StaticGreenBox<std::ratio<0>>, StaticGreenBox<std::ratio<1, 10>>,
+	StaticBlueBox<std::ratio<2, 10>>, StaticBlueBox<std::ratio<3, 10>>>;
+
+inline std::pair<double, double> playStatic(const std::vector<uint32_t>& input_weights) {
+	StandardStaticGame game;
+	return game.play(input_weights.data(), input_weights.data() + input_weights.size());
+}
+
+//Box types and initial weights a game is played with
+class GameConfig {
+public:
+	//The configuration of the rules: two green boxes with initial weights 0.0 and 0.1, two blue boxes with 0.2 and 0.3
+	static GameConfig standard() {
+		GameConfig config;
+		config.addGreenBox(0.0).addGreenBox(0.1).addBlueBox(0.2).addBlueBox(0.3);
+		return config;
+	}
+
+	GameConfig& addBox(BoxType type, double initial_weight) {
+		box_types_.push_back(type);
+		initial_weights_.push_back(initial_weight);
+		return *this;
+	}
+	GameConfig& addGreenBox(double initial_weight) { return addBox(BoxType::GREEN, initial_weight); }
+	GameConfig& addBlueBox(double initial_weight) { return addBox(BoxType::BLUE, initial_weight); }
+
+	size_t size() const { return box_types_.size(); }
+	const std::vector<BoxType>& getBoxTypes() const { return box_types_; }
+	const std::vector<double>& getInitialWeights() const { return initial_weights_; }
+	bool isStandard() const { return *this == standard(); }
+
+	bool operator==(const GameConfig& rhs) const { return box_types_ == rhs.box_types_ && initial_weights_ == rhs.initial_weights_; }
+	bool operator!=(const GameConfig& rhs) const { return !(*this == rhs); }
+
+private:
+	std::vector<BoxType> box_types_;
+	std::vector<double> initial_weights_;
+};
+
+//Boxes of a game configuration as struct of arrays: weights in the selector, types, and an index into the green or blue states.
+//Resetting reuses the arrays, so playing many games with one BoxSet allocates only once; with an ArenaAllocator all of
+//them come from a GameArena.
+template <typename Allocator = std::allocator<double>>
+class BasicBoxSet {
+public:
+	explicit BasicBoxSet(const GameConfig& config, const Allocator& allocator = Allocator())
+		: initial_weights_(config.getInitialWeights().begin(), config.getInitialWeights().end(), allocator),
+		box_types_(config.getBoxTypes().begin(), config.getBoxTypes().end(), allocator), state_indices_(config.size(), 0, allocator),
+		green_windows_(allocator), blue_ranges_(allocator), selector_(allocator) {
+		if (config.size() == 0) {
+			throw std::invalid_argument("BoxSet: a game needs at least one box");
+		}
+		size_t green_count = 0, blue_count = 0;
+		for (size_t box = 0; box < box_types_.size(); ++box) {
+			state_indices_[box] = static_cast<uint32_t>(box_types_[box] == BoxType::GREEN ? green_count++ : blue_count++);
+		}
+		green_windows_.resize(green_count);
+		blue_ranges_.resize(blue_count);
+		reset();
+	}
+
+	void reset() {
+		selector_.build(initial_weights_.data(), initial_weights_.size());
+		std::fill(green_windows_.begin(), green_windows_.end(), GreenWindow());
+		std::fill(blue_ranges_.begin(), blue_ranges_.end(), BlueRange());
+	}
+
+	//Lets the first box with the smallest weight absorb token and returns its score
+	double takeTurn(uint32_t token) {
+		ASAPHUS_INSTRUMENT(uint64_t start_cycles = readCycleCounter());
+		size_t box = selector_.minIndex();
+		ASAPHUS_INSTRUMENT(bool tied = isTiedTurn(selector_.size(), box, [&](size_t other) { return selector_.getWeight(other); }));
+		double weight = static_cast<double>(token);
+		double score;
+		if (box_types_[box] == BoxType::GREEN) {
+			GreenWindow& window = green_windows_[state_indices_[box]];
+			window.absorb(weight);
+			score = window.score();
+		}
+		else {
+			BlueRange& range = blue_ranges_[state_indices_[box]];
+			range.absorb(weight);
+			score = range.score();
+		}
+		selector_.update(box, selector_.getWeight(box) + weight);
+		ASAPHUS_INSTRUMENT(Instrumentation::threadCounters().recordTurn(box, score, tied, readCycleCounter() - start_cycles));
+		return score;
+	}
+
+	//Plays the tokens in [first, last) from the current state
+	std::pair<double, double> play(const uint32_t* first, const uint32_t* last) {
+		double score_A = 0.0, score_B = 0.0;
+		bool is_player_A_turn = true;
+		for (const uint32_t* token = first; token != last; ++token) {
+			(is_player_A_turn ? score_A : score_B) += takeTurn(*token);
+			is_player_A_turn = !is_player_A_turn;
+		}
+		return std::make_pair(score_A, score_B);
+	}
+
+	size_t size() const { return box_types_.size(); }
+	double getWeight(size_t box) const { return selector_.getWeight(box); }
+	BoxType getBoxType(size_t box) const { return box_types_[box]; }
+	//Box the next turn lets absorb its token
+	size_t getNextBox() const { return selector_.minIndex(); }
+
+private:
+	template <typename T>
+	using Vector = std::vector<T, typename std::allocator_traits<Allocator>::template rebind_alloc<T>>;
+
+	Vector<double> initial_weights_;
+	Vector<BoxType> box_types_;
+	Vector<uint32_t> state_indices_;
+	Vector<GreenWindow> green_windows_;
+	Vector<BlueRange> blue_ranges_;
+	BasicMinWeightSelector<Allocator> selector_;
+};
+
+using BoxSet = BasicBoxSet<>;
+
+//Box set whose state lives in a GameArena, by default the one of the current thread
+using ArenaBoxSet = BasicBoxSet<ArenaAllocator<double>>;
+
+//Plays one game with the boxes of config, without printing the scores.
+//The boxes are allocated from the arena of the thread, which is rewound afterwards.
+inline std::pair<double, double> play(const std::vector<uint32_t>& input_weights, const GameConfig& config) {
+	GameArena::Scope scope(GameArena::threadLocal());
+	ArenaBoxSet boxes(config);
+	return boxes.play(input_weights.data(), input_weights.data() + input_weights.size());
+}
+
+//Throws if offsets, holding one entry more than there are games, are empty or do not describe games within a buffer of
+//token_count tokens
+void checkBatchOffsets(size_t token_count, const std::vector<uint64_t>& offsets);
+
+//Plays every game of a batch from a reset game_state
+template <typename GameState>
+void playGames(GameState& game_state, const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores) {
+	for (size_t game = 0; game < game_count; ++game) {
+		game_state.reset();
+		scores[game] = game_state.play(tokens + offsets[game], tokens + offsets[game + 1]);
+	}
+}
+
+//Plays game_count independent games, game i uses the tokens in [offsets[i], offsets[i + 1]) and writes its scores to scores[i].
+//The standard configuration is played with StandardStaticGame, any other one with a BoxSet.
+void playBatch(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores,
+	const GameConfig& config = GameConfig::standard());
+
+std::vector<std::pair<double, double>> playBatch(const std::vector<uint32_t>& tokens, const std::vector<uint64_t>& offsets,
+	const GameConfig& config = GameConfig::standard());
+
+//Same as playBatch() above, handing the scores to sink in blocks instead of storing them for all games
+void playBatch(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, ResultSink& sink,
+	const GameConfig& config = GameConfig::standard());
+
+//Count, mean and sum of squared deviations of a stream of values, updated with Welford's method and merged with the
+//pairwise formula of Chan et al., so partial moments of any split of the stream give the moments of the whole stream
+struct RunningMoments {
+	uint64_t count = 0;
+	double mean = 0.0;
+	double squared_deviations = 0.0;
+
+	void add(double value) {
+		++count;
+		double delta = value - mean;
+		mean += delta / static_cast<double>(count);
+		squared_deviations += delta * (value - mean);
+	}
+
+	void merge(const RunningMoments& other) {
+		if (other.count == 0) {
+			return;
+		}
+		uint64_t total = count + other.count;
+		double delta = other.mean - mean;
+		double other_share = static_cast<double>(other.count) / static_cast<double>(total);
+		squared_deviations += other.squared_deviations + delta * delta * static_cast<double>(count) * other_share;
+		mean += delta * other_share;
+		count = total;
+	}
+
+	//Population variance, 0 without values
+	double getVariance() const { return count == 0 ? 0.0 : squared_deviations / static_cast<double>(count); }
+};
+
+//KLL quantile sketch of Karnin, Lang and Liberty. An item on level h stands for 2^h values, and a level holding its capacity
+//is sorted and every other item, starting with a random one of the first two, moves up a level. Capacities shrink by 2/3
+//per level below the top one, so a sketch keeps about 3 * k items however many values it saw, and ranks of its quantiles are
+//off by about count / k. Sketches of the same k merge into a sketch of all of their values.
+class QuantileSketch {
+public:
+	explicit QuantileSketch(uint32_t k = 200, uint64_t seed = 1);
+
+	void add(double value) {
+		count_ += 1;
+		min_ = std::min(min_, value);
+		max_ = std::max(max_, value);
+		levels_[0].push_back(value);
+		if (levels_[0].size() >= getCapacity(0)) {
+			compress();
+		}
+	}
+
+	//Throws if other has another k
+	void merge(const QuantileSketch& other);
+
+	//Value with about fraction * count values below it, the smallest and largest value for fractions 0 and 1, NaN if empty
+	double getQuantile(double fraction) const;
+
+	uint64_t getCount() const { return count_; }
+	uint32_t getK() const { return k_; }
+	double getMin() const { return min_; }
+	double getMax() const { return max_; }
+	size_t getRetainedCount() const;
+
+private:
+	size_t getCapacity(size_t level) const;
+	void compress();
+
+	uint32_t k_;
+	uint64_t random_state_;
+	uint64_t count_ = 0;
+	double min_ = std::numeric_limits<double>::infinity();
+	double max_ = -std::numeric_limits<double>::infinity();
+	std::vector<std::vector<double>> levels_;
+};
+
+//Aggregates of the games of a batch: win and draw counts, moments and quantiles of the score margins, which are the scores
+//of player A minus the ones of player B, and the sum of the scores every box contributed
+struct BatchStatistics {
+	uint64_t games = 0;
+	uint64_t wins_A = 0;
+	uint64_t wins_B = 0;
+	uint64_t draws = 0;
+	RunningMoments margins;
+	QuantileSketch margin_quantiles;
+	std::vector<double> box_contributions;
+
+	explicit BatchStatistics(size_t box_count = 0) : box_contributions(box_count, 0.0) {}
+
+	void add(const std::pair<double, double>& scores) {
+		++games;
+		if (scores.first > scores.second) {
+			++wins_A;
+		}
+		else if (scores.second > scores.first) {
+			++wins_B;
+		}
+		else {
+			++draws;
+		}
+		double margin = scores.first - scores.second;
+		margins.add(margin);
+		margin_quantiles.add(margin);
+	}
+
+	void merge(const BatchStatistics& other);
+};
+
+//Plays one game of turn_count turns on boxes from their initial state, the tokens being returned by next_token(), and adds
+//it to statistics
+template <typename NextToken>
+inline void reduceGame(BoxSet& boxes, uint64_t turn_count, NextToken&& next_token, BatchStatistics& statistics) {
+	boxes.reset();
+	double score_A = 0.0, score_B = 0.0;
+	bool is_player_A_turn = true;
+	for (uint64_t turn = 0; turn < turn_count; ++turn) {
+		size_t box = boxes.getNextBox();
+		double score = boxes.takeTurn(next_token());
+		statistics.box_contributions[box] += score;
+		(is_player_A_turn ? score_A : score_B) += score;
+		is_player_A_turn = !is_player_A_turn;
+	}
+	statistics.add(std::make_pair(score_A, score_B));
+}
+
+//Same as above for the tokens [first, last)
+inline void reduceGame(BoxSet& boxes, const uint32_t* first, const uint32_t* last, BatchStatistics& statistics) {
+	reduceGame(boxes, static_cast<uint64_t>(last - first), [&first]() { return *first++; }, statistics);
+}
+
+//Statistics of the games of a batch, played in one pass over the tokens without storing scores.
+//Games are played with a BoxSet of config, so their scores are those of playBatch().
+BatchStatistics reduceBatch(const uint32_t* tokens, const uint64_t* offsets, size_t game_count,
+	const GameConfig& config = GameConfig::standard());
+
+//Philox4x32-10 of Salmon et al., a counter-based generator: every 128-bit counter maps to four random words under a 64-bit
+//key, so any word of any stream is computed without generating the ones before it
+struct Philox4x32 {
+	static std::array<uint32_t, 4> block(std::array<uint32_t, 4> counter, std::array<uint32_t, 2> key) {
+		for (int round = 0; round < 10; ++round) {
+			uint64_t product_0 = static_cast<uint64_t>(0xD2511F53u) * counter[0];
+			uint64_t product_1 = static_cast<uint64_t>(0xCD9E8D57u) * counter[2];
+			counter = { { static_cast<uint32_t>(product_1 >> 32) ^ counter[1] ^ key[0], static_cast<uint32_t>(product_1),
+				static_cast<uint32_t>(product_0 >> 32) ^ counter[3] ^ key[1], static_cast<uint32_t>(product_0) } };
+			key[0] += 0x9E3779B9u;
+			key[1] += 0xBB67AE85u;
+		}
+		return counter;
+	}
+};
+
+//Distribution of simulated tokens, mapping 32 random bits to a token
+class TokenDistribution {
+public:
+	//Every token in [low, high], the bias of the multiply-shift mapping being below (high - low + 1) / 2^32
+	static TokenDistribution uniform(uint32_t low, uint32_t high);
+	//Exponentially distributed tokens of the given mean, rounded down and clamped to the largest uint32
+	static TokenDistribution exponential(double mean);
+
+	uint32_t map(uint32_t bits) const {
+		if (kind_ == Kind::UNIFORM) {
+			return low_ + static_cast<uint32_t>((static_cast<uint64_t>(bits) * range_) >> 32);
+		}
+		//1 - bits / 2^32 lies in (0, 1], so the logarithm is finite
+		double token = -mean_ * std::log((4294967296.0 - static_cast<double>(bits)) * (1.0 / 4294967296.0));
+		return token < 4294967295.0 ? static_cast<uint32_t>(token) : std::numeric_limits<uint32_t>::max();
+	}
+
+private:
+	enum class Kind { UNIFORM, EXPONENTIAL };
+
+	TokenDistribution(Kind kind, uint32_t low, uint64_t range, double mean) : kind_(kind), low_(low), range_(range), mean_(mean) {}
+
+	Kind kind_;
+	uint32_t low_;
+	uint64_t range_;
+	double mean_;
+};
+
+//Random games of a Monte Carlo simulation. Game g has a length uniform in [min_length, max_length] and tokens of the
+//distribution, all drawn from the Philox stream of key seed and counters (i, g), so every game depends only on the seed and
+//its index and any subset of the games can be replayed on any number of threads
+struct SimulationConfig {
+	uint64_t seed = 0;
+	uint64_t min_length = 0;
+	uint64_t max_length = 1000;
+	TokenDistribution tokens = TokenDistribution::uniform(0, 1000);
+};
+
+//Tokens of one game of a simulation, generated one by one without being stored
+class SimulatedTokens {
+public:
+	//Throws if simulation.min_length > simulation.max_length
+	SimulatedTokens(const SimulationConfig& simulation, uint64_t game);
+
+	uint64_t getLength() const { return length_; }
+
+	//Next token of the game, the tokens continue past its length
+	uint32_t next() {
+		if (word_ == words_.size()) {
+			refill();
+		}
+		return distribution_.map(words_[word_++]);
+	}
+
+	//All tokens of the game, for replaying it with other engines
+	std::vector<uint32_t> materialize();
+
+private:
+	void refill() {
+		++block_;
+		words_ = Philox4x32::block({ { static_cast<uint32_t>(block_), static_cast<uint32_t>(block_ >> 32), game_[0], game_[1] } }, key_);
+		word_ = 0;
+	}
+
+	TokenDistribution distribution_;
+	std::array<uint32_t, 2> key_;
+	std::array<uint32_t, 2> game_;
+	uint64_t block_ = 0; //block 0 holds the length, tokens start at block 1
+	uint64_t length_;
+	std::array<uint32_t, 4> words_;
+	size_t word_ = 4;
+};
+
+//Scores of game `game` of simulation
+std::pair<double, double> simulateGame(const SimulationConfig& simulation, uint64_t game, const GameConfig& config = GameConfig::standard());
+
+//Statistics of the games [first_game, first_game + game_count) of simulation, the same as reduceBatch() of their tokens
+BatchStatistics simulateBatch(const SimulationConfig& simulation, uint64_t first_game, uint64_t game_count,
+	const GameConfig& config = GameConfig::standard());
+
+//128-bit key of the scores of a game, a hash of its tokens and its box configuration
+struct ResultKey {
+	uint64_t low;
+	uint64_t high;
+
+	bool operator==(const ResultKey& rhs) const { return low == rhs.low && high == rhs.high; }
+	bool operator!=(const ResultKey& rhs) const { return !(*this == rhs); }
+};
+
+//Array of default-constructed objects aligned to alignof(T), also when T is over-aligned: before C++17 operator new only
+//guarantees the alignment of std::max_align_t, so the storage is over-allocated and aligned by hand
+template <typename T>
+class AlignedArray {
+public:
+	AlignedArray() = default;
+	AlignedArray(const AlignedArray&) = delete;
+	AlignedArray& operator=(const AlignedArray&) = delete;
+	~AlignedArray() { destroy(); }
+
+	//Replaces the elements by count new ones
+	void reset(size_t count) {
+		destroy();
+		storage_.reset();
+		size_t space = count * sizeof(T) + alignof(T) - 1;
+		storage_.reset(new unsigned char[space]);
+		void* first = storage_.get();
+		elements_ = static_cast<T*>(std::align(alignof(T), count * sizeof(T), first, space));
+		try {
+			for (; size_ < count; ++size_) {
+				new (elements_ + size_) T();
+			}
+		}
+		catch (...) {
+			destroy();
+			throw;
+		}
+	}
+
+	size_t size() const { return size_; }
+	T& operator[](size_t index) { return elements_[index]; }
+	const T& operator[](size_t index) const { return elements_[index]; }
+
+private:
+	void destroy() {
+		while (size_ > 0) {
+			elements_[--size_].~T();
+		}
+	}
+
+	std::unique_ptr<unsigned char[]> storage_;
+	T* elements_ = nullptr;
+	size_t size_ = 0;
+};
+
+//Bounded cache of the scores of games, shared by the threads scoring them. Games are found by their ResultKey, a hash keyed
+//with a random secret of the cache, and every entry keeps a copy of the tokens and the configuration hash of its game: a game
+//whose key collides with a cached one, by chance or crafted by a client of a service, misses instead of getting its scores.
+//The cache is split into shards of their own lock, chosen by the upper half of a key, and every shard evicts with the CLOCK
+//policy: a hit only marks its entry, and an insertion into a full shard sweeps the entries for one that was not hit since
+//the last sweep passed it.
+//Hits and misses are counted by the shards and, when instrumentation is on, in the GameCounters of the calling thread.
+class ResultCache {
+public:
+	struct Statistics {
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+		size_t size = 0;
+	};
+
+	//Holds at least capacity results, the shard count is rounded up to a power of two
+	explicit ResultCache(size_t capacity, size_t shard_count = 16);
+
+	static uint64_t hashConfig(const GameConfig& config);
+	//Keys of one cache, the keys of another cache differ
+	ResultKey hashGame(const uint32_t* first, const uint32_t* last, uint64_t config_hash) const;
+	ResultKey hashGame(const uint32_t* first, const uint32_t* last, const GameConfig& config) const {
+		return hashGame(first, last, hashConfig(config));
+	}
+
+	//Returns false on a miss, also if the entry of key is of another game than the tokens in [first, last) and config_hash
+	bool lookup(const ResultKey& key, const uint32_t* first, const uint32_t* last, uint64_t config_hash, std::pair<double, double>& scores);
+	//Replaces the entry of key, if any
+	void insert(const ResultKey& key, const uint32_t* first, const uint32_t* last, uint64_t config_hash, const std::pair<double, double>& scores);
+
+	//Scores play() gives the tokens in [first, last), from the cache if it has them
+	std::pair<double, double> play(const uint32_t* first, const uint32_t* last, const GameConfig& config = GameConfig::standard());
+	std::pair<double, double> play(const std::vector<uint32_t>& tokens, const GameConfig& config = GameConfig::standard()) {
+		return play(tokens.data(), tokens.data() + tokens.size(), config);
+	}
+
+	//Same as ::playBatch(), the games missing from the cache being gathered into one batch for
+	//play_misses(tokens, offsets, game_count, scores), which must score them as ::playBatch() does for config
+	template <typename PlayBatch>
+	void playBatch(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores,
+		const GameConfig& config, PlayBatch play_misses);
+
+	void playBatch(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores,
+		const GameConfig& config = GameConfig::standard()) {
+		playBatch(tokens, offsets, game_count, scores, config, [&config](const uint32_t* miss_tokens, const uint64_t* miss_offsets,
+			size_t miss_count, std::pair<double, double>* miss_scores) { ::playBatch(miss_tokens, miss_offsets, miss_count, miss_scores, config); });
+	}
+
+	Statistics getStatistics() const;
+	size_t getCapacity() const { return shard_capacity_ * shard_count_; }
+	void clear();
+
+private:
+	struct Entry {
+		ResultKey key;
+		uint64_t config_hash;
+		std::vector<uint32_t> tokens;
+		std::pair<double, double> scores;
+		bool referenced;
+
+		bool isOf(const uint32_t* first, const uint32_t* last, uint64_t game_config_hash) const {
+			return config_hash == game_config_hash && tokens.size() == static_cast<size_t>(last - first) && std::equal(first, last, tokens.begin());
+		}
+	};
+	struct KeyHash {
+		size_t operator()(const ResultKey& key) const { return static_cast<size_t>(key.low); }
+	};
+	struct alignas(64) Shard {
+		mutable std::mutex mutex;
+		std::unordered_map<ResultKey, size_t, KeyHash> index; //entry of every key
+		std::vector<Entry> entries;
+		size_t hand = 0;
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+	};
+
+	Shard& getShard(const ResultKey& key) { return shards_[static_cast<size_t>(key.high) & (shard_count_ - 1)]; }
+
+	size_t shard_count_;
+	size_t shard_capacity_;
+	std::array<uint64_t, 2> hash_key_; //secret seed of the keys
+	AlignedArray<Shard> shards_; //every shard on cache lines of its own
+};
+
+template <typename PlayBatch>
+void ResultCache::playBatch(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores,
+	const GameConfig& config, PlayBatch play_misses) {
+	uint64_t config_hash = hashConfig(config);
+	std::vector<ResultKey> keys;
+	std::vector<size_t> misses;
+	std::vector<uint32_t> miss_tokens;
+	std::vector<uint64_t> miss_offsets{ 0 };
+	for (size_t game = 0; game < game_count; ++game) {
+		const uint32_t* first = tokens + offsets[game];
+		const uint32_t* last = tokens + offsets[game + 1];
+		ResultKey key = hashGame(first, last, config_hash);
+		if (!lookup(key, first, last, config_hash, scores[game])) {
+			keys.push_back(key);
+			misses.push_back(game);
+			miss_tokens.insert(miss_tokens.end(), first, last);
+			miss_offsets.push_back(miss_tokens.size());
+		}
+	}
+	if (misses.empty()) {
+		return;
+	}
+	std::vector<std::pair<double, double>> miss_scores(misses.size());
+	play_misses(miss_tokens.data(), miss_offsets.data(), misses.size(), miss_scores.data());
+	for (size_t miss = 0; miss < misses.size(); ++miss) {
+		scores[misses[miss]] = miss_scores[miss];
+		insert(keys[miss], miss_tokens.data() + miss_offsets[miss], miss_tokens.data() + miss_offsets[miss + 1], config_hash, miss_scores[miss]);
+	}
+}
+
+//Best play when a player may choose any of the boxes tied for the smallest weight instead of the first of them.
+//Both players maximize their own score minus the score of the other player.
+struct TieSearchResult {
+	std::pair<double, double> scores; //scores along one line of best play
+	std::vector<uint32_t> boxes;      //box chosen in every turn of that line
+	uint64_t nodes = 0;               //positions searched
+};
+
+//Negamax alpha-beta search over the tied boxes. Future scores depend only on the box states and the turn, so positions are
+//stored in a transposition table keyed on just these, and the best box a table entry remembers is tried first, then the
+//boxes scoring most. The choices of the first turn with a tie are split across threads, each with its own table. The table
+//of the best choice already holds the positions of the line played after it, so later ties are searched sequentially.
+//With the standard configuration the fractional parts of the initial weights keep the weights apart until they exceed about
+//2^48. From 2^49 on doubles are 0.125 apart, so boxes 0.1 apart can round to the same weight and tie.
+class TieSearch {
+public:
+	explicit TieSearch(const GameConfig& config = GameConfig::standard(), size_t thread_count = 0);
+	TieSearchResult search(const uint32_t* tokens, size_t count) const;
+	TieSearchResult search(const std::vector<uint32_t>& tokens) const { return search(tokens.data(), tokens.size()); }
+
+private:
+	struct SearchBox {
+		double weight;
+		BoxType type;
+		GreenWindow window;
+		BlueRange range;
+
+		double absorb(double token);
+	};
+	using State = std::vector<SearchBox>;
+	//Hash and offset of the words of a position in the key pool of a table. Every position of a configuration takes the
+	//same number of words, so keys are compared without allocating.
+	struct Key {
+		uint64_t hash;
+		size_t offset;
+	};
+	enum class Bound : uint8_t { EXACT, LOWER, UPPER };
+	struct Entry {
+		double value;
+		Bound bound;
+		uint32_t best_box;
+	};
+	struct KeyHash {
+		size_t operator()(const Key& key) const { return static_cast<size_t>(key.hash); }
+	};
+	struct KeyEqual {
+		const std::vector<uint64_t>* words;
+		size_t key_width;
+
+		bool operator()(const Key& lhs, const Key& rhs) const {
+			return lhs.hash == rhs.hash && std::equal(words->begin() + static_cast<std::ptrdiff_t>(lhs.offset),
+				words->begin() + static_cast<std::ptrdiff_t>(lhs.offset + key_width), words->begin() + static_cast<std::ptrdiff_t>(rhs.offset));
+		}
+	};
+	//The keys refer to the pool of their table, so a table stays where it was created
+	struct Table {
+		explicit Table(size_t key_width) : entries(0, KeyHash(), KeyEqual{ &words, key_width }) {}
+		Table(const Table&) = delete;
+		Table& operator=(const Table&) = delete;
+
+		std::vector<uint64_t> words; //of the keys of the entries, followed by the key probed last
+		std::unordered_map<Key, Entry, KeyHash, KeyEqual> entries;
+		uint64_t nodes = 0;
+	};
+	static const uint32_t no_box = std::numeric_limits<uint32_t>::max();
+	static const size_t green_key_width = 5; //weight, window count, three window weights
+	static const size_t blue_key_width = 4;  //weight, count, front and back weight
+
+	//Appends the words of the position to the pool of the table
+	static Key makeKey(Table& table, const State& state, size_t turn);
+	static std::vector<uint32_t> orderMoves(const State& state, uint32_t token, uint32_t first_box);
+	static uint32_t tableMove(Table& table, const State& state, size_t turn);
+	static double negamax(Table& table, const State& state, const uint32_t* tokens, size_t count, size_t turn, double alpha, double beta);
+	static std::pair<uint32_t, double> bestMove(Table& table, const State& state, const uint32_t* tokens, size_t count, size_t turn,
+		const std::vector<uint32_t>& moves, size_t first_move, size_t move_stride);
+
+	State initial_;
+	size_t key_width_; //words of a key
+	size_t thread_count_;
+};
+
+//Integer type exact scores are accumulated in
+#if defined(__SIZEOF_INT128__)
+using ExactInt = unsigned __int128;
+#else
+using ExactInt = uint64_t;
+#endif
+
+//Scores of a game as exact multiples of 1/36, the least common multiple of the green score denominators 1, 4 and 9
+struct ExactScores {
+	static constexpr uint64_t denominator = 36;
+
+	std::pair<double, double> toDouble() const {
+		return std::make_pair(static_cast<double>(numerator_A) / denominator, static_cast<double>(numerator_B) / denominator);
+	}
+
+	ExactInt numerator_A = 0;
+	ExactInt numerator_B = 0;
+	bool overflow = false; //an integer of the game overflowed, the scores are not reliable
+};
+
+//Engine that plays without floating point. A box weight is kept as the integral sum of its absorbed tokens and initial
+//weight, plus the rank of the fractional part of its initial weight among all boxes, which decides between boxes with equal
+//integral sums. Green scores are sum^2 / count^2 and blue scores integral pairings of integral weights, so both are exact
+//in units of 1/36. Selection matches play() while the weights stay small enough for doubles to resolve their fractional offsets.
+class ExactGame {
+public:
+	explicit ExactGame(const GameConfig& config = GameConfig::standard());
+
+	void reset();
+	void takeTurn(uint32_t token);
+
+	//Plays the tokens in [first, last) from the current state
+	const ExactScores& play(const uint32_t* first, const uint32_t* last) {
+		for (const uint32_t* token = first; token != last; ++token) {
+			takeTurn(*token);
+		}
+		return scores_;
+	}
+
+	const ExactScores& getScores() const { return scores_; }
+
+private:
+	//Integral window of a green box with a running sum
+	struct GreenSums {
+		uint32_t weights[3] = { 0, 0, 0 };
+		uint32_t count = 0;
+		uint32_t next = 0;
+		uint64_t sum = 0;
+	};
+
+	static bool addChecked(ExactInt& value, ExactInt addend) {
+		ExactInt result = value + addend;
+		bool overflow = result < value;
+		value = result;
+		return overflow;
+	}
+	//Products of operands below half the bit width cannot overflow, which spares the division for all realistic operands
+	static bool multiplyChecked(ExactInt lhs, ExactInt rhs, ExactInt& product) {
+		product = lhs * rhs;
+		const ExactInt half_width_limit = static_cast<ExactInt>(1) << (sizeof(ExactInt) * 4);
+		if (lhs < half_width_limit && rhs < half_width_limit) {
+			return false;
+		}
+		return lhs != 0 && product / lhs != rhs;
+	}
+
+	uint64_t box_count_;
+	std::vector<uint64_t> initial_keys_;
+	std::vector<uint64_t> keys_; //integral weight * box count + rank of the fractional initial weight
+	std::vector<BoxType> box_types_;
+	std::vector<uint32_t> state_indices_;
+	std::vector<GreenSums> green_sums_;
+	std::vector<BasicBlueRange<uint32_t>> blue_ranges_;
+	ExactScores scores_;
+	bool is_player_A_turn_ = true;
+};
+
+inline void ExactGame::takeTurn(uint32_t token) {
+	size_t box = static_cast<size_t>(std::min_element(keys_.begin(), keys_.end()) - keys_.begin());
+	uint64_t step = static_cast<uint64_t>(token) * box_count_;
+	bool overflow = keys_[box] > std::numeric_limits<uint64_t>::max() - step;
+	keys_[box] += step;
+
+	ExactInt score;
+	if (box_types_[box] == BoxType::GREEN) {
+		GreenSums& green = green_sums_[state_indices_[box]];
+		green.sum += token;
+		if (green.count == 3) {
+			green.sum -= green.weights[green.next];
+		}
+		else {
+			++green.count;
+		}
+		green.weights[green.next] = token;
+		green.next = (green.next == 2) ? 0 : green.next + 1;
+		//36 / count^2 with count 1, 2 or 3
+		const uint32_t scale[4] = { 0, 36, 9, 4 };
+		ExactInt scaled_sum;
+		overflow |= multiplyChecked(green.sum, scale[green.count], scaled_sum);
+		overflow |= multiplyChecked(scaled_sum, green.sum, score);
+	}
+	else {
+		BasicBlueRange<uint32_t>& blue = blue_ranges_[state_indices_[box]];
+		blue.absorb(token);
+		//36 * pairing(front, back) = 18 * sum * (sum + 1) + 36 * back
+		ExactInt sum = static_cast<ExactInt>(blue.front) + blue.back;
+		ExactInt scaled_sum, back_part;
+		overflow |= multiplyChecked(sum * 18, sum + 1, scaled_sum);
+		overflow |= multiplyChecked(blue.back, ExactScores::denominator, back_part);
+		score = scaled_sum;
+		overflow |= addChecked(score, back_part);
+	}
+	overflow |= addChecked(is_player_A_turn_ ? scores_.numerator_A : scores_.numerator_B, score);
+	scores_.overflow = scores_.overflow || overflow;
+	is_player_A_turn_ = !is_player_A_turn_;
+}
+
+//Exact scores of every game of a batch, played as in playBatch()
+void playBatchExact(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, ExactScores* scores,
+	const GameConfig& config = GameConfig::standard());
+
+//Run of count tokens token, token + step, token + 2 * step, ... of a run-length-encoded token sequence
+struct TokenRun {
+	uint32_t token = 0;
+	uint64_t count = 0;
+	int64_t step = 0;
+};
+
+//Run-length encoding of tokens into runs of equal tokens
+std::vector<TokenRun> encodeRuns(const std::vector<uint32_t>& tokens);
+//Same with arithmetic progressions of at least three tokens encoded as runs with a step
+std::vector<TokenRun> encodeProgressions(const std::vector<uint32_t>& tokens);
+
+//Engine that plays run-length-encoded tokens with the scores play() gives for the expanded sequence.
+//Once every box a run of equal tokens keeps visiting has reached the state absorbing the token leaves unchanged, the boxes
+//are visited in one fixed order, each period of turns adds the same amount to the visited weights and the same scores to
+//the players, so whole periods are skipped at once. Periods are only skipped while all of these sums are exact in doubles,
+//so the scores of runs of equal tokens are bit-identical; runs reaching magnitudes where adding one token after the other
+//rounds are played token by token.
+//A run with a step settles into a rotation over the lightest boxes, each of which absorbs every rotation a token larger by
+//the step times the rotation length: green boxes then score the square of their previous token, blue ones pair a fixed end
+//with the new token. Rotations are skipped while the weights keep the boxes apart by a margin and stay below 2^51. A
+//falling run draws the weights of the boxes together until they change places, so only its first rotations are skipped
+//and the rest is played token by token, a rising run drives them apart and is skipped but for a few rotations. The
+//weights are advanced as adding one token after the other rounds them, bit for bit, so the boxes are visited as play()
+//visits them, and the scores of the skipped turns are summed in closed form. Where play() rounds each of its n turns, the
+//scores of a game with arithmetic runs therefore differ from it by a relative error of at most maxRelativeError(n).
+class RunLengthGame {
+public:
+	explicit RunLengthGame(const GameConfig& config = GameConfig::standard());
+
+	//Bound of the relative difference to play() of the scores of a game of turn_count turns with arithmetic runs
+	static double maxRelativeError(uint64_t turn_count) { return std::ldexp(static_cast<double>(turn_count) + 32.0, -53); }
+
+	void reset();
+	void playRun(const TokenRun& run);
+
+	//Plays the runs in [first, last) from the current state
+	std::pair<double, double> play(const TokenRun* first, const TokenRun* last) {
+		for (const TokenRun* run = first; run != last; ++run) {
+			playRun(*run);
+		}
+		return getScores();
+	}
+
+	std::pair<double, double> getScores() const { return std::make_pair(score_A_, score_B_); }
+	//Number of turns that were skipped instead of played since the last reset
+	uint64_t getSkippedTurns() const { return skipped_turns_; }
+
+private:
+	//Lets the first box with the smallest weight absorb weight and adds its score to the player whose turn it is
+	void takeTurn(double weight);
+	//Skips whole periods of at most turn_count turns of a run of weight and returns the number of turns skipped
+	uint64_t skipPeriods(double weight, uint64_t turn_count);
+	//Skips whole rotations of at most turn_count turns of a run token, token + step, ... and returns the number of turns skipped
+	uint64_t skipRotations(int64_t token, int64_t step, uint64_t turn_count);
+	//Whether absorbing weight leaves the state and the score of box unchanged
+	bool isSteady(size_t box, double weight) const;
+	double getScore(size_t box) const;
+
+	std::vector<double> initial_weights_;
+	std::vector<BoxType> box_types_;
+	std::vector<double> weights_;
+	std::vector<GreenWindow> green_windows_; //of every box, only used by green ones
+	std::vector<BlueRange> blue_ranges_;     //of every box, only used by blue ones
+	double score_A_ = 0.0;
+	double score_B_ = 0.0;
+	bool is_player_A_turn_ = true;
+	uint64_t skipped_turns_ = 0;
+};
+
+inline std::pair<double, double> playRuns(const std::vector<TokenRun>& runs, const GameConfig& config = GameConfig::standard()) {
+	RunLengthGame game(config);
+	return game.play(runs.data(), runs.data() + runs.size());
+}
+
+//Final weights of the boxes of config after a game with the tokens in [first, last). Which box absorbs a token depends on
+//the weights alone, so no box state is kept and no turn is scored.
+inline std::vector<double> playWeights(const uint32_t* first, const uint32_t* last, const GameConfig& config = GameConfig::standard()) {
+	if (config.size() == 0) {
+		throw std::invalid_argument("playWeights: a game needs at least one box");
+	}
+	MinWeightSelector selector(config.getInitialWeights().data(), config.size());
+	for (const uint32_t* token = first; token != last; ++token) {
+		size_t box = selector.minIndex();
+		selector.update(box, selector.getWeight(box) + static_cast<double>(*token));
+	}
+	std::vector<double> weights(config.size());
+	for (size_t box = 0; box < weights.size(); ++box) {
+		weights[box] = selector.getWeight(box);
+	}
+	return weights;
+}
+
+inline std::vector<double> playWeights(const std::vector<uint32_t>& tokens, const GameConfig& config = GameConfig::standard()) {
+	return playWeights(tokens.data(), tokens.data() + tokens.size(), config);
+}
+
+//Score of a player as aggregates that are cheaper to accumulate than the scores of the turns: squared green window sums by
+//the number of weights in the window, and blue pairings before halving next to the sum of largest weights
+struct DeferredScores {
+	double green_squares[3] = { 0.0, 0.0, 0.0 };
+	double blue_pairings = 0.0;
+	double blue_backs = 0.0;
+
+	double materialize() const {
+		return green_squares[0] + green_squares[1] / 4 + green_squares[2] / 9 + blue_pairings / 2 + blue_backs;
+	}
+};
+
+enum class Winner { PLAYER_A, PLAYER_B, NONE };
+
+//Engine for queries that need the final weights or the winner rather than the scores of play() to the last bit. A turn
+//selects the box, updates its weight and window or range and adds to the aggregates of the player, the divisions of the
+//scores are left to getScores(). The turns are grouped differently, so the scores differ from the ones of play() by
+//rounding, for non-negative initial weights at most about 2 * turns * 2^-53 relative to them, and winners by a smaller
+//margin may differ from the ones play() gives.
+class DeferredScoreGame {
+public:
+	explicit DeferredScoreGame(const GameConfig& config = GameConfig::standard());
+
+	void reset();
+	void takeTurn(uint32_t token);
+
+	//Plays the tokens in [first, last) from the current state
+	void play(const uint32_t* first, const uint32_t* last) {
+		for (const uint32_t* token = first; token != last; ++token) {
+			takeTurn(*token);
+		}
+	}
+
+	std::pair<double, double> getScores() const { return std::make_pair(scores_[0].materialize(), scores_[1].materialize()); }
+	const DeferredScores& getDeferredScores(bool player_A) const { return scores_[player_A ? 0 : 1]; }
+	Winner getWinner() const;
+	double getWeight(size_t box) const { return selector_.getWeight(box); }
+	size_t size() const { return box_types_.size(); }
+
+private:
+	std::vector<double> initial_weights_;
+	std::vector<BoxType> box_types_;
+	std::vector<uint32_t> state_indices_;
+	std::vector<GreenWindow> green_windows_;
+	std::vector<BlueRange> blue_ranges_;
+	MinWeightSelector selector_;
+	DeferredScores scores_[2]; //of player A and B
+	bool is_player_A_turn_ = true;
+};
+
+inline void DeferredScoreGame::takeTurn(uint32_t token) {
+	size_t box = selector_.minIndex();
+	double weight = static_cast<double>(token);
+	DeferredScores& scores = scores_[is_player_A_turn_ ? 0 : 1];
+	if (box_types_[box] == BoxType::GREEN) {
+		GreenWindow& window = green_windows_[state_indices_[box]];
+		window.absorb(weight);
+		double sum = window.sum();
+		scores.green_squares[window.count - 1] += sum * sum;
+	}
+	else {
+		BlueRange& range = blue_ranges_[state_indices_[box]];
+		range.absorb(weight);
+		double sum = range.front + range.back;
+		scores.blue_pairings += sum * (sum + 1);
+		scores.blue_backs += range.back;
+	}
+	selector_.update(box, selector_.getWeight(box) + weight);
+	is_player_A_turn_ = !is_player_A_turn_;
+}
+
+//Winner of a game as a DeferredScoreGame scores it
+inline Winner playWinner(const std::vector<uint32_t>& tokens, const GameConfig& config = GameConfig::standard()) {
+	DeferredScoreGame game(config);
+	game.play(tokens.data(), tokens.data() + tokens.size());
+	return game.getWinner();
+}
+
+//Vector operations the lane-parallel engine is written in, one game per lane: plain doubles as the scalar fallback,
+//and AVX2 or AVX-512 registers when the engine is compiled for them
+struct ScalarLanes {
+	using Vec = double;
+	using Mask = bool;
+	static constexpr size_t width = 1;
+
+	static Vec load(const double* values) { return *values; }
+	static void store(double* values, Vec vec) { *values = vec; }
+	static Vec broadcast(double value) { return value; }
+	static Vec add(Vec lhs, Vec rhs) { return lhs + rhs; }
+	static Vec multiply(Vec lhs, Vec rhs) { return lhs * rhs; }
+	static Vec divide(Vec lhs, Vec rhs) { return lhs / rhs; }
+	static Mask less(Vec lhs, Vec rhs) { return lhs < rhs; }
+	static Mask equal(Vec lhs, Vec rhs) { return lhs == rhs; }
+	static Mask both(Mask lhs, Mask rhs) { return lhs && rhs; }
+	static Mask either(Mask lhs, Mask rhs) { return lhs || rhs; }
+	static Mask negate(Mask mask) { return !mask; }
+	static Vec select(Mask mask, Vec if_set, Vec if_clear) { return mask ? if_set : if_clear; }
+};
+
+#if defined(__AVX2__)
+struct Avx2Lanes {
+	using Vec = __m256d;
+	using Mask = __m256d;
+	static constexpr size_t width = 4;
+
+	static Vec load(const double* values) { return _mm256_loadu_pd(values); }
+	static void store(double* values, Vec vec) { _mm256_storeu_pd(values, vec); }
+	static Vec broadcast(double value) { return _mm256_set1_pd(value); }
+	static Vec add(Vec lhs, Vec rhs) { return _mm256_add_pd(lhs, rhs); }
+	static Vec multiply(Vec lhs, Vec rhs) { return _mm256_mul_pd(lhs, rhs); }
+	static Vec divide(Vec lhs, Vec rhs) { return _mm256_div_pd(lhs, rhs); }
+	static Mask less(Vec lhs, Vec rhs) { return _mm256_cmp_pd(lhs, rhs, _CMP_LT_OQ); }
+	static Mask equal(Vec lhs, Vec rhs) { return _mm256_cmp_pd(lhs, rhs, _CMP_EQ_OQ); }
+	static Mask both(Mask lhs, Mask rhs) { return _mm256_and_pd(lhs, rhs); }
+	static Mask either(Mask lhs, Mask rhs) { return _mm256_or_pd(lhs, rhs); }
+	static Mask negate(Mask mask) { return _mm256_xor_pd(mask, _mm256_castsi256_pd(_mm256_set1_epi64x(-1))); }
+	static Vec select(Mask mask, Vec if_set, Vec if_clear) { return _mm256_blendv_pd(if_clear, if_set, mask); }
+};
+#endif
+
+#if defined(__AVX512F__)
+struct Avx512Lanes {
+	using Vec = __m512d;
+	using Mask = __mmask8;
+	static constexpr size_t width = 8;
+
+	static Vec load(const double* values) { return _mm512_loadu_pd(values); }
+	static void store(double* values, Vec vec) { _mm512_storeu_pd(values, vec); }
+	static Vec broadcast(double value) { return _mm512_set1_pd(value); }
+	static Vec add(Vec lhs, Vec rhs) { return _mm512_add_pd(lhs, rhs); }
+	static Vec multiply(Vec lhs, Vec rhs) { return _mm512_mul_pd(lhs, rhs); }
+	static Vec divide(Vec lhs, Vec rhs) { return _mm512_div_pd(lhs, rhs); }
+	static Mask less(Vec lhs, Vec rhs) { return _mm512_cmp_pd_mask(lhs, rhs, _CMP_LT_OQ); }
+	static Mask equal(Vec lhs, Vec rhs) { return _mm512_cmp_pd_mask(lhs, rhs, _CMP_EQ_OQ); }
+	static Mask both(Mask lhs, Mask rhs) { return static_cast<Mask>(lhs & rhs); }
+	static Mask either(Mask lhs, Mask rhs) { return static_cast<Mask>(lhs | rhs); }
+	static Mask negate(Mask mask) { return static_cast<Mask>(~mask); }
+	static Vec select(Mask mask, Vec if_set, Vec if_clear) { return _mm512_mask_blend_pd(mask, if_clear, if_set); }
+};
+#endif
+
+//Plays Simd::width games of the standard configuration at once, one game per lane, with the operations of GreenWindow,
+//BlueRange and Player::takeTurn written as lane-wise selects instead of branches. Lanes whose game has ended are refilled
+//with the next game of the batch, lanes without a next game are masked out until the batch is done.
+template <typename Simd>
+class LaneBatchEngine {
+public:
+	static constexpr size_t lane_count = Simd::width;
+
+	void playBatch(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores);
+
+private:
+	//Lane fields by box, counters and flags are doubles as well so that every field fills one register
+	struct LaneState {
+		double weights[4][lane_count];
+		double green_slots[2][3][lane_count];
+		double green_count[2][lane_count];
+		double green_next[2][lane_count];
+		double blue_front[2][lane_count];
+		double blue_back[2][lane_count];
+		double blue_count[2][lane_count];
+		double score_A[lane_count];
+		double score_B[lane_count];
+		double is_player_A_turn[lane_count];
+	};
+
+	void resetLane(size_t lane);
+	void playTurns(uint64_t turn_count);
+
+	LaneState state_;
+	const uint32_t* next_token_[lane_count];
+	size_t token_stride_[lane_count]; //0 for masked out lanes, which keep reading a zero token
+	uint64_t remaining_turns_[lane_count];
+};
+
+template <typename Simd>
+void LaneBatchEngine<Simd>::resetLane(size_t lane) {
+	const double initial_weights[4] = { 0.0, 0.1, 0.2, 0.3 };
+	for (size_t box = 0; box < 4; ++box) {
+		state_.weights[box][lane] = initial_weights[box];
+	}
+	for (size_t box = 0; box < 2; ++box) {
+		for (size_t slot = 0; slot < 3; ++slot) {
+			state_.green_slots[box][slot][lane] = 0.0;
+		}
+		state_.green_count[box][lane] = 0.0;
+		state_.green_next[box][lane] = 0.0;
+		state_.blue_front[box][lane] = 0.0;
+		state_.blue_back[box][lane] = 0.0;
+		state_.blue_count[box][lane] = 0.0;
+	}
+	state_.score_A[lane] = 0.0;
+	state_.score_B[lane] = 0.0;
+	state_.is_player_A_turn[lane] = 1.0;
+}
+
+template <typename Simd>
+void LaneBatchEngine<Simd>::playTurns(uint64_t turn_count) {
+	using Vec = typename Simd::Vec;
+	using Mask = typename Simd::Mask;
+	LaneState& s = state_;
+	const Vec zero = Simd::broadcast(0.0), one = Simd::broadcast(1.0), two = Simd::broadcast(2.0);
+	const Vec three = Simd::broadcast(3.0), four = Simd::broadcast(4.0);
+	const Vec slot_index[3] = { zero, one, two };
+
+	Vec weights[4], green_slots[2][3], green_count[2], green_next[2], blue_front[2], blue_back[2], blue_count[2];
+	for (size_t box = 0; box < 4; ++box) {
+		weights[box] = Simd::load(s.weights[box]);
+	}
+	for (size_t box = 0; box < 2; ++box) {
+		for (size_t slot = 0; slot < 3; ++slot) {
+			green_slots[box][slot] = Simd::load(s.green_slots[box][slot]);
+		}
+		green_count[box] = Simd::load(s.green_count[box]);
+		green_next[box] = Simd::load(s.green_next[box]);
+		blue_front[box] = Simd::load(s.blue_front[box]);
+		blue_back[box] = Simd::load(s.blue_back[box]);
+		blue_count[box] = Simd::load(s.blue_count[box]);
+	}
+	Vec score_A = Simd::load(s.score_A), score_B = Simd::load(s.score_B), is_player_A_turn = Simd::load(s.is_player_A_turn);
+
+	for (uint64_t turn = 0; turn < turn_count; ++turn) {
+		double token_weights[lane_count];
+		for (size_t lane = 0; lane < lane_count; ++lane) {
+			token_weights[lane] = static_cast<double>(*next_token_[lane]);
+			next_token_[lane] += token_stride_[lane];
+		}
+		Vec token = Simd::load(token_weights);
+
+		//first box with the smallest weight, the later boxes only win with a strictly smaller weight
+		Vec min_weight = weights[0];
+		Mask smaller[4];
+		for (size_t box = 1; box < 4; ++box) {
+			smaller[box] = Simd::less(weights[box], min_weight);
+			min_weight = Simd::select(smaller[box], weights[box], min_weight);
+		}
+		Mask absorbs[4];
+		absorbs[3] = smaller[3];
+		absorbs[2] = Simd::both(smaller[2], Simd::negate(smaller[3]));
+		absorbs[1] = Simd::both(smaller[1], Simd::negate(Simd::either(smaller[2], smaller[3])));
+		absorbs[0] = Simd::negate(Simd::either(smaller[1], Simd::either(smaller[2], smaller[3])));
+		for (size_t box = 0; box < 4; ++box) {
+			weights[box] = Simd::add(weights[box], Simd::select(absorbs[box], token, zero));
+		}
+
+		for (size_t box = 0; box < 2; ++box) {
+			for (size_t slot = 0; slot < 3; ++slot) {
+				Mask written = Simd::both(absorbs[box], Simd::equal(green_next[box], slot_index[slot]));
+				green_slots[box][slot] = Simd::select(written, token, green_slots[box][slot]);
+			}
+			Vec next = Simd::select(Simd::equal(green_next[box], two), zero, Simd::add(green_next[box], one));
+			green_next[box] = Simd::select(absorbs[box], next, green_next[box]);
+			Mask counts = Simd::both(absorbs[box], Simd::less(green_count[box], three));
+			green_count[box] = Simd::select(counts, Simd::add(green_count[box], one), green_count[box]);
+		}
+
+		for (size_t box = 0; box < 2; ++box) {
+			Mask blue_absorbs = absorbs[box + 2];
+			Vec front = blue_front[box], back = blue_back[box], count = blue_count[box];
+			Mask first = Simd::equal(count, zero), smallest = Simd::less(token, front), largest = Simd::less(back, token);
+			Mask middle = Simd::negate(Simd::either(smallest, largest));
+			Mask new_front = Simd::either(Simd::either(first, smallest), Simd::both(middle, Simd::equal(count, three)));
+			Mask new_back = Simd::either(Simd::either(first, Simd::both(Simd::negate(smallest), largest)), Simd::both(middle, Simd::equal(count, two)));
+			blue_front[box] = Simd::select(Simd::both(blue_absorbs, new_front), token, front);
+			blue_back[box] = Simd::select(Simd::both(blue_absorbs, new_back), token, back);
+			Mask counts = Simd::both(blue_absorbs, Simd::less(count, four));
+			blue_count[box] = Simd::select(counts, Simd::add(count, one), count);
+		}
+
+		//score of the absorbing green box, summing its window in absorption order
+		Vec slots[3];
+		for (size_t slot = 0; slot < 3; ++slot) {
+			slots[slot] = Simd::select(absorbs[1], green_slots[1][slot], green_slots[0][slot]);
+		}
+		Vec count = Simd::select(absorbs[1], green_count[1], green_count[0]);
+		Vec oldest = Simd::select(Simd::less(count, three), zero, Simd::select(absorbs[1], green_next[1], green_next[0]));
+		Mask oldest_zero = Simd::equal(oldest, zero), oldest_one = Simd::equal(oldest, one);
+		Vec first_weight = Simd::select(oldest_zero, slots[0], Simd::select(oldest_one, slots[1], slots[2]));
+		Vec second_weight = Simd::select(oldest_zero, slots[1], Simd::select(oldest_one, slots[2], slots[0]));
+		Vec third_weight = Simd::select(oldest_zero, slots[2], Simd::select(oldest_one, slots[0], slots[1]));
+		Vec sum = Simd::add(zero, first_weight);
+		sum = Simd::select(Simd::less(count, two), sum, Simd::add(sum, second_weight));
+		sum = Simd::select(Simd::less(count, three), sum, Simd::add(sum, third_weight));
+		Vec mean = Simd::divide(sum, Simd::select(Simd::equal(count, zero), one, count));
+		Vec green_score = Simd::multiply(mean, mean);
+
+		//score of the absorbing blue box
+		Vec front = Simd::select(absorbs[3], blue_front[1], blue_front[0]);
+		Vec back = Simd::select(absorbs[3], blue_back[1], blue_back[0]);
+		Vec pair_sum = Simd::add(front, back);
+		Vec blue_score = Simd::add(Simd::divide(Simd::multiply(pair_sum, Simd::add(pair_sum, one)), two), back);
+
+		Vec score = Simd::select(Simd::either(absorbs[0], absorbs[1]), green_score, blue_score);
+		Mask player_A = Simd::equal(is_player_A_turn, one);
+		score_A = Simd::add(score_A, Simd::select(player_A, score, zero));
+		score_B = Simd::add(score_B, Simd::select(player_A, zero, score));
+		is_player_A_turn = Simd::select(player_A, zero, one);
+	}
+
+	for (size_t box = 0; box < 4; ++box) {
+		Simd::store(s.weights[box], weights[box]);
+	}
+	for (size_t box = 0; box < 2; ++box) {
+		for (size_t slot = 0; slot < 3; ++slot) {
+			Simd::store(s.green_slots[box][slot], green_slots[box][slot]);
+		}
+		Simd::store(s.green_count[box], green_count[box]);
+		Simd::store(s.green_next[box], green_next[box]);
+		Simd::store(s.blue_front[box], blue_front[box]);
+		Simd::store(s.blue_back[box], blue_back[box]);
+		Simd::store(s.blue_count[box], blue_count[box]);
+	}
+	Simd::store(s.score_A, score_A);
+	Simd::store(s.score_B, score_B);
+	Simd::store(s.is_player_A_turn, is_player_A_turn);
+}
+
+template <typename Simd>
+void LaneBatchEngine<Simd>::playBatch(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores) {
+	static const uint32_t zero_token = 0;
+	size_t lane_games[lane_count];
+	size_t next_game = 0;
+	bool any_active = false;
+
+	//games without tokens are finished right away
+	auto assignNextGame = [&](size_t lane) {
+		while (next_game < game_count && offsets[next_game] == offsets[next_game + 1]) {
+			scores[next_game++] = std::make_pair(0.0, 0.0);
+		}
+		resetLane(lane);
+		if (next_game < game_count) {
+			lane_games[lane] = next_game;
+			next_token_[lane] = tokens + offsets[next_game];
+			token_stride_[lane] = 1;
+			remaining_turns_[lane] = offsets[next_game + 1] - offsets[next_game];
+			++next_game;
+		}
+		else {
+			next_token_[lane] = &zero_token;
+			token_stride_[lane] = 0;
+			remaining_turns_[lane] = std::numeric_limits<uint64_t>::max();
+		}
+	};
+	for (size_t lane = 0; lane < lane_count; ++lane) {
+		assignNextGame(lane);
+		any_active = any_active || token_stride_[lane] != 0;
+	}
+
+	while (any_active) {
+		uint64_t turn_count = std::numeric_limits<uint64_t>::max();
+		for (size_t lane = 0; lane < lane_count; ++lane) {
+			turn_count = std::min(turn_count, remaining_turns_[lane]);
+		}
+		playTurns(turn_count);
+
+		any_active = false;
+		for (size_t lane = 0; lane < lane_count; ++lane) {
+			if (token_stride_[lane] == 0) {
+				continue;
+			}
+			remaining_turns_[lane] -= turn_count;
+			if (remaining_turns_[lane] == 0) {
+				scores[lane_games[lane]] = std::make_pair(state_.score_A[lane], state_.score_B[lane]);
+				assignNextGame(lane);
+			}
+			any_active = any_active || token_stride_[lane] != 0;
+		}
+	}
+}
+
+//Widest lane operations the engine is compiled for
+#if defined(__AVX512F__)
+using DefaultLanes = Avx512Lanes;
+#elif defined(__AVX2__)
+using DefaultLanes = Avx2Lanes;
+#else
+using DefaultLanes = ScalarLanes;
+#endif
+
+//Lane-parallel kernels of the library. Besides the kernel of the library's own target, the library carries AVX2 and AVX-512
+//kernels compiled in translation units of their own, so one binary runs the widest kernel the CPU supports.
+enum class LaneKernel { SCALAR, AVX2, AVX512 };
+
+const char* laneKernelName(LaneKernel kernel);
+
+//Whether the library contains kernel and the CPU runs it
+bool isLaneKernelSupported(LaneKernel kernel);
+
+//Widest supported kernel, or the one the environment variable ASAPHUS_LANE_KERNEL names (scalar, avx2 or avx512) if it is
+//supported. Chosen on the first call, later calls return the same kernel.
+LaneKernel selectLaneKernel();
+
+//Same as playBatch() for the standard configuration, playing with the kernel of selectLaneKernel()
+void playBatchLanes(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores);
+
+//Same as above with the given kernel, throws if it is not supported
+void playBatchLanes(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores, LaneKernel kernel);
+
+//Devices batches are played on. The CUDA backend is part of the library if it is configured with -DASAPHUS_ENABLE_CUDA=ON.
+enum class BatchBackend { CPU, CUDA };
+
+const char* batchBackendName(BatchBackend backend);
+
+//Whether the library contains backend and a device to run it is present
+bool isBatchBackendAvailable(BatchBackend backend);
+
+//CUDA if it is available, or the backend the environment variable ASAPHUS_BATCH_BACKEND names (cpu or cuda) if it is.
+//Chosen on the first call, later calls return the same backend.
+BatchBackend selectBatchBackend();
+
+//Same as playBatch(), played on backend. The CUDA backend plays the standard configuration only, one game per
+//thread. Throws if backend is not available or cannot play config.
+void playBatch(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores,
+	BatchBackend backend, const GameConfig& config = GameConfig::standard());
+
+//Plays independent games on a fixed number of threads.
+//Every thread starts on its own contiguous range of games and, once that is used up, steals the upper half of the remaining range of another thread.
+class ParallelBatchRunner {
+public:
+	//A thread count of 0 uses one thread per hardware thread
+	explicit ParallelBatchRunner(unsigned thread_count = 0)
+		: thread_count_(thread_count != 0 ? thread_count : std::max(1u, std::thread::hardware_concurrency())) {}
+
+	unsigned getThreadCount() const { return thread_count_; }
+
+	//Calls game_function(state, game) for every game in [0, game_count), state being a copy of prototype owned by the calling thread
+	template <typename WorkerState, typename GameFunction>
+	void forEachGame(size_t game_count, const WorkerState& prototype, GameFunction game_function) const {
+		forEachGame(game_count, prototype, game_function, [](WorkerState&) {});
+	}
+
+	//Same as above, calling finish_function(state) on every thread once no games are left
+	template <typename WorkerState, typename GameFunction, typename FinishFunction>
+	void forEachGame(size_t game_count, const WorkerState& prototype, GameFunction game_function, FinishFunction finish_function) const;
+
+	void playBatch(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores,
+		const GameConfig& config = GameConfig::standard()) const {
+		if (config.isStandard()) {
+			playBatchWith(StandardStaticGame(), tokens, offsets, game_count, scores);
+		}
+		else {
+			playBatchWith(BoxSet(config), tokens, offsets, game_count, scores);
+		}
+	}
+
+	std::vector<std::pair<double, double>> playBatch(const std::vector<uint32_t>& tokens, const std::vector<uint64_t>& offsets,
+		const GameConfig& config = GameConfig::standard()) const {
+		if (offsets.empty()) {
+			return {};
+		}
+		checkBatchOffsets(tokens.size(), offsets);
+		std::vector<std::pair<double, double>> scores(offsets.size() - 1);
+		playBatch(tokens.data(), offsets.data(), scores.size(), scores.data(), config);
+		return scores;
+	}
+
+	//Same as playBatch() for the standard configuration, every thread playing blocks of games with the kernel of selectLaneKernel()
+	void playBatchLanes(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores) const {
+		const size_t block_size = 256;
+		size_t block_count = (game_count + block_size - 1) / block_size;
+		LaneKernel kernel = selectLaneKernel();
+		forEachGame(block_count, kernel, [&](LaneKernel worker_kernel, size_t block) {
+			size_t first = block * block_size;
+			::playBatchLanes(tokens, offsets + first, std::min(block_size, game_count - first), scores + first, worker_kernel);
+			});
+	}
+
+	//Same as ::reduceBatch(), every thread reducing into statistics of its own which are merged once it runs out of games
+	BatchStatistics reduceBatch(const uint32_t* tokens, const uint64_t* offsets, size_t game_count,
+		const GameConfig& config = GameConfig::standard()) const {
+		BatchStatistics total(config.size());
+		std::mutex total_mutex;
+		forEachGame(game_count, Reduction{ BoxSet(config), BatchStatistics(config.size()) },
+			[&](Reduction& reduction, size_t game) { reduceGame(reduction.boxes, tokens + offsets[game], tokens + offsets[game + 1], reduction.statistics); },
+			[&](Reduction& reduction) {
+				std::lock_guard<std::mutex> lock(total_mutex);
+				total.merge(reduction.statistics);
+			});
+		return total;
+	}
+
+	//Same as ::simulateBatch(), every thread reducing into statistics of its own
+	BatchStatistics simulateBatch(const SimulationConfig& simulation, uint64_t first_game, uint64_t game_count,
+		const GameConfig& config = GameConfig::standard()) const {
+		BatchStatistics total(config.size());
+		std::mutex total_mutex;
+		forEachGame(static_cast<size_t>(game_count), Reduction{ BoxSet(config), BatchStatistics(config.size()) },
+			[&](Reduction& reduction, size_t game) {
+				SimulatedTokens tokens(simulation, first_game + game);
+				reduceGame(reduction.boxes, tokens.getLength(), [&tokens]() { return tokens.next(); }, reduction.statistics);
+			},
+			[&](Reduction& reduction) {
+				std::lock_guard<std::mutex> lock(total_mutex);
+				total.merge(reduction.statistics);
+			});
+		return total;
+	}
+
+	//Hands the scores to sink in blocks, every block being played by all threads
+	void playBatch(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, ResultSink& sink,
+		const GameConfig& config = GameConfig::standard()) const {
+		const size_t block_size = 65536;
+		std::vector<std::pair<double, double>> scores(std::min(game_count, block_size));
+		for (size_t first = 0; first < game_count; first += block_size) {
+			size_t count = std::min(block_size, game_count - first);
+			playBatch(tokens, offsets + first, count, scores.data(), config);
+			sink.consume(scores.data(), count);
+		}
+	}
+
+private:
+	//State of a thread reducing games into statistics
+	struct Reduction {
+		BoxSet boxes;
+		BatchStatistics statistics;
+	};
+
+	template <typename GameState>
+	void playBatchWith(const GameState& prototype, const uint32_t* tokens, const uint64_t* offsets, size_t game_count,
+		std::pair<double, double>* scores) const {
+		forEachGame(game_count, prototype, [&](GameState& game_state, size_t game) {
+			game_state.reset();
+			scores[game] = game_state.play(tokens + offsets[game], tokens + offsets[game + 1]);
+			});
+	}
+
+	//Games of one thread that are not claimed yet
+	struct alignas(64) GameRange {
+		std::mutex mutex;
+		size_t begin = 0;
+		size_t end = 0;
+	};
+
+	//Takes the next unclaimed game of the range, returns false if there is none
+	static bool claimGame(GameRange& range, size_t& game);
+	//Moves the upper half of the first other range with unclaimed games into the range of worker
+	static bool stealGames(std::vector<GameRange>& ranges, size_t worker);
+
+	unsigned thread_count_;
+};
+
+template <typename WorkerState, typename GameFunction, typename FinishFunction>
+void ParallelBatchRunner::forEachGame(size_t game_count, const WorkerState& prototype, GameFunction game_function,
+	FinishFunction finish_function) const {
+	size_t worker_count = std::min<size_t>(thread_count_, std::max<size_t>(game_count, 1));
+	std::vector<GameRange> ranges(worker_count);
+	for (size_t worker = 0; worker < worker_count; ++worker) {
+		ranges[worker].begin = game_count * worker / worker_count;
+		ranges[worker].end = game_count * (worker + 1) / worker_count;
+	}
+
+	std::mutex error_mutex;
+	std::exception_ptr error;
+	auto run_worker = [&](size_t worker) {
+		try {
+			WorkerState state(prototype);
+			GameRange& own = ranges[worker];
+			for (;;) {
+				size_t game;
+				if (!claimGame(own, game)) {
+					if (!stealGames(ranges, worker)) {
+						finish_function(state);
+						return;
+					}
+					continue;
+				}
+				game_function(state, game);
+			}
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(error_mutex);
+			if (!error) {
+				error = std::current_exception();
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(worker_count - 1);
+	for (size_t worker = 1; worker < worker_count; ++worker) {
+		threads.emplace_back(run_worker, worker);
+	}
+	run_worker(0);
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+//Binary token corpus, all fields little-endian:
+//  header   char magic[8] = "ASAPHTOK", uint32 version = 1, uint32 header size = 32, uint64 game count, uint64 token count
+//  index    uint64 offsets[game count + 1], game i consists of the tokens [offsets[i], offsets[i + 1])
+//  payload  uint32 tokens[token count]
+struct TokenCorpusHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint64_t game_count;
+	uint64_t token_count;
+};
+static_assert(sizeof(TokenCorpusHeader) == 32, "the corpus header is 32 bytes");
+
+inline bool isLittleEndianHost() {
+	const uint32_t probe = 1;
+	unsigned char first_byte;
+	std::memcpy(&first_byte, &probe, 1);
+	return first_byte == 1;
+}
+
+//Writes a corpus in the format read by TokenCorpus
+void writeTokenCorpus(const std::string& path, const std::vector<uint32_t>& tokens, const std::vector<uint64_t>& offsets);
+
+//Read-only memory mapping of a corpus file. The index and payload are used in place, so the batch engines score straight from the mapping.
+//The constructor checks the whole index, so every game of a corpus lies within its payload.
+class TokenCorpus {
+public:
+	explicit TokenCorpus(const std::string& path);
+	~TokenCorpus() { unmap(); }
+	TokenCorpus(const TokenCorpus&) = delete;
+	TokenCorpus& operator=(const TokenCorpus&) = delete;
+
+	size_t getGameCount() const { return static_cast<size_t>(header_->game_count); }
+	size_t getTokenCount() const { return static_cast<size_t>(header_->token_count); }
+	const uint64_t* getOffsets() const { return offsets_; }
+	const uint32_t* getTokens() const { return tokens_; }
+
+private:
+	void unmap();
+
+	const void* data_ = nullptr;
+	size_t size_ = 0;
+	const TokenCorpusHeader* header_ = nullptr;
+	const uint64_t* offsets_ = nullptr;
+	const uint32_t* tokens_ = nullptr;
+};
@@ -0,0 +1,219 @@
+/**
+ * @file service.hpp
+ * @copyright Copyright (c) 2022 Asaphus Vision GmbH
+ *
+ * Scoring service: a TCP server playing the games of framed requests in micro-batches, and a blocking client for it.
+ *
+ * A request frame is a uint64 request id, a uint32 token count and the uint32 tokens, a response frame the request id and
+ * the doubles of the scores of player A and B, all in little-endian byte order. Clients may send any number of requests
+ * without waiting for responses; the responses of a connection arrive in the order of its requests.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "asaphus/engine.hpp"
+
+const size_t scoring_request_header_size = 12;
+const size_t scoring_response_size = 24;
+//The server also rejects requests with more tokens than the max_tokens of its batching policy
+const uint32_t max_scoring_request_tokens = 1u << 20;
+
+inline void appendScoringRequest(std::vector<char>& buffer, uint64_t request_id, const uint32_t* tokens, uint32_t token_count) {
+	size_t offset = buffer.size();
+	buffer.resize(offset + scoring_request_header_size + token_count * sizeof(uint32_t));
+	std::memcpy(buffer.data() + offset, &request_id, sizeof(request_id));
+	std::memcpy(buffer.data() + offset + 8, &token_count, sizeof(token_count));
+	std::memcpy(buffer.data() + offset + scoring_request_header_size, tokens, token_count * sizeof(uint32_t));
+}
+
+inline void appendScoringResponse(std::vector<char>& buffer, uint64_t request_id, const std::pair<double, double>& scores) {
+	size_t offset = buffer.size();
+	buffer.resize(offset + scoring_response_size);
+	std::memcpy(buffer.data() + offset, &request_id, sizeof(request_id));
+	std::memcpy(buffer.data() + offset + 8, &scores.first, sizeof(double));
+	std::memcpy(buffer.data() + offset + 16, &scores.second, sizeof(double));
+}
+
+//Where the scores of a request go
+struct ScoringTicket {
+	uint64_t connection;
+	uint64_t request_id;
+};
+
+//Collects the games of requests and plays all pending ones as one batch once at least max_requests requests or max_tokens
+//tokens are pending, or the oldest pending request has waited for max_delay. A dispatcher thread plays a batch with the parallel
+//engine while the next one is collected, and hands the scores of every batch to the completion function. With a cache, only
+//the games missing from it are played. A request is never split across batches, so a batch holds fewer than max_tokens
+//tokens plus those of its last request.
+class MicroBatcher {
+public:
+	struct Policy {
+		size_t max_requests = 4096;
+		size_t max_tokens = 1 << 20;
+		std::chrono::microseconds max_delay = std::chrono::microseconds(200);
+	};
+	using Completion = std::function<void(const std::vector<ScoringTicket>& tickets, const std::vector<std::pair<double, double>>& scores)>;
+
+	MicroBatcher(const Policy& policy, unsigned compute_threads, Completion completion, ResultCache* cache = nullptr)
+		: policy_(policy), runner_(compute_threads), completion_(std::move(completion)), cache_(cache), dispatcher_([this]() { dispatch(); }) {}
+	MicroBatcher(const MicroBatcher&) = delete;
+	MicroBatcher& operator=(const MicroBatcher&) = delete;
+	~MicroBatcher() { stop(); }
+
+	void submit(const ScoringTicket& ticket, const uint32_t* tokens, size_t token_count);
+
+	//Plays the pending requests and stops the dispatcher
+	void stop();
+
+	uint64_t getBatchCount() const { return batch_count_; }
+
+private:
+	struct Batch {
+		std::vector<ScoringTicket> tickets;
+		std::vector<uint32_t> tokens;
+		std::vector<uint64_t> offsets{ 0 };
+		std::chrono::steady_clock::time_point oldest;
+
+		void clear() {
+			tickets.clear();
+			tokens.clear();
+			offsets.resize(1);
+		}
+	};
+
+	bool isFull() const { return pending_.tickets.size() >= policy_.max_requests || pending_.tokens.size() >= policy_.max_tokens; }
+	void dispatch();
+
+	Policy policy_;
+	ParallelBatchRunner runner_;
+	Completion completion_;
+	ResultCache* cache_;
+	std::mutex mutex_;
+	std::condition_variable pending_changed_;
+	Batch pending_;
+	bool stopping_ = false;
+	std::atomic<uint64_t> batch_count_{ 0 };
+	std::thread dispatcher_;
+};
+
+//Server accepting connections on a port of all interfaces. An I/O thread pool parses the requests of the connections and
+//writes their responses, while a MicroBatcher plays them with compute_threads threads. A connection with max_outstanding
+//requests without response, or max_output_bytes of responses its client has not read yet, is not read from until it is
+//below both again, so the requests pending in the batcher are bounded by the connections times max_outstanding. A request
+//with more tokens than policy.max_tokens closes its connection, so a batch never holds more than twice policy.max_tokens
+//tokens.
+class ScoringServer {
+public:
+	struct Options {
+		uint16_t port = 7411; //0 picks a free port
+		unsigned io_threads = 2;
+		unsigned compute_threads = 0;
+		MicroBatcher::Policy policy;
+		size_t cache_capacity = 0; //games whose scores are cached, 0 disables the cache
+		size_t max_outstanding = 4096;
+		size_t max_output_bytes = 1 << 20;
+	};
+
+	explicit ScoringServer(const Options& options);
+	ScoringServer(const ScoringServer&) = delete;
+	ScoringServer& operator=(const ScoringServer&) = delete;
+	~ScoringServer();
+
+	uint16_t getPort() const { return port_; }
+	//Null without a cache
+	const ResultCache* getCache() const { return cache_.get(); }
+
+	//Serves until stop() is called. Throws std::runtime_error once the connections are closed if waiting for or accepting
+	//connections failed with an error retrying does not fix.
+	void run();
+
+	//Only writes to a pipe, so it may be called from a signal handler
+	void stop() {
+		char byte = 0;
+		ssize_t written = ::write(stop_pipe_[1], &byte, 1);
+		(void)written;
+	}
+
+private:
+	struct Connection {
+		int socket;
+		std::vector<char> input;
+		std::mutex output_mutex;
+		std::vector<char> output;
+		std::atomic<uint64_t> outstanding{ 0 }; //requests without response
+		bool input_closed = false;
+	};
+
+	struct IoThread {
+		int wake_pipe[2];
+		std::mutex mutex;
+		std::vector<std::pair<uint64_t, std::shared_ptr<Connection>>> accepted;
+		std::thread thread;
+	};
+
+	void serveConnections(IoThread& io_thread);
+	void closeIoThreads();
+	void fail(const char* message);
+	bool readRequests(uint64_t id, Connection& connection);
+	bool parseRequests(uint64_t id, Connection& connection);
+	bool isBackedUp(Connection& connection) const;
+	static bool writeResponses(Connection& connection);
+	void complete(const std::vector<ScoringTicket>& tickets, const std::vector<std::pair<double, double>>& scores);
+	static void wake(IoThread& io_thread) {
+		char byte = 0;
+		ssize_t written = ::write(io_thread.wake_pipe[1], &byte, 1);
+		(void)written;
+	}
+
+	Options options_;
+	int listen_socket_ = -1;
+	uint16_t port_ = 0;
+	int stop_pipe_[2] = { -1, -1 };
+	std::atomic<bool> stopping_{ false };
+	std::vector<std::unique_ptr<IoThread>> io_threads_;
+	std::mutex connections_mutex_;
+	std::unordered_map<uint64_t, std::pair<std::shared_ptr<Connection>, IoThread*>> connections_;
+	std::unique_ptr<ResultCache> cache_;
+	std::unique_ptr<MicroBatcher> batcher_;
+	std::mutex error_mutex_;
+	std::exception_ptr error_; //of the first failure stopping run()
+};
+
+//Blocking client of a ScoringServer
+class ScoringClient {
+public:
+	ScoringClient(const std::string& host, uint16_t port);
+	ScoringClient(const ScoringClient&) = delete;
+	ScoringClient& operator=(const ScoringClient&) = delete;
+	~ScoringClient() { ::close(socket_); }
+
+	void send(uint64_t request_id, const std::vector<uint32_t>& tokens);
+
+	//Blocks until the next response arrived
+	std::pair<uint64_t, std::pair<double, double>> receive();
+
+	//Tells the server no more requests follow, responses can still be received
+	void finishSending() { ::shutdown(socket_, SHUT_WR); }
+
+private:
+	int socket_;
+};
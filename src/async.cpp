@@ -0,0 +1,97 @@
+/**
+ * @file async.cpp
+ * @copyright Copyright (c) 2022 Asaphus Vision GmbH
+ *
+ * Asynchronous scorer declared in asaphus/async.hpp.
+ */
+
+#include "asaphus/async.hpp"
+
+#include <stdexcept>
+
+AsyncScorer::AsyncScorer(const Options& options) : options_(options) {
+	if (options.chunk_tokens == 0) {
+		throw std::invalid_argument("AsyncScorer: chunks need at least one token");
+	}
+	unsigned thread_count = options.thread_count != 0 ? options.thread_count : std::max(1u, std::thread::hardware_concurrency());
+	threads_.reserve(thread_count);
+	for (unsigned thread = 0; thread < thread_count; ++thread) {
+		threads_.emplace_back([this]() { work(); });
+	}
+}
+
+AsyncScorer::~AsyncScorer() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	queued_.notify_all();
+	for (auto& thread : threads_) {
+		thread.join();
+	}
+}
+
+void AsyncScorer::play(std::vector<uint32_t> tokens, Callback callback) {
+	std::unique_ptr<Game> game(new Game());
+	game->tokens = std::move(tokens);
+	game->callback = std::move(callback);
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (stopping_) {
+			throw std::runtime_error("AsyncScorer: the scorer is stopping");
+		}
+		queue_.push_back(std::move(game));
+		++pending_;
+	}
+	queued_.notify_one();
+}
+
+size_t AsyncScorer::getPendingCount() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return pending_;
+}
+
+uint64_t AsyncScorer::getYieldCount() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return yields_;
+}
+
+//Plays one chunk of the game at the front of the queue at a time, the lock is only held to take a game and to put it back
+void AsyncScorer::work() {
+	for (;;) {
+		std::unique_ptr<Game> game;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			queued_.wait(lock, [&]() { return stopping_ || !queue_.empty(); });
+			if (queue_.empty()) {
+				return;
+			}
+			game = std::move(queue_.front());
+			queue_.pop_front();
+		}
+
+		std::exception_ptr error;
+		try {
+			size_t chunk = std::min(options_.chunk_tokens, game->tokens.size() - game->played);
+			game->session.feed(game->tokens.data() + game->played, chunk);
+			game->played += chunk;
+		}
+		catch (...) {
+			error = std::current_exception();
+		}
+		if (!error && game->played < game->tokens.size()) {
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				queue_.push_back(std::move(game));
+				++yields_;
+			}
+			queued_.notify_one();
+			continue;
+		}
+
+		//The callback runs without the lock, it may submit further games
+		game->callback(game->session.getScores(), error);
+		std::lock_guard<std::mutex> lock(mutex_);
+		--pending_;
+	}
+}
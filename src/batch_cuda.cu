@@ -0,0 +1,205 @@
+/**
+ * @file batch_cuda.cu
+ * @copyright Copyright (c) 2022 Asaphus Vision GmbH
+ *
+ * CUDA backend of playBatch(): one game of the standard configuration per thread, with its boxes in registers.
+ * The threads of a block load the next tile of tokens of all of their games into shared memory together, so consecutive
+ * threads read consecutive tokens of the same game. The host splits the batch into chunks and alternates them between two
+ * streams with buffers of their own, so copying one chunk overlaps playing the other. The library compiles this file with
+ * --fmad=false, which leaves every operation rounded the way the host engines round it.
+ */
+
+#include "asaphus/engine.hpp"
+#include "cuda_kernels.hpp"
+
+#include <cuda_runtime.h>
+
+static const unsigned games_per_block = 128;
+static const unsigned tile_tokens = 32;
+
+static void checkCuda(cudaError_t error, const char* operation) {
+	if (error != cudaSuccess) {
+		throw std::runtime_error(std::string("playBatchCuda: ") + operation + " failed: " + cudaGetErrorString(error));
+	}
+}
+
+//Two green boxes with initial weights 0.0 and 0.1 and two blue boxes with 0.2 and 0.3, as StandardStaticGame.
+//Boxes are only indexed with constants, so the compiler keeps all of them in registers.
+struct DeviceStandardGame {
+	double weights[4] = { 0.0, 0.1, 0.2, 0.3 };
+	GreenWindow green_windows[2];
+	BlueRange blue_ranges[2];
+	double score_A = 0.0;
+	double score_B = 0.0;
+	bool is_player_A_turn = true;
+
+	__device__ void takeTurn(uint32_t token) {
+		double weight = static_cast<double>(token);
+		unsigned box = 0;
+		double smallest = weights[0];
+		if (weights[1] < smallest) { box = 1; smallest = weights[1]; }
+		if (weights[2] < smallest) { box = 2; smallest = weights[2]; }
+		if (weights[3] < smallest) { box = 3; }
+		double score;
+		switch (box) {
+		case 0: green_windows[0].absorb(weight); score = green_windows[0].score(); weights[0] += weight; break;
+		case 1: green_windows[1].absorb(weight); score = green_windows[1].score(); weights[1] += weight; break;
+		case 2: blue_ranges[0].absorb(weight); score = blue_ranges[0].score(); weights[2] += weight; break;
+		default: blue_ranges[1].absorb(weight); score = blue_ranges[1].score(); weights[3] += weight; break;
+		}
+		if (is_player_A_turn) {
+			score_A += score;
+		}
+		else {
+			score_B += score;
+		}
+		is_player_A_turn = !is_player_A_turn;
+	}
+};
+
+//Offsets are relative to the chunk, game i of it plays the tokens in [offsets[i], offsets[i + 1])
+__global__ void playStandardGames(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, double2* scores) {
+	__shared__ uint32_t tiles[games_per_block][tile_tokens + 1]; //padded so the threads of a warp read distinct banks
+	__shared__ uint64_t begins[games_per_block];
+	__shared__ uint64_t ends[games_per_block];
+	__shared__ unsigned long long longest;
+
+	size_t first_game = static_cast<size_t>(blockIdx.x) * games_per_block;
+	size_t game = first_game + threadIdx.x;
+	bool is_active = game < game_count;
+	begins[threadIdx.x] = is_active ? offsets[game] : 0;
+	ends[threadIdx.x] = is_active ? offsets[game + 1] : 0;
+	if (threadIdx.x == 0) {
+		longest = 0;
+	}
+	__syncthreads();
+	atomicMax(&longest, static_cast<unsigned long long>(ends[threadIdx.x] - begins[threadIdx.x]));
+
+	DeviceStandardGame state;
+	uint64_t length = ends[threadIdx.x] - begins[threadIdx.x];
+	for (uint64_t tile = 0;; tile += tile_tokens) {
+		__syncthreads();
+		if (tile >= longest) {
+			break;
+		}
+		for (unsigned i = threadIdx.x; i < games_per_block * tile_tokens; i += blockDim.x) {
+			unsigned tile_game = i / tile_tokens, token = i % tile_tokens;
+			uint64_t position = begins[tile_game] + tile + token;
+			if (position < ends[tile_game]) {
+				tiles[tile_game][token] = tokens[position];
+			}
+		}
+		__syncthreads();
+		uint64_t count = length > tile ? min(static_cast<uint64_t>(tile_tokens), length - tile) : 0;
+		for (unsigned token = 0; token < count; ++token) {
+			state.takeTurn(tiles[threadIdx.x][token]);
+		}
+	}
+	if (is_active) {
+		scores[game] = make_double2(state.score_A, state.score_B);
+	}
+}
+
+bool isCudaDeviceAvailable() {
+	int device_count = 0;
+	return cudaGetDeviceCount(&device_count) == cudaSuccess && device_count > 0;
+}
+
+//Pinned host and device buffers of one stream, sized for the largest chunk
+struct ChunkStage {
+	cudaStream_t stream = nullptr;
+	uint32_t* host_tokens = nullptr;
+	uint64_t* host_offsets = nullptr;
+	double2* host_scores = nullptr;
+	uint32_t* device_tokens = nullptr;
+	uint64_t* device_offsets = nullptr;
+	double2* device_scores = nullptr;
+	size_t first_game = 0;
+	size_t game_count = 0; //of the chunk in flight, 0 if there is none
+
+	ChunkStage(size_t max_tokens, size_t max_games) {
+		checkCuda(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking), "creating a stream");
+		checkCuda(cudaMallocHost(&host_tokens, std::max<size_t>(max_tokens, 1) * sizeof(uint32_t)), "allocating pinned memory");
+		checkCuda(cudaMallocHost(&host_offsets, (max_games + 1) * sizeof(uint64_t)), "allocating pinned memory");
+		checkCuda(cudaMallocHost(&host_scores, max_games * sizeof(double2)), "allocating pinned memory");
+		checkCuda(cudaMalloc(&device_tokens, std::max<size_t>(max_tokens, 1) * sizeof(uint32_t)), "allocating device memory");
+		checkCuda(cudaMalloc(&device_offsets, (max_games + 1) * sizeof(uint64_t)), "allocating device memory");
+		checkCuda(cudaMalloc(&device_scores, max_games * sizeof(double2)), "allocating device memory");
+	}
+	ChunkStage(const ChunkStage&) = delete;
+	ChunkStage& operator=(const ChunkStage&) = delete;
+	~ChunkStage() {
+		if (stream != nullptr) {
+			cudaStreamSynchronize(stream);
+			cudaStreamDestroy(stream);
+		}
+		cudaFreeHost(host_tokens);
+		cudaFreeHost(host_offsets);
+		cudaFreeHost(host_scores);
+		cudaFree(device_tokens);
+		cudaFree(device_offsets);
+		cudaFree(device_scores);
+	}
+
+	void launch(const uint32_t* tokens, const uint64_t* offsets, size_t first, size_t count) {
+		uint64_t base = offsets[first], token_count = offsets[first + count] - base;
+		std::memcpy(host_tokens, tokens + base, token_count * sizeof(uint32_t));
+		for (size_t i = 0; i <= count; ++i) {
+			host_offsets[i] = offsets[first + i] - base;
+		}
+		checkCuda(cudaMemcpyAsync(device_tokens, host_tokens, token_count * sizeof(uint32_t), cudaMemcpyHostToDevice, stream), "copying tokens");
+		checkCuda(cudaMemcpyAsync(device_offsets, host_offsets, (count + 1) * sizeof(uint64_t), cudaMemcpyHostToDevice, stream), "copying offsets");
+		unsigned block_count = static_cast<unsigned>((count + games_per_block - 1) / games_per_block);
+		playStandardGames<<<block_count, games_per_block, 0, stream>>>(device_tokens, device_offsets, count, device_scores);
+		checkCuda(cudaGetLastError(), "launching the kernel");
+		checkCuda(cudaMemcpyAsync(host_scores, device_scores, count * sizeof(double2), cudaMemcpyDeviceToHost, stream), "copying scores");
+		first_game = first;
+		game_count = count;
+	}
+
+	//Waits for the chunk in flight and stores its scores
+	void finish(std::pair<double, double>* scores) {
+		if (game_count == 0) {
+			return;
+		}
+		checkCuda(cudaStreamSynchronize(stream), "playing a chunk");
+		for (size_t i = 0; i < game_count; ++i) {
+			scores[first_game + i] = std::make_pair(host_scores[i].x, host_scores[i].y);
+		}
+		game_count = 0;
+	}
+};
+
+void playBatchCuda(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores) {
+	//Chunks end after at most max_chunk_games games or once they hold max_chunk_tokens tokens, a longer game is a chunk of its own
+	const size_t max_chunk_games = 1 << 16;
+	const uint64_t max_chunk_tokens = 1 << 24;
+	std::vector<size_t> chunk_ends;
+	size_t max_games = 0;
+	uint64_t max_tokens = 0;
+	for (size_t first = 0; first < game_count;) {
+		size_t last = first + 1;
+		while (last < game_count && last - first < max_chunk_games && offsets[last + 1] - offsets[first] <= max_chunk_tokens) {
+			++last;
+		}
+		chunk_ends.push_back(last);
+		max_games = std::max(max_games, last - first);
+		max_tokens = std::max<uint64_t>(max_tokens, offsets[last] - offsets[first]);
+		first = last;
+	}
+	if (chunk_ends.empty()) {
+		return;
+	}
+
+	ChunkStage first_stage(max_tokens, max_games), second_stage(max_tokens, max_games);
+	ChunkStage* stages[2] = { &first_stage, &second_stage };
+	size_t first = 0;
+	for (size_t chunk = 0; chunk < chunk_ends.size(); ++chunk) {
+		ChunkStage& stage = *stages[chunk % 2];
+		stage.finish(scores);
+		stage.launch(tokens, offsets, first, chunk_ends[chunk] - first);
+		first = chunk_ends[chunk];
+	}
+	first_stage.finish(scores);
+	second_stage.finish(scores);
+}
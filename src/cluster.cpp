@@ -0,0 +1,562 @@
+/**
+ * @file cluster.cpp
+ * @copyright Copyright (c) 2022 Asaphus Vision GmbH
+ *
+ * Shard scheduling, statistics, coordinator and worker declared in asaphus/cluster.hpp.
+ */
+
+#include "asaphus/cluster.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+const uint32_t shard_request_frame = 1;
+const uint32_t shard_result_frame = 2;
+const uint32_t shard_assignment_frame = 1;
+const uint32_t shards_finished_frame = 2;
+const uint64_t checkpoint_magic = 0x31544e494f504b43; //"CKPOINT1"
+
+static bool sendAll(int socket, const void* data, size_t size) {
+	const char* bytes = static_cast<const char*>(data);
+	for (size_t written = 0; written < size;) {
+		ssize_t sent = ::send(socket, bytes + written, size - written, MSG_NOSIGNAL);
+		if (sent <= 0) {
+			if (sent < 0 && errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		written += static_cast<size_t>(sent);
+	}
+	return true;
+}
+
+//A timeout of -1 waits as long as the peer takes, otherwise the whole of size bytes must arrive within timeout_ms
+static bool receiveAll(int socket, void* data, size_t size, int timeout_ms = -1) {
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+	char* bytes = static_cast<char*>(data);
+	for (size_t received = 0; received < size;) {
+		if (timeout_ms >= 0) {
+			auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+			pollfd descriptor = { socket, POLLIN, 0 };
+			int ready = remaining > 0 ? ::poll(&descriptor, 1, static_cast<int>(remaining)) : 0;
+			if (ready < 0 && errno == EINTR) {
+				continue;
+			}
+			if (ready <= 0) {
+				return false;
+			}
+		}
+		ssize_t result = ::recv(socket, bytes + received, size - received, 0);
+		if (result <= 0) {
+			if (result < 0 && errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		received += static_cast<size_t>(result);
+	}
+	return true;
+}
+
+ShardScheduler::ShardScheduler(uint64_t game_count, uint64_t shard_games, Clock::duration straggler_timeout)
+	: game_count_(game_count), shard_games_(shard_games), straggler_timeout_(straggler_timeout) {
+	if (shard_games == 0) {
+		throw std::invalid_argument("ShardScheduler: shards need at least one game");
+	}
+	done_.resize((game_count + shard_games - 1) / shard_games, 0);
+	for (uint64_t shard = 0; shard < done_.size(); ++shard) {
+		pending_.push_back(shard);
+	}
+}
+
+ShardScheduler::Shard ShardScheduler::getShard(uint64_t index) const {
+	uint64_t first_game = index * shard_games_;
+	return Shard{ index, first_game, std::min(shard_games_, game_count_ - first_game) };
+}
+
+bool ShardScheduler::assign(uint64_t worker, Clock::time_point now, Shard& shard) {
+	while (!pending_.empty()) {
+		uint64_t index = pending_.front();
+		pending_.pop_front();
+		if (!done_[index]) {
+			in_flight_[index].push_back(Assignment{ worker, now });
+			shard = getShard(index);
+			return true;
+		}
+	}
+	//A straggler goes to at most one more worker, the one that has waited for it longest is picked first
+	auto straggler = in_flight_.end();
+	for (auto candidate = in_flight_.begin(); candidate != in_flight_.end(); ++candidate) {
+		const auto& assignments = candidate->second;
+		if (assignments.size() == 1 && assignments[0].worker != worker && now - assignments[0].start >= straggler_timeout_ &&
+			(straggler == in_flight_.end() || assignments[0].start < straggler->second[0].start)) {
+			straggler = candidate;
+		}
+	}
+	if (straggler == in_flight_.end()) {
+		return false;
+	}
+	straggler->second.push_back(Assignment{ worker, now });
+	++redispatch_count_;
+	shard = getShard(straggler->first);
+	return true;
+}
+
+bool ShardScheduler::complete(uint64_t worker, uint64_t shard) {
+	if (shard >= done_.size() || done_[shard] || !isAssigned(worker, shard)) {
+		return false;
+	}
+	in_flight_.erase(shard);
+	done_[shard] = 1;
+	++done_count_;
+	return true;
+}
+
+bool ShardScheduler::isAssigned(uint64_t worker, uint64_t shard) const {
+	auto found = in_flight_.find(shard);
+	return found != in_flight_.end() && std::any_of(found->second.begin(), found->second.end(),
+		[&](const Assignment& assignment) { return assignment.worker == worker; });
+}
+
+void ShardScheduler::release(uint64_t worker) {
+	for (auto shard = in_flight_.begin(); shard != in_flight_.end();) {
+		auto& assignments = shard->second;
+		assignments.erase(std::remove_if(assignments.begin(), assignments.end(),
+			[&](const Assignment& assignment) { return assignment.worker == worker; }), assignments.end());
+		if (assignments.empty()) {
+			pending_.push_front(shard->first);
+			shard = in_flight_.erase(shard);
+		}
+		else {
+			++shard;
+		}
+	}
+}
+
+void ShardScheduler::markDone(uint64_t shard) {
+	if (!done_[shard]) {
+		in_flight_.erase(shard);
+		done_[shard] = 1;
+		++done_count_;
+	}
+}
+
+ShardScheduler::Clock::time_point ShardScheduler::getNextStragglerTime() const {
+	Clock::time_point next = Clock::time_point::max();
+	for (const auto& shard : in_flight_) {
+		if (shard.second.size() == 1) {
+			next = std::min(next, shard.second[0].start + straggler_timeout_);
+		}
+	}
+	return next;
+}
+
+size_t ScoreStatistics::getBucket(double score) {
+	if (!(score >= 1.0)) {
+		return std::isnan(score) ? bucket_count - 1 : 0;
+	}
+	if (std::isinf(score)) {
+		return bucket_count - 1;
+	}
+	int exponent;
+	std::frexp(score, &exponent); //score is in [2^(exponent - 1), 2^exponent)
+	return std::min(static_cast<size_t>(exponent), bucket_count - 1);
+}
+
+void ScoreStatistics::merge(const ScoreStatistics& other) {
+	games += other.games;
+	wins_A += other.wins_A;
+	wins_B += other.wins_B;
+	ties += other.ties;
+	for (size_t bucket = 0; bucket < bucket_count; ++bucket) {
+		histogram_A[bucket] += other.histogram_A[bucket];
+		histogram_B[bucket] += other.histogram_B[bucket];
+	}
+}
+
+void ScoreStatistics::write(std::ostream& stream) const {
+	const uint64_t counts[4] = { games, wins_A, wins_B, ties };
+	stream.write(reinterpret_cast<const char*>(counts), sizeof(counts));
+	stream.write(reinterpret_cast<const char*>(histogram_A.data()), sizeof(histogram_A));
+	stream.write(reinterpret_cast<const char*>(histogram_B.data()), sizeof(histogram_B));
+}
+
+void ScoreStatistics::read(std::istream& stream) {
+	uint64_t counts[4];
+	stream.read(reinterpret_cast<char*>(counts), sizeof(counts));
+	stream.read(reinterpret_cast<char*>(histogram_A.data()), sizeof(histogram_A));
+	stream.read(reinterpret_cast<char*>(histogram_B.data()), sizeof(histogram_B));
+	if (!stream) {
+		throw std::runtime_error("ScoreStatistics: truncated statistics");
+	}
+	games = counts[0];
+	wins_A = counts[1];
+	wins_B = counts[2];
+	ties = counts[3];
+}
+
+void ScoreStatistics::writeSummary(std::ostream& stream) const {
+	stream << "games: " << games << ", wins of player A: " << wins_A << ", wins of player B: " << wins_B << ", ties: " << ties << '\n';
+	stream << "score bucket, games of player A, games of player B\n";
+	for (size_t bucket = 0; bucket < bucket_count; ++bucket) {
+		if (histogram_A[bucket] != 0 || histogram_B[bucket] != 0) {
+			if (bucket == 0) {
+				stream << "< 1";
+			}
+			else if (bucket == bucket_count - 1) {
+				stream << ">= 2^" << bucket - 1;
+			}
+			else {
+				stream << "[2^" << bucket - 1 << ", 2^" << bucket << ")";
+			}
+			stream << ", " << histogram_A[bucket] << ", " << histogram_B[bucket] << '\n';
+		}
+	}
+}
+
+ClusterCoordinator::ClusterCoordinator(const std::string& corpus_path, const std::string& output_path, const Options& options)
+	: options_(options), scheduler_(TokenCorpus(corpus_path).getGameCount(), options.shard_games, options.straggler_timeout) {
+	if (!isLittleEndianHost()) {
+		throw std::runtime_error("ClusterCoordinator: frames are only supported on little-endian hosts");
+	}
+	if (!options_.checkpoint_path.empty()) {
+		loadCheckpoint();
+	}
+	//Resuming keeps the scores of the shards done before
+	off_t output_size = static_cast<off_t>(scheduler_.getGameCount() * 2 * sizeof(double));
+	output_file_ = ::open(output_path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (output_file_ < 0 || ::ftruncate(output_file_, output_size) != 0) {
+		if (output_file_ >= 0) {
+			::close(output_file_);
+		}
+		throw std::runtime_error("ClusterCoordinator: cannot open " + output_path);
+	}
+
+	listen_socket_ = ::socket(AF_INET, SOCK_STREAM, 0);
+	int reuse = 1;
+	sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(options.port);
+	socklen_t address_size = sizeof(address);
+	if (listen_socket_ < 0 || ::setsockopt(listen_socket_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+		::bind(listen_socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(listen_socket_, 128) != 0 ||
+		::getsockname(listen_socket_, reinterpret_cast<sockaddr*>(&address), &address_size) != 0 || ::pipe(stop_pipe_) != 0) {
+		if (listen_socket_ >= 0) {
+			::close(listen_socket_);
+		}
+		::close(output_file_);
+		throw std::runtime_error("ClusterCoordinator: cannot listen on port " + std::to_string(options.port));
+	}
+	port_ = ntohs(address.sin_port);
+}
+
+ClusterCoordinator::~ClusterCoordinator() {
+	::close(listen_socket_);
+	::close(stop_pipe_[0]);
+	::close(stop_pipe_[1]);
+	::close(output_file_);
+}
+
+void ClusterCoordinator::run() {
+	uint64_t next_worker = 0;
+	bool stopped = false;
+	std::exception_ptr poll_error;
+	while (!stopped) {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (scheduler_.isDone() || checkpoint_error_) {
+				break;
+			}
+		}
+		//Wakes up now and then to notice that the last shard is done
+		pollfd descriptors[2] = { { listen_socket_, POLLIN, 0 }, { stop_pipe_[0], POLLIN, 0 } };
+		if (::poll(descriptors, 2, 100) < 0 && errno != EINTR) {
+			//Thrown once the workers are shut down, so no worker thread is left joinable
+			poll_error = std::make_exception_ptr(std::runtime_error("ClusterCoordinator: poll failed"));
+			break;
+		}
+		if (descriptors[1].revents & POLLIN) {
+			char byte;
+			stopped = ::read(stop_pipe_[0], &byte, 1) >= 0;
+		}
+		if (descriptors[0].revents & POLLIN) {
+			int socket = ::accept(listen_socket_, nullptr, nullptr);
+			if (socket >= 0) {
+				int no_delay = 1;
+				::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+				std::lock_guard<std::mutex> lock(mutex_);
+				worker_sockets_.push_back(socket);
+				uint64_t worker = next_worker++;
+				worker_threads_.emplace_back([this, socket, worker]() { serveWorker(socket, worker); });
+			}
+		}
+	}
+
+	//Workers asking for a shard are told there is none. Workers still playing the second copy of a straggler may return it
+	//within the straggler timeout, so they are told as well, unless the coordinator was stopped, cannot poll or cannot
+	//checkpoint.
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		finished_ = true;
+		finish_deadline_ = ShardScheduler::Clock::now() +
+			(stopped || poll_error || checkpoint_error_ ? ShardScheduler::Clock::duration(0) : options_.straggler_timeout);
+	}
+	progress_.notify_all();
+	for (std::thread& thread : worker_threads_) {
+		thread.join();
+	}
+	for (int socket : worker_sockets_) {
+		::close(socket);
+	}
+	worker_sockets_.clear();
+	worker_threads_.clear();
+	finished_ = false;
+	if (checkpoint_error_) {
+		std::exception_ptr error = checkpoint_error_;
+		checkpoint_error_ = nullptr;
+		std::rethrow_exception(error);
+	}
+	if (!options_.checkpoint_path.empty()) {
+		writeCheckpoint();
+	}
+	if (poll_error) {
+		std::rethrow_exception(poll_error);
+	}
+}
+
+void ClusterCoordinator::serveWorker(int socket, uint64_t worker) {
+	//A worker stalling within a frame is disconnected, its shards go to the next worker
+	const int frame_timeout_ms = static_cast<int>(std::min<std::chrono::milliseconds::rep>(options_.frame_timeout.count(),
+		std::numeric_limits<int>::max()));
+	for (;;) {
+		pollfd descriptor = { socket, POLLIN, 0 };
+		int ready = ::poll(&descriptor, 1, 100);
+		if (ready <= 0) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			if ((ready < 0 && errno != EINTR) || (finished_ && ShardScheduler::Clock::now() >= finish_deadline_)) {
+				break;
+			}
+			continue;
+		}
+		uint32_t frame_type;
+		if (!receiveAll(socket, &frame_type, sizeof(frame_type), frame_timeout_ms)) {
+			break;
+		}
+		if (frame_type == shard_request_frame) {
+			ShardScheduler::Shard shard;
+			bool assigned = false;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				while (!finished_ && !scheduler_.isDone()) {
+					assigned = scheduler_.assign(worker, ShardScheduler::Clock::now(), shard);
+					if (assigned) {
+						break;
+					}
+					//A shard is done, released or becomes a straggler
+					auto deadline = std::min(scheduler_.getNextStragglerTime(), ShardScheduler::Clock::now() + std::chrono::seconds(1));
+					progress_.wait_until(lock, deadline);
+				}
+			}
+			uint64_t assignment[3] = { shard.index, shard.first_game, shard.game_count };
+			if (!(assigned ? sendAll(socket, &shard_assignment_frame, sizeof(uint32_t)) && sendAll(socket, assignment, sizeof(assignment))
+				: sendAll(socket, &shards_finished_frame, sizeof(uint32_t)))) {
+				break;
+			}
+		}
+		else if (frame_type == shard_result_frame) {
+			uint64_t header[2];
+			if (!receiveAll(socket, header, sizeof(header), frame_timeout_ms) || header[0] >= scheduler_.getShardCount() ||
+				header[1] != scheduler_.getShard(header[0]).game_count) {
+				break;
+			}
+			std::vector<std::pair<double, double>> scores(static_cast<size_t>(header[1]));
+			std::vector<double> doubles(2 * scores.size());
+			if (!receiveAll(socket, doubles.data(), doubles.size() * sizeof(double), frame_timeout_ms)) {
+				break;
+			}
+			for (size_t game = 0; game < scores.size(); ++game) {
+				scores[game] = std::make_pair(doubles[2 * game], doubles[2 * game + 1]);
+			}
+			bool stored = false;
+			try {
+				stored = storeResult(worker, header[0], scores);
+			}
+			catch (const std::exception&) {
+				//only scoring before the shard is marked done throws, so it stays in flight and is played again once this worker is released
+			}
+			if (!stored) {
+				break;
+			}
+		}
+		else {
+			break;
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		scheduler_.release(worker);
+	}
+	progress_.notify_all();
+}
+
+bool ClusterCoordinator::storeResult(uint64_t worker, uint64_t shard, const std::vector<std::pair<double, double>>& scores) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (scheduler_.isDone(shard)) {
+		return true; //the other worker of a straggler was faster
+	}
+	if (!scheduler_.isAssigned(worker, shard)) {
+		return false; //a result nobody asked this worker for disconnects it
+	}
+	ScoreStatistics shard_statistics;
+	std::vector<double> doubles(2 * scores.size());
+	for (size_t game = 0; game < scores.size(); ++game) {
+		shard_statistics.add(scores[game]);
+		doubles[2 * game] = scores[game].first;
+		doubles[2 * game + 1] = scores[game].second;
+	}
+	off_t offset = static_cast<off_t>(scheduler_.getShard(shard).first_game * 2 * sizeof(double));
+	const char* bytes = reinterpret_cast<const char*>(doubles.data());
+	for (size_t written = 0; written < doubles.size() * sizeof(double);) {
+		ssize_t result = ::pwrite(output_file_, bytes + written, doubles.size() * sizeof(double) - written, offset + static_cast<off_t>(written));
+		if (result < 0 && errno == EINTR) {
+			continue;
+		}
+		if (result <= 0) {
+			return false;
+		}
+		written += static_cast<size_t>(result);
+	}
+	scheduler_.complete(worker, shard);
+	statistics_.merge(shard_statistics);
+	progress_.notify_all();
+	//The result is stored whether or not the checkpoint can be written, a failure ends run() with its error
+	if (!options_.checkpoint_path.empty() && ++unsaved_shards_ >= options_.checkpoint_interval && !checkpoint_error_) {
+		try {
+			writeCheckpoint();
+		}
+		catch (const std::exception&) {
+			checkpoint_error_ = std::current_exception();
+		}
+	}
+	return true;
+}
+
+//Shard size and count, the done flag of every shard and the statistics of the done shards. Scores of checkpointed shards
+//are synced to the output file first, and the checkpoint is replaced by renaming, so a crash leaves a consistent one.
+void ClusterCoordinator::writeCheckpoint() {
+	if (::fsync(output_file_) != 0) {
+		throw std::runtime_error("ClusterCoordinator: cannot sync the output file");
+	}
+	std::string temporary_path = options_.checkpoint_path + ".tmp";
+	{
+		std::ofstream stream(temporary_path, std::ios::binary | std::ios::trunc);
+		const uint64_t header[4] = { checkpoint_magic, scheduler_.getGameCount(), scheduler_.getShardGames(), scheduler_.getShardCount() };
+		stream.write(reinterpret_cast<const char*>(header), sizeof(header));
+		for (uint64_t shard = 0; shard < scheduler_.getShardCount(); ++shard) {
+			char done = scheduler_.isDone(shard) ? 1 : 0;
+			stream.write(&done, 1);
+		}
+		statistics_.write(stream);
+		stream.flush();
+		if (!stream) {
+			throw std::runtime_error("ClusterCoordinator: cannot write " + temporary_path);
+		}
+	}
+	if (std::rename(temporary_path.c_str(), options_.checkpoint_path.c_str()) != 0) {
+		throw std::runtime_error("ClusterCoordinator: cannot replace " + options_.checkpoint_path);
+	}
+	unsaved_shards_ = 0;
+}
+
+void ClusterCoordinator::loadCheckpoint() {
+	std::ifstream stream(options_.checkpoint_path, std::ios::binary);
+	if (!stream) {
+		return; //nothing to resume
+	}
+	uint64_t header[4];
+	stream.read(reinterpret_cast<char*>(header), sizeof(header));
+	if (!stream || header[0] != checkpoint_magic) {
+		throw std::runtime_error("ClusterCoordinator: " + options_.checkpoint_path + " is not a checkpoint");
+	}
+	if (header[1] != scheduler_.getGameCount() || header[2] != scheduler_.getShardGames() || header[3] != scheduler_.getShardCount()) {
+		throw std::runtime_error("ClusterCoordinator: " + options_.checkpoint_path + " is of another corpus or shard size");
+	}
+	std::vector<char> done(static_cast<size_t>(header[3]));
+	stream.read(done.data(), done.size());
+	statistics_.read(stream);
+	for (uint64_t shard = 0; shard < done.size(); ++shard) {
+		if (done[shard] != 0) {
+			scheduler_.markDone(shard);
+		}
+	}
+}
+
+ClusterWorker::ClusterWorker(const std::string& host, uint16_t port, const std::string& corpus_path, unsigned thread_count)
+	: corpus_(corpus_path), runner_(thread_count) {
+	if (!isLittleEndianHost()) {
+		throw std::runtime_error("ClusterWorker: frames are only supported on little-endian hosts");
+	}
+	sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	socket_ = ::socket(AF_INET, SOCK_STREAM, 0);
+	if (socket_ < 0 || ::inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1 ||
+		::connect(socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+		if (socket_ >= 0) {
+			::close(socket_);
+		}
+		throw std::runtime_error("ClusterWorker: cannot connect to " + host + ":" + std::to_string(port));
+	}
+	int no_delay = 1;
+	::setsockopt(socket_, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+}
+
+uint64_t ClusterWorker::run(uint64_t max_shards) {
+	uint64_t played = 0;
+	std::vector<std::pair<double, double>> scores;
+	std::vector<double> doubles;
+	while (played < max_shards) {
+		uint32_t frame_type;
+		if (!sendAll(socket_, &shard_request_frame, sizeof(uint32_t)) || !receiveAll(socket_, &frame_type, sizeof(frame_type))) {
+			throw std::runtime_error("ClusterWorker: connection to the coordinator lost");
+		}
+		if (frame_type == shards_finished_frame) {
+			break;
+		}
+		uint64_t assignment[3];
+		if (frame_type != shard_assignment_frame || !receiveAll(socket_, assignment, sizeof(assignment))) {
+			throw std::runtime_error("ClusterWorker: invalid assignment");
+		}
+		if (assignment[1] > corpus_.getGameCount() || assignment[2] > corpus_.getGameCount() - assignment[1]) {
+			throw std::runtime_error("ClusterWorker: the assigned shard is not part of the corpus");
+		}
+		scores.resize(static_cast<size_t>(assignment[2]));
+		runner_.playBatchLanes(corpus_.getTokens(), corpus_.getOffsets() + assignment[1], scores.size(), scores.data());
+		doubles.resize(2 * scores.size());
+		for (size_t game = 0; game < scores.size(); ++game) {
+			doubles[2 * game] = scores[game].first;
+			doubles[2 * game + 1] = scores[game].second;
+		}
+		uint64_t header[2] = { assignment[0], assignment[2] };
+		if (!sendAll(socket_, &shard_result_frame, sizeof(uint32_t)) || !sendAll(socket_, header, sizeof(header)) ||
+			!sendAll(socket_, doubles.data(), doubles.size() * sizeof(double))) {
+			throw std::runtime_error("ClusterWorker: connection to the coordinator lost");
+		}
+		++played;
+	}
+	return played;
+}
@@ -0,0 +1,18 @@
+/**
+ * @file cuda_kernels.hpp
+ * @copyright Copyright (c) 2022 Asaphus Vision GmbH
+ *
+ * CUDA backend of the library, defined in batch_cuda.cu when the library is configured with -DASAPHUS_ENABLE_CUDA=ON.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+//Whether the CUDA runtime finds a device
+bool isCudaDeviceAvailable();
+
+//Plays the games of a batch of the standard configuration on the current device
+void playBatchCuda(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores);
@@ -0,0 +1,1529 @@
+/**
+ * @file engine.cpp
+ * @copyright Copyright (c) 2022 Asaphus Vision GmbH
+ *
+ * Out-of-line parts of the game engine declared in asaphus/engine.hpp.
+ */
+
+#include "asaphus/engine.hpp"
+#include "lane_kernels.hpp"
+#ifdef ASAPHUS_CUDA_BACKEND
+#include "cuda_kernels.hpp"
+#endif
+
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <random>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+void GameCounters::merge(const GameCounters& other) {
+	turns += other.turns;
+	tied_turns += other.tied_turns;
+	turn_cycles += other.turn_cycles;
+	absorb_calls += other.absorb_calls;
+	absorb_cycles += other.absorb_cycles;
+	cache_hits += other.cache_hits;
+	cache_misses += other.cache_misses;
+	if (other.absorptions.size() > absorptions.size()) {
+		absorptions.resize(other.absorptions.size(), 0);
+		contributions.resize(other.contributions.size(), 0.0);
+	}
+	for (size_t box = 0; box < other.absorptions.size(); ++box) {
+		absorptions[box] += other.absorptions[box];
+		contributions[box] += other.contributions[box];
+	}
+}
+
+void GameCounters::writeSummary(std::ostream& stream) const {
+	char line[160];
+	auto average = [](uint64_t cycles, uint64_t count) { return count == 0 ? 0.0 : static_cast<double>(cycles) / static_cast<double>(count); };
+	std::snprintf(line, sizeof(line), "turns %llu, tied %llu (%.4g%%), %.4g cycles/turn, %llu absorbWeight calls, %.4g cycles/call\n",
+		static_cast<unsigned long long>(turns), static_cast<unsigned long long>(tied_turns), 100.0 * average(tied_turns, turns),
+		average(turn_cycles, turns), static_cast<unsigned long long>(absorb_calls), average(absorb_cycles, absorb_calls));
+	stream << line;
+	if (cache_hits + cache_misses != 0) {
+		std::snprintf(line, sizeof(line), "result cache: %llu hits, %llu misses (%.4g%% hits)\n", static_cast<unsigned long long>(cache_hits),
+			static_cast<unsigned long long>(cache_misses), 100.0 * average(cache_hits, cache_hits + cache_misses));
+		stream << line;
+	}
+	for (size_t box = 0; box < absorptions.size(); ++box) {
+		std::snprintf(line, sizeof(line), "box %zu: %llu tokens, score contribution %g\n", box,
+			static_cast<unsigned long long>(absorptions[box]), contributions[box]);
+		stream << line;
+	}
+}
+
+//Moves on to the next block when the current one is full, inserting a new block if the next one is missing or too small
+void* GameArena::allocate(size_t size, size_t alignment) {
+	if (current_ < blocks_.size()) {
+		uintptr_t address = reinterpret_cast<uintptr_t>(blocks_[current_].data.get()) + used_;
+		size_t padding = (alignment - address % alignment) % alignment;
+		if (padding + size <= blocks_[current_].size - used_) {
+			used_ += padding + size;
+			return reinterpret_cast<void*>(address + padding);
+		}
+		++current_;
+	}
+	if (size > std::numeric_limits<size_t>::max() - alignment) {
+		throw std::bad_alloc();
+	}
+	size_t block_size = std::max(block_size_, size + alignment);
+	if (current_ == blocks_.size() || blocks_[current_].size < block_size) {
+		Block block{ std::unique_ptr<unsigned char[]>(new unsigned char[block_size]), block_size };
+		blocks_.insert(blocks_.begin() + static_cast<std::ptrdiff_t>(current_), std::move(block));
+	}
+	used_ = 0;
+	return allocate(size, alignment);
+}
+
+size_t playBatchPrefixShared(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores) {
+	auto gameTokens = [&](size_t game) { return tokens + offsets[game]; };
+	auto gameLength = [&](size_t game) { return static_cast<size_t>(offsets[game + 1] - offsets[game]); };
+	std::vector<size_t> order(game_count);
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+		return std::lexicographical_compare(gameTokens(lhs), gameTokens(lhs) + gameLength(lhs), gameTokens(rhs), gameTokens(rhs) + gameLength(rhs));
+		});
+
+	//games order[first, last) share their first depth tokens, which state has played
+	struct Branch {
+		size_t first;
+		size_t last;
+		size_t depth;
+		GameState state;
+	};
+	std::vector<Branch> branches;
+	if (game_count != 0) {
+		branches.push_back(Branch{ 0, game_count, 0, GameState() });
+	}
+	size_t played_tokens = 0;
+	while (!branches.empty()) {
+		Branch branch = branches.back();
+		branches.pop_back();
+
+		const uint32_t* first_tokens = gameTokens(order[branch.first]);
+		const uint32_t* last_tokens = gameTokens(order[branch.last - 1]);
+		size_t common = branch.depth;
+		size_t max_common = std::min(gameLength(order[branch.first]), gameLength(order[branch.last - 1]));
+		while (common < max_common && first_tokens[common] == last_tokens[common]) {
+			++common;
+		}
+		branch.state.play(first_tokens + branch.depth, first_tokens + common);
+		played_tokens += common - branch.depth;
+
+		//games ending with the common prefix sort first
+		size_t game = branch.first;
+		for (; game < branch.last && gameLength(order[game]) == common; ++game) {
+			scores[order[game]] = branch.state.getScores();
+		}
+		while (game < branch.last) {
+			uint32_t next_token = gameTokens(order[game])[common];
+			size_t group_end = game + 1;
+			while (group_end < branch.last && gameTokens(order[group_end])[common] == next_token) {
+				++group_end;
+			}
+			if (group_end - game == 1) {
+				GameState leaf(branch.state);
+				leaf.play(gameTokens(order[game]) + common, gameTokens(order[game]) + gameLength(order[game]));
+				played_tokens += gameLength(order[game]) - common;
+				scores[order[game]] = leaf.getScores();
+			}
+			else {
+				branches.push_back(Branch{ game, group_end, common, branch.state });
+			}
+			game = group_end;
+		}
+	}
+	return played_tokens;
+}
+
+void checkBatchOffsets(size_t token_count, const std::vector<uint64_t>& offsets) {
+	if (offsets.empty()) {
+		throw std::invalid_argument("playBatch: offsets need an entry more than there are games");
+	}
+	if (offsets.back() > token_count || !std::is_sorted(offsets.begin(), offsets.end())) {
+		throw std::invalid_argument("playBatch: offsets must be ascending and within the token buffer");
+	}
+}
+
+void playBatch(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores,
+	const GameConfig& config) {
+	if (config.isStandard()) {
+		StandardStaticGame game_state;
+		playGames(game_state, tokens, offsets, game_count, scores);
+	}
+	else {
+		BoxSet game_state(config);
+		playGames(game_state, tokens, offsets, game_count, scores);
+	}
+}
+
+std::vector<std::pair<double, double>> playBatch(const std::vector<uint32_t>& tokens, const std::vector<uint64_t>& offsets,
+	const GameConfig& config) {
+	if (offsets.empty()) {
+		return {};
+	}
+	checkBatchOffsets(tokens.size(), offsets);
+	std::vector<std::pair<double, double>> scores(offsets.size() - 1);
+	playBatch(tokens.data(), offsets.data(), scores.size(), scores.data(), config);
+	return scores;
+}
+
+void playBatch(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, ResultSink& sink,
+	const GameConfig& config) {
+	const size_t block_size = 4096;
+	std::vector<std::pair<double, double>> scores(std::min(game_count, block_size));
+	for (size_t first = 0; first < game_count; first += block_size) {
+		size_t count = std::min(block_size, game_count - first);
+		playBatch(tokens, offsets + first, count, scores.data(), config);
+		sink.consume(scores.data(), count);
+	}
+}
+
+QuantileSketch::QuantileSketch(uint32_t k, uint64_t seed) : k_(k), random_state_(seed), levels_(1) {
+	if (k < 8) {
+		throw std::invalid_argument("QuantileSketch: k must be at least 8");
+	}
+}
+
+size_t QuantileSketch::getCapacity(size_t level) const {
+	size_t depth = levels_.size() - 1 - level;
+	return std::max<size_t>(2, static_cast<size_t>(k_ * std::pow(2.0 / 3.0, static_cast<double>(depth))));
+}
+
+void QuantileSketch::compress() {
+	for (size_t level = 0; level < levels_.size(); ++level) {
+		if (levels_[level].size() < getCapacity(level)) {
+			continue;
+		}
+		if (level + 1 == levels_.size()) {
+			levels_.emplace_back();
+		}
+		std::vector<double>& items = levels_[level];
+		std::vector<double>& above = levels_[level + 1];
+		std::sort(items.begin(), items.end());
+		//An odd item out stays on its level
+		size_t paired = items.size() & ~static_cast<size_t>(1);
+		random_state_ = random_state_ * 6364136223846793005ull + 1442695040888963407ull;
+		size_t offset = static_cast<size_t>(random_state_ >> 63);
+		for (size_t i = offset; i < paired; i += 2) {
+			above.push_back(items[i]);
+		}
+		items.erase(items.begin(), items.begin() + static_cast<std::ptrdiff_t>(paired));
+	}
+}
+
+void QuantileSketch::merge(const QuantileSketch& other) {
+	if (other.k_ != k_) {
+		throw std::invalid_argument("QuantileSketch: sketches of different k cannot be merged");
+	}
+	if (other.levels_.size() > levels_.size()) {
+		levels_.resize(other.levels_.size());
+	}
+	for (size_t level = 0; level < other.levels_.size(); ++level) {
+		levels_[level].insert(levels_[level].end(), other.levels_[level].begin(), other.levels_[level].end());
+	}
+	count_ += other.count_;
+	min_ = std::min(min_, other.min_);
+	max_ = std::max(max_, other.max_);
+	compress();
+}
+
+double QuantileSketch::getQuantile(double fraction) const {
+	if (count_ == 0) {
+		return std::numeric_limits<double>::quiet_NaN();
+	}
+	if (!(fraction > 0.0)) {
+		return min_;
+	}
+	if (fraction >= 1.0) {
+		return max_;
+	}
+	std::vector<std::pair<double, uint64_t>> weighted;
+	weighted.reserve(getRetainedCount());
+	for (size_t level = 0; level < levels_.size(); ++level) {
+		for (double item : levels_[level]) {
+			weighted.emplace_back(item, static_cast<uint64_t>(1) << level);
+		}
+	}
+	std::sort(weighted.begin(), weighted.end());
+	//Weights of the retained items sum to about count, ranks are taken relative to their sum
+	uint64_t total = 0;
+	for (const auto& item : weighted) {
+		total += item.second;
+	}
+	double rank = fraction * static_cast<double>(total);
+	uint64_t cumulative = 0;
+	for (const auto& item : weighted) {
+		cumulative += item.second;
+		if (static_cast<double>(cumulative) >= rank) {
+			return item.first;
+		}
+	}
+	return max_;
+}
+
+size_t QuantileSketch::getRetainedCount() const {
+	size_t retained = 0;
+	for (const auto& items : levels_) {
+		retained += items.size();
+	}
+	return retained;
+}
+
+void BatchStatistics::merge(const BatchStatistics& other) {
+	games += other.games;
+	wins_A += other.wins_A;
+	wins_B += other.wins_B;
+	draws += other.draws;
+	margins.merge(other.margins);
+	margin_quantiles.merge(other.margin_quantiles);
+	if (other.box_contributions.size() > box_contributions.size()) {
+		box_contributions.resize(other.box_contributions.size(), 0.0);
+	}
+	for (size_t box = 0; box < other.box_contributions.size(); ++box) {
+		box_contributions[box] += other.box_contributions[box];
+	}
+}
+
+BatchStatistics reduceBatch(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, const GameConfig& config) {
+	BoxSet boxes(config);
+	BatchStatistics statistics(config.size());
+	for (size_t game = 0; game < game_count; ++game) {
+		reduceGame(boxes, tokens + offsets[game], tokens + offsets[game + 1], statistics);
+	}
+	return statistics;
+}
+
+TokenDistribution TokenDistribution::uniform(uint32_t low, uint32_t high) {
+	if (low > high) {
+		throw std::invalid_argument("TokenDistribution: low must not exceed high");
+	}
+	return TokenDistribution(Kind::UNIFORM, low, static_cast<uint64_t>(high - low) + 1, 0.0);
+}
+
+TokenDistribution TokenDistribution::exponential(double mean) {
+	if (!(mean > 0.0) || !std::isfinite(mean)) {
+		throw std::invalid_argument("TokenDistribution: mean must be positive and finite");
+	}
+	return TokenDistribution(Kind::EXPONENTIAL, 0, 0, mean);
+}
+
+SimulatedTokens::SimulatedTokens(const SimulationConfig& simulation, uint64_t game)
+	: distribution_(simulation.tokens),
+	key_{ { static_cast<uint32_t>(simulation.seed), static_cast<uint32_t>(simulation.seed >> 32) } },
+	game_{ { static_cast<uint32_t>(game), static_cast<uint32_t>(game >> 32) } } {
+	if (simulation.min_length > simulation.max_length) {
+		throw std::invalid_argument("SimulatedTokens: min_length must not exceed max_length");
+	}
+	auto length_words = Philox4x32::block({ { 0, 0, game_[0], game_[1] } }, key_);
+	uint64_t bits = (static_cast<uint64_t>(length_words[1]) << 32) | length_words[0];
+	uint64_t span = simulation.max_length - simulation.min_length;
+	//The modulo bias is below (span + 1) / 2^64
+	length_ = simulation.min_length + (span == std::numeric_limits<uint64_t>::max() ? bits : bits % (span + 1));
+}
+
+std::vector<uint32_t> SimulatedTokens::materialize() {
+	std::vector<uint32_t> tokens(length_);
+	for (auto& token : tokens) {
+		token = next();
+	}
+	return tokens;
+}
+
+std::pair<double, double> simulateGame(const SimulationConfig& simulation, uint64_t game, const GameConfig& config) {
+	SimulatedTokens tokens(simulation, game);
+	BoxSet boxes(config);
+	double score_A = 0.0, score_B = 0.0;
+	for (uint64_t turn = 0; turn < tokens.getLength(); ++turn) {
+		(turn % 2 == 0 ? score_A : score_B) += boxes.takeTurn(tokens.next());
+	}
+	return std::make_pair(score_A, score_B);
+}
+
+BatchStatistics simulateBatch(const SimulationConfig& simulation, uint64_t first_game, uint64_t game_count, const GameConfig& config) {
+	BoxSet boxes(config);
+	BatchStatistics statistics(config.size());
+	for (uint64_t game = first_game; game < first_game + game_count; ++game) {
+		SimulatedTokens tokens(simulation, game);
+		reduceGame(boxes, tokens.getLength(), [&tokens]() { return tokens.next(); }, statistics);
+	}
+	return statistics;
+}
+
+ResultCache::ResultCache(size_t capacity, size_t shard_count) : shard_count_(1) {
+	if (capacity == 0 || shard_count == 0) {
+		throw std::invalid_argument("ResultCache: capacity and shard count must be positive");
+	}
+	while (shard_count_ < shard_count) {
+		shard_count_ *= 2;
+	}
+	shard_capacity_ = (capacity + shard_count_ - 1) / shard_count_;
+	std::random_device entropy;
+	for (uint64_t& word : hash_key_) {
+		word = (static_cast<uint64_t>(entropy()) << 32) ^ entropy();
+	}
+	shards_.reset(shard_count_);
+	for (size_t shard = 0; shard < shard_count_; ++shard) {
+		shards_[shard].entries.reserve(shard_capacity_);
+		shards_[shard].index.reserve(shard_capacity_);
+	}
+}
+
+uint64_t ResultCache::hashConfig(const GameConfig& config) {
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (size_t box = 0; box < config.size(); ++box) {
+		uint64_t weight;
+		std::memcpy(&weight, &config.getInitialWeights()[box], sizeof(weight));
+		for (uint64_t word : { static_cast<uint64_t>(config.getBoxTypes()[box]), weight }) {
+			hash = (hash ^ word) * 0x100000001b3ull;
+			hash ^= hash >> 29;
+		}
+	}
+	return hash;
+}
+
+static uint64_t rotateLeft(uint64_t value, int bits) {
+	return (value << bits) | (value >> (64 - bits));
+}
+
+//Finalizer of MurmurHash3
+static uint64_t mixBits(uint64_t value) {
+	value ^= value >> 33;
+	value *= 0xff51afd7ed558ccdull;
+	value ^= value >> 33;
+	value *= 0xc4ceb9fe1a85ec53ull;
+	value ^= value >> 33;
+	return value;
+}
+
+//Two lanes of multiply-rotate rounds over pairs of tokens, which the finalization mixes into each other. The lanes start from
+//the secret key of the cache, which makes colliding keys hard to find but not impossible, entries are checked on a hit.
+ResultKey ResultCache::hashGame(const uint32_t* first, const uint32_t* last, uint64_t config_hash) const {
+	const uint64_t k1 = 0x87c37b91114253d5ull, k2 = 0x4cf5ad432745937full;
+	uint64_t low = mixBits(config_hash ^ hash_key_[0]);
+	uint64_t high = mixBits(rotateLeft(config_hash, 32) ^ hash_key_[1]);
+	const uint32_t* token = first;
+	for (; last - token >= 4; token += 4) {
+		uint64_t words[2];
+		std::memcpy(words, token, sizeof(words));
+		low = rotateLeft((low ^ words[0]) * k1, 31) * k2;
+		high = rotateLeft((high ^ words[1]) * k2, 33) * k1;
+	}
+	for (; token != last; ++token) {
+		low = rotateLeft((low ^ *token) * k1, 31) * k2;
+	}
+	uint64_t count = static_cast<uint64_t>(last - first);
+	low ^= count;
+	high ^= count * k1;
+	low += high;
+	high += low;
+	low = mixBits(low);
+	high = mixBits(high);
+	low += high;
+	high += low;
+	return ResultKey{ low, high };
+}
+
+bool ResultCache::lookup(const ResultKey& key, const uint32_t* first, const uint32_t* last, uint64_t config_hash,
+	std::pair<double, double>& scores) {
+	Shard& shard = getShard(key);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	auto found = shard.index.find(key);
+	if (found == shard.index.end() || !shard.entries[found->second].isOf(first, last, config_hash)) {
+		++shard.misses;
+		ASAPHUS_INSTRUMENT(++Instrumentation::threadCounters().cache_misses);
+		return false;
+	}
+	Entry& entry = shard.entries[found->second];
+	entry.referenced = true;
+	scores = entry.scores;
+	++shard.hits;
+	ASAPHUS_INSTRUMENT(++Instrumentation::threadCounters().cache_hits);
+	return true;
+}
+
+void ResultCache::insert(const ResultKey& key, const uint32_t* first, const uint32_t* last, uint64_t config_hash,
+	const std::pair<double, double>& scores) {
+	Shard& shard = getShard(key);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	auto found = shard.index.find(key);
+	size_t slot;
+	if (found != shard.index.end()) {
+		slot = found->second; //the same game or one colliding with it, the later one is kept
+	}
+	else if (shard.entries.size() < shard_capacity_) {
+		slot = shard.entries.size();
+		shard.index.emplace(key, slot);
+		shard.entries.push_back(Entry{ key, 0, {}, {}, false });
+	}
+	else {
+		//Entries hit since the hand last passed them get another round
+		while (shard.entries[shard.hand].referenced) {
+			shard.entries[shard.hand].referenced = false;
+			shard.hand = (shard.hand + 1) % shard_capacity_;
+		}
+		slot = shard.hand;
+		shard.index.erase(shard.entries[slot].key);
+		shard.index.emplace(key, slot);
+		shard.entries[slot].referenced = false;
+		shard.hand = (shard.hand + 1) % shard_capacity_;
+		++shard.evictions;
+	}
+	Entry& entry = shard.entries[slot];
+	entry.key = key;
+	entry.config_hash = config_hash;
+	entry.tokens.assign(first, last);
+	entry.scores = scores;
+}
+
+std::pair<double, double> ResultCache::play(const uint32_t* first, const uint32_t* last, const GameConfig& config) {
+	uint64_t config_hash = hashConfig(config);
+	ResultKey key = hashGame(first, last, config_hash);
+	std::pair<double, double> scores;
+	if (lookup(key, first, last, config_hash, scores)) {
+		return scores;
+	}
+	if (config.isStandard()) {
+		StandardStaticGame game;
+		scores = game.play(first, last);
+	}
+	else {
+		GameArena::Scope scope(GameArena::threadLocal());
+		ArenaBoxSet boxes(config);
+		scores = boxes.play(first, last);
+	}
+	insert(key, first, last, config_hash, scores);
+	return scores;
+}
+
+ResultCache::Statistics ResultCache::getStatistics() const {
+	Statistics statistics;
+	for (size_t index = 0; index < shard_count_; ++index) {
+		const Shard& shard = shards_[index];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		statistics.hits += shard.hits;
+		statistics.misses += shard.misses;
+		statistics.evictions += shard.evictions;
+		statistics.size += shard.entries.size();
+	}
+	return statistics;
+}
+
+void ResultCache::clear() {
+	for (size_t index = 0; index < shard_count_; ++index) {
+		Shard& shard = shards_[index];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		shard.index.clear();
+		shard.entries.clear();
+		shard.hand = 0;
+	}
+}
+
+double TieSearch::SearchBox::absorb(double token) {
+	weight += token;
+	if (type == BoxType::GREEN) {
+		window.absorb(token);
+		return window.score();
+	}
+	range.absorb(token);
+	return range.score();
+}
+
+TieSearch::TieSearch(const GameConfig& config, size_t thread_count)
+	: key_width_(1), thread_count_(thread_count != 0 ? thread_count : std::max(1u, std::thread::hardware_concurrency())) {
+	if (config.size() == 0) {
+		throw std::invalid_argument("TieSearch: a game needs at least one box");
+	}
+	for (size_t box = 0; box < config.size(); ++box) {
+		initial_.push_back(SearchBox{ config.getInitialWeights()[box], config.getBoxTypes()[box], GreenWindow(), BlueRange() });
+		key_width_ += config.getBoxTypes()[box] == BoxType::GREEN ? green_key_width : blue_key_width;
+	}
+}
+
+//Green windows holding the same weights in the same order are one state, whichever slot is written next. Unused window
+//weights are zero.
+TieSearch::Key TieSearch::makeKey(Table& table, const State& state, size_t turn) {
+	Key key{ 0xcbf29ce484222325ull, table.words.size() };
+	auto append = [&](uint64_t word) {
+		table.words.push_back(word);
+		key.hash = (key.hash ^ word) * 0x100000001b3ull;
+		key.hash ^= key.hash >> 29;
+	};
+	auto bits = [](double value) {
+		uint64_t word;
+		std::memcpy(&word, &value, sizeof(word));
+		return word;
+	};
+	append(turn);
+	for (const SearchBox& box : state) {
+		append(bits(box.weight));
+		if (box.type == BoxType::GREEN) {
+			append(box.window.count);
+			uint32_t slot = (box.window.count < 3) ? 0 : box.window.next;
+			for (uint32_t i = 0; i < 3; ++i, slot = (slot == 2) ? 0 : slot + 1) {
+				append(i < box.window.count ? bits(box.window.weights[slot]) : 0);
+			}
+		}
+		else {
+			append(box.range.count);
+			append(bits(box.range.front));
+			append(bits(box.range.back));
+		}
+	}
+	return key;
+}
+
+//Boxes tied for the smallest weight, first_box first and then by descending score of absorbing token
+std::vector<uint32_t> TieSearch::orderMoves(const State& state, uint32_t token, uint32_t first_box) {
+	double min_weight = std::numeric_limits<double>::infinity();
+	for (const SearchBox& box : state) {
+		min_weight = std::min(min_weight, box.weight);
+	}
+	std::vector<std::pair<double, uint32_t>> moves;
+	for (uint32_t box = 0; box < state.size(); ++box) {
+		if (state[box].weight == min_weight) {
+			SearchBox child = state[box];
+			double score = child.absorb(token);
+			moves.emplace_back(box == first_box ? std::numeric_limits<double>::infinity() : score, box);
+		}
+	}
+	std::stable_sort(moves.begin(), moves.end(), [](const std::pair<double, uint32_t>& lhs, const std::pair<double, uint32_t>& rhs) {
+		return lhs.first > rhs.first;
+		});
+	std::vector<uint32_t> ordered;
+	for (const auto& move : moves) {
+		ordered.push_back(move.second);
+	}
+	return ordered;
+}
+
+uint32_t TieSearch::tableMove(Table& table, const State& state, size_t turn) {
+	Key key = makeKey(table, state, turn);
+	auto found = table.entries.find(key);
+	table.words.resize(key.offset);
+	return found == table.entries.end() ? no_box : found->second.best_box;
+}
+
+//Best score difference the player to move can reach from turn on, within [alpha, beta]
+double TieSearch::negamax(Table& table, const State& state, const uint32_t* tokens, size_t count, size_t turn, double alpha, double beta) {
+	++table.nodes;
+	if (turn == count) {
+		return 0.0;
+	}
+	//A new position keeps its words in the pool for the entry stored below
+	Key key = makeKey(table, state, turn);
+	uint32_t first_box = no_box;
+	auto found = table.entries.find(key);
+	if (found != table.entries.end()) {
+		table.words.resize(key.offset);
+		key = found->first;
+		const Entry& entry = found->second;
+		if (entry.bound == Bound::EXACT || (entry.bound == Bound::LOWER && entry.value >= beta) || (entry.bound == Bound::UPPER && entry.value <= alpha)) {
+			return entry.value;
+		}
+		first_box = entry.best_box;
+	}
+
+	const double original_alpha = alpha;
+	double best = -std::numeric_limits<double>::infinity();
+	uint32_t best_box = no_box;
+	for (uint32_t box : orderMoves(state, tokens[turn], first_box)) {
+		State child = state;
+		double score = child[box].absorb(tokens[turn]);
+		double value = score - negamax(table, child, tokens, count, turn + 1, score - beta, score - alpha);
+		if (value > best) {
+			best = value;
+			best_box = box;
+		}
+		alpha = std::max(alpha, best);
+		if (alpha >= beta) {
+			break;
+		}
+	}
+	Bound bound = (best <= original_alpha) ? Bound::UPPER : (best >= beta) ? Bound::LOWER : Bound::EXACT;
+	table.entries[key] = Entry{ best, bound, best_box };
+	return best;
+}
+
+//First of moves[first_move], moves[first_move + move_stride], ... reaching the best score difference, and that difference
+std::pair<uint32_t, double> TieSearch::bestMove(Table& table, const State& state, const uint32_t* tokens, size_t count, size_t turn,
+	const std::vector<uint32_t>& moves, size_t first_move, size_t move_stride) {
+	std::pair<uint32_t, double> best(no_box, -std::numeric_limits<double>::infinity());
+	for (size_t move = first_move; move < moves.size(); move += move_stride) {
+		State child = state;
+		double score = child[moves[move]].absorb(tokens[turn]);
+		double value = score - negamax(table, child, tokens, count, turn + 1, -std::numeric_limits<double>::infinity(), score - best.second);
+		if (value > best.second) {
+			best = std::make_pair(moves[move], value);
+		}
+	}
+	return best;
+}
+
+TieSearchResult TieSearch::search(const uint32_t* tokens, size_t count) const {
+	TieSearchResult result;
+	double score_A = 0.0, score_B = 0.0;
+	State state = initial_;
+	std::unique_ptr<Table> table(new Table(key_width_));
+	bool split = false;
+	for (size_t turn = 0; turn < count; ++turn) {
+		std::vector<uint32_t> moves = orderMoves(state, tokens[turn], tableMove(*table, state, turn));
+		uint32_t box = moves.front();
+		if (moves.size() > 1 && !split && thread_count_ > 1) {
+			//tasks take every task_count-th move, the best move of the earliest task wins ties as it does searching sequentially
+			size_t task_count = std::min(thread_count_, moves.size());
+			std::vector<std::unique_ptr<Table>> tables;
+			std::vector<std::future<std::pair<uint32_t, double>>> tasks;
+			for (size_t task = 0; task < task_count; ++task) {
+				tables.emplace_back(new Table(key_width_));
+			}
+			for (size_t task = 0; task < task_count; ++task) {
+				tasks.push_back(std::async(std::launch::async, [&, task]() {
+					return bestMove(*tables[task], state, tokens, count, turn, moves, task, task_count);
+					}));
+			}
+			std::vector<std::pair<uint32_t, double>> best_moves;
+			for (auto& task : tasks) {
+				best_moves.push_back(task.get());
+			}
+			size_t best_task = 0;
+			for (size_t task = 0; task < task_count; ++task) {
+				result.nodes += tables[task]->nodes;
+				const auto& lhs = best_moves[task];
+				const auto& rhs = best_moves[best_task];
+				if (lhs.second > rhs.second || (lhs.second == rhs.second &&
+					std::find(moves.begin(), moves.end(), lhs.first) < std::find(moves.begin(), moves.end(), rhs.first))) {
+					best_task = task;
+				}
+			}
+			box = best_moves[best_task].first;
+			table = std::move(tables[best_task]);
+			table->nodes = 0;
+			split = true;
+		}
+		else if (moves.size() > 1) {
+			box = bestMove(*table, state, tokens, count, turn, moves, 0, 1).first;
+		}
+		double score = state[box].absorb(tokens[turn]);
+		(turn % 2 == 0 ? score_A : score_B) += score;
+		result.boxes.push_back(box);
+	}
+	result.scores = std::make_pair(score_A, score_B);
+	result.nodes += table->nodes;
+	return result;
+}
+
+ExactGame::ExactGame(const GameConfig& config)
+	: box_count_(config.size()), initial_keys_(config.size()), box_types_(config.getBoxTypes()), state_indices_(config.size()) {
+	const auto& initial_weights = config.getInitialWeights();
+	if (config.size() == 0) {
+		throw std::invalid_argument("ExactGame: a game needs at least one box");
+	}
+	std::vector<size_t> order(config.size());
+	std::iota(order.begin(), order.end(), 0);
+	auto fraction = [&](size_t box) { return initial_weights[box] - std::floor(initial_weights[box]); };
+	std::stable_sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) { return fraction(lhs) < fraction(rhs); });
+
+	size_t green_count = 0, blue_count = 0;
+	for (size_t rank = 0; rank < order.size(); ++rank) {
+		size_t box = order[rank];
+		double integral = std::floor(initial_weights[box]);
+		if (!(integral >= 0.0 && integral < 9007199254740992.0 / box_count_)) {
+			throw std::invalid_argument("ExactGame: initial weights must be non-negative and below 2^53 / box count");
+		}
+		initial_keys_[box] = static_cast<uint64_t>(integral) * box_count_ + rank;
+	}
+	for (size_t box = 0; box < box_types_.size(); ++box) {
+		state_indices_[box] = static_cast<uint32_t>(box_types_[box] == BoxType::GREEN ? green_count++ : blue_count++);
+	}
+	green_sums_.resize(green_count);
+	blue_ranges_.resize(blue_count);
+	reset();
+}
+
+void ExactGame::reset() {
+	keys_ = initial_keys_;
+	std::fill(green_sums_.begin(), green_sums_.end(), GreenSums());
+	std::fill(blue_ranges_.begin(), blue_ranges_.end(), BasicBlueRange<uint32_t>());
+	scores_ = ExactScores();
+	is_player_A_turn_ = true;
+}
+
+void playBatchExact(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, ExactScores* scores,
+	const GameConfig& config) {
+	ExactGame game_state(config);
+	for (size_t game = 0; game < game_count; ++game) {
+		game_state.reset();
+		scores[game] = game_state.play(tokens + offsets[game], tokens + offsets[game + 1]);
+	}
+}
+
+std::vector<TokenRun> encodeRuns(const std::vector<uint32_t>& tokens) {
+	std::vector<TokenRun> runs;
+	for (uint32_t token : tokens) {
+		if (runs.empty() || runs.back().token != token) {
+			TokenRun run;
+			run.token = token;
+			runs.push_back(run);
+		}
+		++runs.back().count;
+	}
+	return runs;
+}
+
+std::vector<TokenRun> encodeProgressions(const std::vector<uint32_t>& tokens) {
+	std::vector<TokenRun> runs;
+	for (size_t first = 0; first < tokens.size();) {
+		int64_t step = first + 1 < tokens.size() ? static_cast<int64_t>(tokens[first + 1]) - tokens[first] : 0;
+		size_t last = first + 1;
+		while (last < tokens.size() && static_cast<int64_t>(tokens[last]) - tokens[last - 1] == step) {
+			++last;
+		}
+		//Two tokens are no progression, the second one may start one
+		if (step != 0 && last - first < 3) {
+			last = first + 1;
+			step = 0;
+		}
+		TokenRun run;
+		run.token = tokens[first];
+		run.count = last - first;
+		run.step = step;
+		runs.push_back(run);
+		first = last;
+	}
+	return runs;
+}
+
+//Largest power of two value is an integral multiple of, 0 for 0
+static double granularity(double value) {
+	if (value == 0.0) {
+		return 0.0;
+	}
+	int exponent;
+	double mantissa = std::frexp(std::fabs(value), &exponent);
+	uint64_t bits = static_cast<uint64_t>(std::ldexp(mantissa, 53));
+	int zeros = 0;
+	while ((bits & 1) == 0) {
+		bits >>= 1;
+		++zeros;
+	}
+	return std::ldexp(1.0, exponent - 53 + zeros);
+}
+
+//Start value followed by the same addends period after period, counted in units of the largest power of two all of them are
+//multiples of. Partial sums below 2^53 units are doubles, so while they stay there adding one addend after the other never rounds
+//and the sum after any number of periods is known in closed form.
+class ExactSeries {
+public:
+	ExactSeries(double start, const std::vector<double>& addends) {
+		unit_ = granularity(start);
+		for (double addend : addends) {
+			double unit = granularity(addend);
+			if (unit != 0.0 && (unit_ == 0.0 || unit < unit_)) {
+				unit_ = unit;
+			}
+		}
+		is_exact_ = std::isfinite(start) && toUnits(start, start_);
+		for (double addend : addends) {
+			int64_t units = 0;
+			is_exact_ = is_exact_ && std::isfinite(addend) && toUnits(addend, units);
+			step_ += units;
+			magnitude_ += units < 0 ? -units : units;
+		}
+	}
+
+	//Largest number of periods after which every partial sum is still exact
+	uint64_t getMaxPeriods() const {
+		int64_t start = start_ < 0 ? -start_ : start_;
+		if (!is_exact_ || start >= limit) {
+			return 0;
+		}
+		return magnitude_ == 0 ? std::numeric_limits<uint64_t>::max() : static_cast<uint64_t>((limit - 1 - start) / magnitude_);
+	}
+
+	//Sum after periods periods, periods must not exceed getMaxPeriods()
+	double advance(uint64_t periods) const {
+		return static_cast<double>(start_ + static_cast<int64_t>(periods) * step_) * unit_;
+	}
+
+private:
+	static const int64_t limit = static_cast<int64_t>(1) << 53;
+
+	bool toUnits(double value, int64_t& units) const {
+		double scaled = unit_ == 0.0 ? 0.0 : value / unit_;
+		if (std::fabs(scaled) >= static_cast<double>(limit)) {
+			return false;
+		}
+		units = static_cast<int64_t>(scaled);
+		return true;
+	}
+
+	double unit_ = 0.0;
+	int64_t start_ = 0;
+	int64_t step_ = 0;
+	int64_t magnitude_ = 0; //sum of the absolute addends, bounds every partial sum of a period
+	bool is_exact_ = false;
+};
+
+RunLengthGame::RunLengthGame(const GameConfig& config)
+	: initial_weights_(config.getInitialWeights()), box_types_(config.getBoxTypes()), weights_(config.size()),
+	green_windows_(config.size()), blue_ranges_(config.size()) {
+	if (config.size() == 0) {
+		throw std::invalid_argument("RunLengthGame: a game needs at least one box");
+	}
+	reset();
+}
+
+void RunLengthGame::reset() {
+	weights_ = initial_weights_;
+	std::fill(green_windows_.begin(), green_windows_.end(), GreenWindow());
+	std::fill(blue_ranges_.begin(), blue_ranges_.end(), BlueRange());
+	score_A_ = 0.0;
+	score_B_ = 0.0;
+	is_player_A_turn_ = true;
+	skipped_turns_ = 0;
+}
+
+void RunLengthGame::takeTurn(double weight) {
+	size_t box = 0;
+	for (size_t other = 1; other < weights_.size(); ++other) {
+		if (weights_[other] < weights_[box]) {
+			box = other;
+		}
+	}
+	if (box_types_[box] == BoxType::GREEN) {
+		green_windows_[box].absorb(weight);
+	}
+	else {
+		blue_ranges_[box].absorb(weight);
+	}
+	weights_[box] += weight;
+	(is_player_A_turn_ ? score_A_ : score_B_) += getScore(box);
+	is_player_A_turn_ = !is_player_A_turn_;
+}
+
+double RunLengthGame::getScore(size_t box) const {
+	return box_types_[box] == BoxType::GREEN ? green_windows_[box].score() : blue_ranges_[box].score();
+}
+
+bool RunLengthGame::isSteady(size_t box, double weight) const {
+	if (box_types_[box] == BoxType::GREEN) {
+		const GreenWindow& window = green_windows_[box];
+		return window.count == 3 && window.weights[0] == weight && window.weights[1] == weight && window.weights[2] == weight;
+	}
+	const BlueRange& range = blue_ranges_[box];
+	return range.count == 4 && range.front <= weight && weight <= range.back;
+}
+
+uint64_t RunLengthGame::skipPeriods(double weight, uint64_t turn_count) {
+	//Boxes visited by the next turns while all of them are steady, which only takes their weights to replay
+	const size_t box_count = weights_.size();
+	std::vector<double> weights = weights_;
+	std::vector<size_t> visits;
+	for (size_t turn = 0; turn < 2 * box_count && turn < turn_count; ++turn) {
+		size_t box = 0;
+		for (size_t other = 1; other < box_count; ++other) {
+			if (weights[other] < weights[box]) {
+				box = other;
+			}
+		}
+		if (!isSteady(box, weight)) {
+			break;
+		}
+		visits.push_back(box);
+		weights[box] += weight;
+	}
+
+	//An even number of turns visiting each of its boxes equally often is a period: it leaves the scores of the boxes as they
+	//are and adds the same to all visited weights, so the next period compares weights the same way and visits the same boxes,
+	//as long as the boxes it does not visit remain heavier
+	std::vector<uint64_t> visit_counts(box_count);
+	for (size_t period = 2; period <= visits.size(); period += 2) {
+		std::fill(visit_counts.begin(), visit_counts.end(), 0);
+		for (size_t turn = 0; turn < period; ++turn) {
+			++visit_counts[visits[turn]];
+		}
+		uint64_t repeats = visit_counts[visits[0]];
+		bool is_uniform = true;
+		double unvisited_weight = std::numeric_limits<double>::infinity();
+		for (size_t box = 0; box < box_count; ++box) {
+			if (visit_counts[box] == 0) {
+				unvisited_weight = std::min(unvisited_weight, weights_[box]);
+			}
+			else {
+				is_uniform = is_uniform && visit_counts[box] == repeats;
+			}
+		}
+		if (!is_uniform) {
+			continue;
+		}
+
+		uint64_t periods = turn_count / period;
+		std::vector<ExactSeries> box_series;
+		std::vector<size_t> visited_boxes;
+		for (size_t box = 0; box < box_count; ++box) {
+			if (visit_counts[box] != 0) {
+				box_series.emplace_back(weights_[box], std::vector<double>(repeats, weight));
+				visited_boxes.push_back(box);
+				periods = std::min(periods, box_series.back().getMaxPeriods());
+			}
+		}
+		std::vector<double> scores_A, scores_B;
+		for (size_t turn = 0; turn < period; ++turn) {
+			((turn % 2 == 0) == is_player_A_turn_ ? scores_A : scores_B).push_back(getScore(visits[turn]));
+		}
+		ExactSeries series_A(score_A_, scores_A), series_B(score_B_, scores_B);
+		periods = std::min(periods, std::min(series_A.getMaxPeriods(), series_B.getMaxPeriods()));
+
+		//Without added weight the unvisited boxes cannot become lighter than the visited ones, otherwise every visited box
+		//is lighter than it will weigh after the skipped periods
+		auto stayLighter = [&](uint64_t count) {
+			for (const ExactSeries& series : box_series) {
+				if (!(series.advance(count) <= unvisited_weight)) {
+					return false;
+				}
+			}
+			return true;
+		};
+		if (weight != 0.0 && periods > 0 && !stayLighter(periods)) {
+			uint64_t lighter = 0, heavier = periods;
+			while (heavier - lighter > 1) {
+				uint64_t middle = lighter + (heavier - lighter) / 2;
+				(stayLighter(middle) ? lighter : heavier) = middle;
+			}
+			periods = lighter;
+		}
+		if (periods == 0) {
+			continue;
+		}
+
+		for (size_t i = 0; i < visited_boxes.size(); ++i) {
+			weights_[visited_boxes[i]] = box_series[i].advance(periods);
+		}
+		score_A_ = series_A.advance(periods);
+		score_B_ = series_B.advance(periods);
+		skipped_turns_ += periods * period;
+		return periods * period;
+	}
+	return 0;
+}
+
+//Integer sums of the scores of skipped rotations, exact where a 128-bit integer is available and in doubles otherwise
+using SeriesSum = std::conditional<sizeof(ExactInt) >= 16, ExactInt, double>::type;
+
+//Adds the sums of x * x and of x over the count terms x = first, first + difference, ..., all of them non-negative
+//integers below 2^34
+static void addProgressionSums(int64_t first, int64_t difference, uint64_t count, SeriesSum& squares, SeriesSum& values) {
+	if (difference < 0) {
+		first += static_cast<int64_t>(count - 1) * difference;
+		difference = -difference;
+	}
+	const SeriesSum start = static_cast<SeriesSum>(first), step = static_cast<SeriesSum>(difference), n = static_cast<SeriesSum>(count);
+	const SeriesSum index_sum = n * (n - 1) / 2, square_index_sum = (n - 1) * n * (2 * n - 1) / 6;
+	squares += n * start * start + 2 * start * step * index_sum + step * step * square_index_sum;
+	values += n * start + step * index_sum;
+}
+
+//Weight after absorbing the count tokens first, first + difference, ... one after the other, rounded as adding them in
+//doubles rounds. Below 2^51 the integral part of every sum is exact, sums within one binade are exact as well, and a sum
+//entering a higher binade rounds its fractional part to the spacing of that binade.
+static double advanceWeight(double weight, int64_t first, int64_t difference, uint64_t count) {
+	const int64_t base = static_cast<int64_t>(std::floor(weight));
+	double fraction = weight - static_cast<double>(base);
+	auto integral = [&](uint64_t absorbed) {
+		int64_t n = static_cast<int64_t>(absorbed);
+		return base + n * first + difference * (n * (n - 1) / 2);
+	};
+	int64_t carry = 0;
+	for (uint64_t absorbed = 0; fraction != 0.0;) {
+		//The first sum of a higher binade
+		int64_t current = integral(absorbed);
+		int exponent = 0;
+		std::frexp(static_cast<double>(current), &exponent);
+		int64_t binade_end = current < 1 ? 1 : static_cast<int64_t>(1) << exponent;
+		if (integral(count) < binade_end) {
+			break;
+		}
+		uint64_t below = absorbed, above = count;
+		while (above - below > 1) {
+			uint64_t middle = below + (above - below) / 2;
+			(integral(middle) < binade_end ? below : above) = middle;
+		}
+		absorbed = above;
+		std::frexp(static_cast<double>(integral(absorbed)), &exponent);
+		const double spacing = std::ldexp(1.0, exponent - 53);
+		fraction = std::nearbyint(fraction / spacing) * spacing;
+		if (fraction == 1.0) {
+			carry = 1;
+			fraction = 0.0;
+		}
+	}
+	return static_cast<double>(integral(count) + carry) + fraction;
+}
+
+uint64_t RunLengthGame::skipRotations(int64_t token, int64_t step, uint64_t turn_count) {
+	//Weights closer than the margin might be ordered differently by the rounding of play() than by exact sums
+	const double margin = 4.0, weight_limit = std::ldexp(1.0, 51);
+	const size_t box_count = weights_.size();
+	std::vector<size_t> order(box_count);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [this](size_t lhs, size_t rhs) { return weights_[lhs] < weights_[rhs]; });
+	if (!(weights_[order[0]] >= 0.0)) {
+		return 0;
+	}
+	//Green boxes hold the two tokens of the previous rotations, blue ones get a new end with every token
+	auto isSettled = [&](size_t box, int64_t next_token, int64_t stride) {
+		if (box_types_[box] == BoxType::GREEN) {
+			const GreenWindow& window = green_windows_[box];
+			return window.count == 3 && window.weights[(window.next + 2) % 3] == static_cast<double>(next_token - stride) &&
+				window.weights[(window.next + 1) % 3] == static_cast<double>(next_token - 2 * stride);
+		}
+		const BlueRange& range = blue_ranges_[box];
+		return range.count == 4 && (step > 0 ? range.back < static_cast<double>(next_token) : range.front > static_cast<double>(next_token));
+	};
+
+	//Of the rotations over the lightest boxes, the one skipping the most turns is taken
+	size_t size = 0;
+	uint64_t periods = 0, turns = 0;
+	for (size_t candidate = 1; candidate <= box_count; ++candidate) {
+		const uint64_t period = candidate % 2 == 0 ? candidate : 2 * candidate; //turns, even so that every period starts with the same player
+		const uint64_t visits = period / candidate;                         //of every box in a period
+		const int64_t stride = static_cast<int64_t>(candidate) * step;       //between the tokens one box absorbs
+		if (turn_count < period) {
+			break;
+		}
+		//The weight box i of the rotation has at its visit in turn i is the one it had a rotation earlier plus the token of
+		//that turn, so the difference between consecutive visited weights grows by step every rotation
+		double min_difference = static_cast<double>(token) + weights_[order[0]] - weights_[order[candidate - 1]];
+		bool settled = true;
+		for (size_t rank = 0; rank < candidate; ++rank) {
+			if (rank + 1 < candidate) {
+				min_difference = std::min(min_difference, weights_[order[rank + 1]] - weights_[order[rank]]);
+			}
+			settled = settled && isSettled(order[rank], token + static_cast<int64_t>(rank) * step, stride);
+		}
+		if (!settled || !(min_difference >= margin)) {
+			continue;
+		}
+		uint64_t max_periods = turn_count / period;
+		if (step < 0) {
+			max_periods = std::min(max_periods, static_cast<uint64_t>((min_difference - margin) / static_cast<double>(-step)) / visits);
+		}
+
+		//Every visited box stays lighter than the other boxes until its last visit, and below the weight limit
+		const double unvisited = candidate < box_count ? weights_[order[candidate]] : std::numeric_limits<double>::infinity();
+		auto weightAfter = [&](size_t rank, uint64_t count) {
+			double n = static_cast<double>(count);
+			return weights_[order[rank]] + n * static_cast<double>(token + static_cast<int64_t>(rank) * step) + static_cast<double>(stride) * (n * (n - 1) / 2);
+		};
+		auto fits = [&](uint64_t candidate_periods) {
+			uint64_t count = candidate_periods * visits;
+			for (size_t rank = 0; rank < candidate; ++rank) {
+				if (!(weightAfter(rank, count - 1) + margin <= unvisited) || !(weightAfter(rank, count) < weight_limit)) {
+					return false;
+				}
+			}
+			return true;
+		};
+		if (max_periods == 0 || !fits(1)) {
+			continue;
+		}
+		uint64_t fitting = 1, too_many = max_periods + 1;
+		while (too_many - fitting > 1) {
+			uint64_t middle = fitting + (too_many - fitting) / 2;
+			(fits(middle) ? fitting : too_many) = middle;
+		}
+		if (fitting * period > turns) {
+			size = candidate;
+			periods = fitting;
+			turns = fitting * period;
+		}
+	}
+	if (turns == 0) {
+		return 0;
+	}
+
+	//Turn i of period q visits the box of rank i % size with token + (i + q * period) * step. A green box scores the square
+	//of the token it absorbed a rotation earlier, a blue one pairs the new token with the end of its range that stays.
+	const uint64_t period = turns / periods;
+	const int64_t stride = static_cast<int64_t>(size) * step;
+	SeriesSum sums[2] = { 0, 0 }; //of the player whose turn it is and of the other one
+	for (uint64_t turn = 0; turn < period; ++turn) {
+		const size_t box = order[turn % size];
+		const int64_t first = token + static_cast<int64_t>(turn) * step, difference = static_cast<int64_t>(period) * step;
+		SeriesSum squares = 0, values = 0;
+		SeriesSum& sum = sums[turn % 2];
+		if (box_types_[box] == BoxType::GREEN) {
+			addProgressionSums(first - stride, difference, periods, squares, values);
+			sum += squares;
+		}
+		else {
+			const BlueRange& range = blue_ranges_[box];
+			const int64_t kept = static_cast<int64_t>(step > 0 ? range.front : range.back);
+			const SeriesSum kept_sum = static_cast<SeriesSum>(periods) * static_cast<SeriesSum>(kept);
+			addProgressionSums(first + kept, difference, periods, squares, values);
+			//pairing(front + back) + back, with the new token as the back of a rising run and as the front of a falling one
+			sum += (squares + values) / 2 + (step > 0 ? values - kept_sum : kept_sum);
+		}
+	}
+	(is_player_A_turn_ ? score_A_ : score_B_) += static_cast<double>(sums[0]);
+	(is_player_A_turn_ ? score_B_ : score_A_) += static_cast<double>(sums[1]);
+
+	const uint64_t count = periods * (period / size);
+	for (size_t rank = 0; rank < size; ++rank) {
+		const size_t box = order[rank];
+		const int64_t first = token + static_cast<int64_t>(rank) * step;
+		weights_[box] = advanceWeight(weights_[box], first, stride, count);
+		for (uint64_t visit = count - std::min<uint64_t>(count, 3); visit < count; ++visit) {
+			double absorbed = static_cast<double>(first + static_cast<int64_t>(visit) * stride);
+			if (box_types_[box] == BoxType::GREEN) {
+				green_windows_[box].absorb(absorbed);
+			}
+			else {
+				blue_ranges_[box].absorb(absorbed);
+			}
+		}
+	}
+	skipped_turns_ += turns;
+	return turns;
+}
+
+void RunLengthGame::playRun(const TokenRun& run) {
+	if (run.count == 0) {
+		return;
+	}
+	if (run.step != 0) {
+		uint64_t step = run.step < 0 ? 0 - static_cast<uint64_t>(run.step) : static_cast<uint64_t>(run.step);
+		uint64_t headroom = run.step < 0 ? run.token : std::numeric_limits<uint32_t>::max() - run.token;
+		if (run.count - 1 > headroom / step) {
+			throw std::invalid_argument("RunLengthGame: tokens of a run must stay within 0 and 2^32 - 1");
+		}
+	}
+
+	//Probing for a period backs off while the run has not settled or rounds, so runs without one play barely slower
+	const uint64_t min_interval = 2 * weights_.size(), max_interval = 64 * min_interval;
+	uint64_t remaining = run.count, interval = min_interval;
+	int64_t token = run.token;
+	while (remaining > 0) {
+		uint64_t turns = std::min(remaining, interval);
+		for (uint64_t turn = 0; turn < turns; ++turn, token += run.step) {
+			takeTurn(static_cast<double>(token));
+		}
+		remaining -= turns;
+		if (remaining >= 2) {
+			uint64_t skipped = run.step == 0 ? skipPeriods(static_cast<double>(token), remaining) : skipRotations(token, run.step, remaining);
+			remaining -= skipped;
+			token += static_cast<int64_t>(skipped) * run.step;
+			interval = skipped > 0 ? min_interval : std::min(2 * interval, max_interval);
+		}
+	}
+}
+
+DeferredScoreGame::DeferredScoreGame(const GameConfig& config)
+	: initial_weights_(config.getInitialWeights()), box_types_(config.getBoxTypes()), state_indices_(config.size()) {
+	if (config.size() == 0) {
+		throw std::invalid_argument("DeferredScoreGame: a game needs at least one box");
+	}
+	size_t green_count = 0, blue_count = 0;
+	for (size_t box = 0; box < box_types_.size(); ++box) {
+		state_indices_[box] = static_cast<uint32_t>(box_types_[box] == BoxType::GREEN ? green_count++ : blue_count++);
+	}
+	green_windows_.resize(green_count);
+	blue_ranges_.resize(blue_count);
+	reset();
+}
+
+void DeferredScoreGame::reset() {
+	selector_.build(initial_weights_.data(), initial_weights_.size());
+	std::fill(green_windows_.begin(), green_windows_.end(), GreenWindow());
+	std::fill(blue_ranges_.begin(), blue_ranges_.end(), BlueRange());
+	scores_[0] = DeferredScores();
+	scores_[1] = DeferredScores();
+	is_player_A_turn_ = true;
+}
+
+Winner DeferredScoreGame::getWinner() const {
+	auto scores = getScores();
+	if (scores.first == scores.second) {
+		return Winner::NONE;
+	}
+	return scores.first > scores.second ? Winner::PLAYER_A : Winner::PLAYER_B;
+}
+
+//Kernels are contained in the library if their translation unit is built, or if this one is compiled for their instructions
+#if defined(ASAPHUS_AVX2_KERNEL) || defined(__AVX2__)
+#define ASAPHUS_HAS_AVX2_KERNEL 1
+#endif
+#if defined(ASAPHUS_AVX512_KERNEL) || defined(__AVX512F__)
+#define ASAPHUS_HAS_AVX512_KERNEL 1
+#endif
+
+template <typename Simd>
+static void playBatchLanesWith(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores) {
+	LaneBatchEngine<Simd> engine;
+	engine.playBatch(tokens, offsets, game_count, scores);
+}
+
+#if !defined(ASAPHUS_AVX2_KERNEL) && defined(__AVX2__)
+void playBatchLanesAvx2(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores) {
+	playBatchLanesWith<Avx2Lanes>(tokens, offsets, game_count, scores);
+}
+#endif
+
+#if !defined(ASAPHUS_AVX512_KERNEL) && defined(__AVX512F__)
+void playBatchLanesAvx512(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores) {
+	playBatchLanesWith<Avx512Lanes>(tokens, offsets, game_count, scores);
+}
+#endif
+
+const char* laneKernelName(LaneKernel kernel) {
+	switch (kernel) {
+	case LaneKernel::SCALAR: return "scalar";
+	case LaneKernel::AVX2: return "avx2";
+	default: return "avx512";
+	}
+}
+
+//Kernels compiled into this translation unit run on every CPU the library runs on
+bool isLaneKernelSupported(LaneKernel kernel) {
+	switch (kernel) {
+	case LaneKernel::SCALAR:
+		return true;
+	case LaneKernel::AVX2:
+#if defined(__AVX2__)
+		return true;
+#elif defined(ASAPHUS_HAS_AVX2_KERNEL) && (defined(__GNUC__) || defined(__clang__))
+		return __builtin_cpu_supports("avx2");
+#else
+		return false;
+#endif
+	default:
+#if defined(__AVX512F__)
+		return true;
+#elif defined(ASAPHUS_HAS_AVX512_KERNEL) && (defined(__GNUC__) || defined(__clang__))
+		return __builtin_cpu_supports("avx512f");
+#else
+		return false;
+#endif
+	}
+}
+
+LaneKernel selectLaneKernel() {
+	static const LaneKernel selected = []() {
+		const char* requested = std::getenv("ASAPHUS_LANE_KERNEL");
+		for (LaneKernel kernel : { LaneKernel::SCALAR, LaneKernel::AVX2, LaneKernel::AVX512 }) {
+			if (requested != nullptr && std::strcmp(requested, laneKernelName(kernel)) == 0 && isLaneKernelSupported(kernel)) {
+				return kernel;
+			}
+		}
+		for (LaneKernel kernel : { LaneKernel::AVX512, LaneKernel::AVX2 }) {
+			if (isLaneKernelSupported(kernel)) {
+				return kernel;
+			}
+		}
+		return LaneKernel::SCALAR;
+	}();
+	return selected;
+}
+
+void playBatchLanes(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores) {
+	playBatchLanes(tokens, offsets, game_count, scores, selectLaneKernel());
+}
+
+void playBatchLanes(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores, LaneKernel kernel) {
+	if (!isLaneKernelSupported(kernel)) {
+		throw std::invalid_argument(std::string("playBatchLanes: the ") + laneKernelName(kernel) + " kernel is not supported");
+	}
+	switch (kernel) {
+#if defined(ASAPHUS_HAS_AVX512_KERNEL)
+	case LaneKernel::AVX512:
+		playBatchLanesAvx512(tokens, offsets, game_count, scores);
+		break;
+#endif
+#if defined(ASAPHUS_HAS_AVX2_KERNEL)
+	case LaneKernel::AVX2:
+		playBatchLanesAvx2(tokens, offsets, game_count, scores);
+		break;
+#endif
+	default:
+		playBatchLanesWith<ScalarLanes>(tokens, offsets, game_count, scores);
+		break;
+	}
+}
+
+const char* batchBackendName(BatchBackend backend) {
+	return backend == BatchBackend::CUDA ? "cuda" : "cpu";
+}
+
+bool isBatchBackendAvailable(BatchBackend backend) {
+	if (backend == BatchBackend::CPU) {
+		return true;
+	}
+#ifdef ASAPHUS_CUDA_BACKEND
+	static const bool has_device = isCudaDeviceAvailable();
+	return has_device;
+#else
+	return false;
+#endif
+}
+
+BatchBackend selectBatchBackend() {
+	static const BatchBackend selected = []() {
+		const char* requested = std::getenv("ASAPHUS_BATCH_BACKEND");
+		for (BatchBackend backend : { BatchBackend::CPU, BatchBackend::CUDA }) {
+			if (requested != nullptr && std::strcmp(requested, batchBackendName(backend)) == 0 && isBatchBackendAvailable(backend)) {
+				return backend;
+			}
+		}
+		return isBatchBackendAvailable(BatchBackend::CUDA) ? BatchBackend::CUDA : BatchBackend::CPU;
+	}();
+	return selected;
+}
+
+void playBatch(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores,
+	BatchBackend backend, const GameConfig& config) {
+	if (!isBatchBackendAvailable(backend)) {
+		throw std::invalid_argument(std::string("playBatch: the ") + batchBackendName(backend) + " backend is not available");
+	}
+	if (backend == BatchBackend::CPU) {
+		playBatch(tokens, offsets, game_count, scores, config);
+		return;
+	}
+	if (!config.isStandard()) {
+		throw std::invalid_argument("playBatch: the cuda backend plays the standard configuration only");
+	}
+#ifdef ASAPHUS_CUDA_BACKEND
+	playBatchCuda(tokens, offsets, game_count, scores);
+#endif
+}
+
+bool ParallelBatchRunner::claimGame(GameRange& range, size_t& game) {
+	std::lock_guard<std::mutex> lock(range.mutex);
+	if (range.begin == range.end) {
+		return false;
+	}
+	game = range.begin++;
+	return true;
+}
+
+bool ParallelBatchRunner::stealGames(std::vector<GameRange>& ranges, size_t worker) {
+	for (size_t offset = 1; offset < ranges.size(); ++offset) {
+		GameRange& victim = ranges[(worker + offset) % ranges.size()];
+		size_t begin, end;
+		{
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (victim.begin == victim.end) {
+				continue;
+			}
+			begin = victim.begin + (victim.end - victim.begin) / 2;
+			end = victim.end;
+			victim.end = begin;
+		}
+		//only one lock is held at a time, thieves stealing from each other cannot deadlock
+		std::lock_guard<std::mutex> lock(ranges[worker].mutex);
+		ranges[worker].begin = begin;
+		ranges[worker].end = end;
+		return true;
+	}
+	return false;
+}
+
+void writeTokenCorpus(const std::string& path, const std::vector<uint32_t>& tokens, const std::vector<uint64_t>& offsets) {
+	if (!isLittleEndianHost()) {
+		throw std::runtime_error("writeTokenCorpus: only little-endian hosts are supported");
+	}
+	checkBatchOffsets(tokens.size(), offsets);
+	if (offsets.front() != 0 || offsets.back() != tokens.size()) {
+		throw std::invalid_argument("writeTokenCorpus: offsets must cover the whole token buffer");
+	}
+	TokenCorpusHeader header = { { 'A', 'S', 'A', 'P', 'H', 'T', 'O', 'K' }, 1, sizeof(TokenCorpusHeader), offsets.size() - 1, tokens.size() };
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(offsets.data()), static_cast<std::streamsize>(offsets.size() * sizeof(uint64_t)));
+	file.write(reinterpret_cast<const char*>(tokens.data()), static_cast<std::streamsize>(tokens.size() * sizeof(uint32_t)));
+	if (!file) {
+		throw std::runtime_error("writeTokenCorpus: cannot write " + path);
+	}
+}
+
+TokenCorpus::TokenCorpus(const std::string& path) {
+	if (!isLittleEndianHost()) {
+		throw std::runtime_error("TokenCorpus: only little-endian hosts can map a corpus without conversion");
+	}
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	LARGE_INTEGER file_size;
+	if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &file_size)) {
+		if (file != INVALID_HANDLE_VALUE) {
+			CloseHandle(file);
+		}
+		throw std::runtime_error("TokenCorpus: cannot open " + path);
+	}
+	size_ = static_cast<size_t>(file_size.QuadPart);
+	HANDLE mapping = size_ != 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+	data_ = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (mapping != nullptr) {
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+#else
+	int file = ::open(path.c_str(), O_RDONLY);
+	struct stat file_status;
+	if (file < 0 || ::fstat(file, &file_status) != 0) {
+		if (file >= 0) {
+			::close(file);
+		}
+		throw std::runtime_error("TokenCorpus: cannot open " + path);
+	}
+	size_ = static_cast<size_t>(file_status.st_size);
+	void* data = size_ != 0 ? ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED;
+	data_ = data != MAP_FAILED ? data : nullptr;
+	::close(file);
+#endif
+	if (data_ == nullptr || size_ < sizeof(TokenCorpusHeader)) {
+		unmap();
+		throw std::runtime_error("TokenCorpus: " + path + " is not a token corpus");
+	}
+
+	header_ = static_cast<const TokenCorpusHeader*>(data_);
+	uint64_t game_count = header_->game_count, token_count = header_->token_count;
+	uint64_t max_count = (size_ - sizeof(TokenCorpusHeader)) / sizeof(uint32_t);
+	bool valid = std::memcmp(header_->magic, "ASAPHTOK", 8) == 0 && header_->version == 1 && header_->header_size == sizeof(TokenCorpusHeader)
+		&& game_count < max_count / 2 && token_count <= max_count
+		&& sizeof(TokenCorpusHeader) + (game_count + 1) * sizeof(uint64_t) + token_count * sizeof(uint32_t) == size_;
+	if (!valid) {
+		unmap();
+		throw std::runtime_error("TokenCorpus: " + path + " is not a token corpus");
+	}
+	offsets_ = reinterpret_cast<const uint64_t*>(static_cast<const char*>(data_) + sizeof(TokenCorpusHeader));
+	tokens_ = reinterpret_cast<const uint32_t*>(offsets_ + game_count + 1);
+	//Every game must lie within the payload, since the batch engines turn the offsets into token pointers unchecked
+	if (offsets_[0] != 0 || offsets_[game_count] != token_count || !std::is_sorted(offsets_, offsets_ + game_count + 1)) {
+		unmap();
+		throw std::runtime_error("TokenCorpus: the index of " + path + " does not match its payload");
+	}
+}
+
+void TokenCorpus::unmap() {
+	if (data_ != nullptr) {
+#ifdef _WIN32
+		UnmapViewOfFile(data_);
+#else
+		::munmap(const_cast<void*>(data_), size_);
+#endif
+		data_ = nullptr;
+	}
+}
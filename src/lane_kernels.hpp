@@ -0,0 +1,18 @@
+/**
+ * @file lane_kernels.hpp
+ * @copyright Copyright (c) 2022 Asaphus Vision GmbH
+ *
+ * Lane-parallel kernels of the library, each defined in a translation unit compiled for its instructions.
+ * These translation units must not use inline functions of the engine beyond the LaneBatchEngine of their lane type, as the
+ * linker could pick their copy, compiled for instructions the CPU may lack, for the whole library. The few inline standard
+ * library functions that engine needs are emitted by engine.cpp as well, which the linker sees first as it calls the kernels.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+void playBatchLanesAvx2(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores);
+void playBatchLanesAvx512(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores);
@@ -0,0 +1,18 @@
+/**
+ * @file lanes_avx2.cpp
+ * @copyright Copyright (c) 2022 Asaphus Vision GmbH
+ *
+ * Avx2Lanes kernel of the lane-parallel engine, compiled with -mavx2 and only called on CPUs supporting it.
+ */
+
+#include "asaphus/engine.hpp"
+#include "lane_kernels.hpp"
+
+#if !defined(__AVX2__)
+#error "lanes_avx2.cpp must be compiled with -mavx2"
+#endif
+
+void playBatchLanesAvx2(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores) {
+	LaneBatchEngine<Avx2Lanes> engine;
+	engine.playBatch(tokens, offsets, game_count, scores);
+}
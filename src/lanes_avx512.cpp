@@ -0,0 +1,18 @@
+/**
+ * @file lanes_avx512.cpp
+ * @copyright Copyright (c) 2022 Asaphus Vision GmbH
+ *
+ * Avx512Lanes kernel of the lane-parallel engine, compiled with -mavx512f and only called on CPUs supporting it.
+ */
+
+#include "asaphus/engine.hpp"
+#include "lane_kernels.hpp"
+
+#if !defined(__AVX512F__)
+#error "lanes_avx512.cpp must be compiled with -mavx512f"
+#endif
+
+void playBatchLanesAvx512(const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* scores) {
+	LaneBatchEngine<Avx512Lanes> engine;
+	engine.playBatch(tokens, offsets, game_count, scores);
+}
@@ -0,0 +1,451 @@
+/**
+ * @file service.cpp
+ * @copyright Copyright (c) 2022 Asaphus Vision GmbH
+ *
+ * Scoring server and client declared in asaphus/service.hpp.
+ */
+
+#include "asaphus/service.hpp"
+
+#include <cerrno>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+void MicroBatcher::submit(const ScoringTicket& ticket, const uint32_t* tokens, size_t token_count) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (pending_.tickets.empty()) {
+		pending_.oldest = std::chrono::steady_clock::now();
+	}
+	pending_.tickets.push_back(ticket);
+	pending_.tokens.insert(pending_.tokens.end(), tokens, tokens + token_count);
+	pending_.offsets.push_back(pending_.tokens.size());
+	if (pending_.tickets.size() == 1 || isFull()) {
+		pending_changed_.notify_one();
+	}
+}
+
+void MicroBatcher::stop() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	pending_changed_.notify_one();
+	if (dispatcher_.joinable()) {
+		dispatcher_.join();
+	}
+}
+
+void MicroBatcher::dispatch() {
+	Batch batch;
+	std::vector<std::pair<double, double>> scores;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			pending_changed_.wait(lock, [&]() { return stopping_ || !pending_.tickets.empty(); });
+			if (pending_.tickets.empty()) {
+				return;
+			}
+			pending_changed_.wait_until(lock, pending_.oldest + policy_.max_delay, [&]() { return stopping_ || isFull(); });
+			std::swap(batch, pending_);
+			pending_.clear();
+		}
+		scores.resize(batch.tickets.size());
+		if (cache_ != nullptr) {
+			cache_->playBatch(batch.tokens.data(), batch.offsets.data(), scores.size(), scores.data(), GameConfig::standard(),
+				[this](const uint32_t* tokens, const uint64_t* offsets, size_t game_count, std::pair<double, double>* game_scores) {
+					runner_.playBatchLanes(tokens, offsets, game_count, game_scores);
+				});
+		}
+		else {
+			runner_.playBatchLanes(batch.tokens.data(), batch.offsets.data(), scores.size(), scores.data());
+		}
+		++batch_count_;
+		completion_(batch.tickets, scores);
+	}
+}
+
+ScoringServer::ScoringServer(const Options& options) : options_(options) {
+	if (!isLittleEndianHost()) {
+		throw std::runtime_error("ScoringServer: frames are only supported on little-endian hosts");
+	}
+	if (options.io_threads == 0) {
+		throw std::invalid_argument("ScoringServer: at least one I/O thread is needed");
+	}
+	if (options.max_outstanding == 0 || options.max_output_bytes == 0) {
+		throw std::invalid_argument("ScoringServer: a connection needs room for at least one request and its response");
+	}
+	if (options.cache_capacity != 0) {
+		cache_.reset(new ResultCache(options.cache_capacity));
+	}
+	listen_socket_ = ::socket(AF_INET, SOCK_STREAM, 0);
+	int reuse = 1;
+	sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(options.port);
+	socklen_t address_size = sizeof(address);
+	if (listen_socket_ < 0 || ::setsockopt(listen_socket_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+		::bind(listen_socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(listen_socket_, 128) != 0 ||
+		::getsockname(listen_socket_, reinterpret_cast<sockaddr*>(&address), &address_size) != 0 || ::pipe(stop_pipe_) != 0) {
+		if (listen_socket_ >= 0) {
+			::close(listen_socket_);
+		}
+		throw std::runtime_error("ScoringServer: cannot listen on port " + std::to_string(options.port));
+	}
+	port_ = ntohs(address.sin_port);
+}
+
+ScoringServer::~ScoringServer() {
+	::close(listen_socket_);
+	::close(stop_pipe_[0]);
+	::close(stop_pipe_[1]);
+}
+
+void ScoringServer::run() {
+	stopping_ = false;
+	//Every pipe is created before any thread starts, so a failure leaves no thread to stop
+	for (unsigned i = 0; i < options_.io_threads; ++i) {
+		std::unique_ptr<IoThread> io_thread(new IoThread());
+		if (::pipe(io_thread->wake_pipe) != 0) {
+			closeIoThreads();
+			throw std::runtime_error("ScoringServer: cannot create a pipe");
+		}
+		//a full pipe already wakes the thread, so wake() never has to block
+		for (int end : io_thread->wake_pipe) {
+			::fcntl(end, F_SETFL, ::fcntl(end, F_GETFL) | O_NONBLOCK);
+		}
+		io_threads_.push_back(std::move(io_thread));
+	}
+	try {
+		batcher_.reset(new MicroBatcher(options_.policy, options_.compute_threads,
+			[this](const std::vector<ScoringTicket>& tickets, const std::vector<std::pair<double, double>>& scores) { complete(tickets, scores); },
+			cache_.get()));
+		for (auto& io_thread : io_threads_) {
+			IoThread& io_thread_ref = *io_thread;
+			io_thread->thread = std::thread([this, &io_thread_ref]() { serveConnections(io_thread_ref); });
+		}
+	}
+	catch (...) {
+		stopping_ = true;
+		closeIoThreads();
+		batcher_.reset();
+		throw;
+	}
+
+	uint64_t next_id = 0;
+	bool stop_requested = false;
+	for (;;) {
+		pollfd descriptors[2] = { { listen_socket_, POLLIN, 0 }, { stop_pipe_[0], POLLIN, 0 } };
+		if (::poll(descriptors, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fail("ScoringServer: poll failed");
+			break;
+		}
+		if (descriptors[1].revents != 0) {
+			stop_requested = true;
+			break;
+		}
+		int socket = ::accept(listen_socket_, nullptr, nullptr);
+		if (socket < 0) {
+			if (errno == EBADF || errno == EFAULT || errno == EINVAL || errno == ENOTSOCK) {
+				fail("ScoringServer: accept failed");
+				break;
+			}
+			//The listen socket stays readable while no descriptor is left, so wait a while for connections to close. Other
+			//errors only concern the connection accepted.
+			if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+				::poll(&descriptors[1], 1, 100);
+			}
+			continue;
+		}
+		int no_delay = 1;
+		::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+		::fcntl(socket, F_SETFL, ::fcntl(socket, F_GETFL) | O_NONBLOCK);
+		std::shared_ptr<Connection> connection = std::make_shared<Connection>();
+		connection->socket = socket;
+		IoThread& io_thread = *io_threads_[next_id % io_threads_.size()];
+		{
+			std::lock_guard<std::mutex> lock(connections_mutex_);
+			connections_[next_id] = std::make_pair(connection, &io_thread);
+		}
+		{
+			std::lock_guard<std::mutex> lock(io_thread.mutex);
+			io_thread.accepted.emplace_back(next_id++, connection);
+		}
+		wake(io_thread);
+	}
+
+	//No request is read after the I/O threads stopped, so every request parsed is played before the batcher stops, and the
+	//responses are written as far as the sockets accept them
+	stopping_ = true;
+	for (auto& io_thread : io_threads_) {
+		wake(*io_thread);
+		io_thread->thread.join();
+	}
+	batcher_->stop();
+	closeIoThreads();
+	std::lock_guard<std::mutex> lock(connections_mutex_);
+	for (auto& connection : connections_) {
+		writeResponses(*connection.second.first);
+		::close(connection.second.first->socket);
+	}
+	connections_.clear();
+	batcher_.reset();
+	if (stop_requested) {
+		char byte;
+		ssize_t drained = ::read(stop_pipe_[0], &byte, 1);
+		(void)drained;
+	}
+	std::exception_ptr error;
+	{
+		std::lock_guard<std::mutex> error_lock(error_mutex_);
+		std::swap(error, error_);
+	}
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+//Joins the I/O threads started, which stop once stopping_ is set, and closes their pipes
+void ScoringServer::closeIoThreads() {
+	for (auto& io_thread : io_threads_) {
+		if (io_thread->thread.joinable()) {
+			wake(*io_thread);
+			io_thread->thread.join();
+		}
+		::close(io_thread->wake_pipe[0]);
+		::close(io_thread->wake_pipe[1]);
+	}
+	io_threads_.clear();
+}
+
+//Keeps the first failure for run() to throw once the server is shut down
+void ScoringServer::fail(const char* message) {
+	std::lock_guard<std::mutex> lock(error_mutex_);
+	if (!error_) {
+		error_ = std::make_exception_ptr(std::runtime_error(message));
+	}
+}
+
+void ScoringServer::serveConnections(IoThread& io_thread) {
+	std::vector<std::pair<uint64_t, std::shared_ptr<Connection>>> connections;
+	std::vector<pollfd> descriptors;
+	while (!stopping_) {
+		descriptors.assign(1, pollfd{ io_thread.wake_pipe[0], POLLIN, 0 });
+		for (const auto& connection : connections) {
+			bool reading = !connection.second->input_closed && !isBackedUp(*connection.second);
+			std::lock_guard<std::mutex> lock(connection.second->output_mutex);
+			short events = static_cast<short>((reading ? POLLIN : 0) | (connection.second->output.empty() ? 0 : POLLOUT));
+			//poll reports the hang-up of a peer even without events, so a socket waiting for responses to write is left out
+			descriptors.push_back(pollfd{ events != 0 ? connection.second->socket : -1, events, 0 });
+		}
+		if (::poll(descriptors.data(), descriptors.size(), -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			//run() shuts the server down and closes the connections of this thread
+			fail("ScoringServer: poll failed");
+			stop();
+			return;
+		}
+		if (descriptors[0].revents != 0) {
+			char bytes[64];
+			while (::read(io_thread.wake_pipe[0], bytes, sizeof(bytes)) == sizeof(bytes)) {
+			}
+			std::lock_guard<std::mutex> lock(io_thread.mutex);
+			connections.insert(connections.end(), io_thread.accepted.begin(), io_thread.accepted.end());
+			io_thread.accepted.clear();
+		}
+
+		//connections are closed once the client stopped sending and all responses are written
+		for (size_t i = 0; i + 1 < descriptors.size(); ++i) {
+			Connection& connection = *connections[i].second;
+			bool open = true;
+			if (descriptors[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+				open = readRequests(connections[i].first, connection);
+			}
+			if (open) {
+				open = writeResponses(connection);
+			}
+			if (open && !connection.input.empty()) {
+				open = parseRequests(connections[i].first, connection); //requests held back while the connection was backed up
+			}
+			if (open && connection.input_closed && connection.outstanding == 0 && connection.input.empty()) {
+				std::lock_guard<std::mutex> lock(connection.output_mutex);
+				open = !connection.output.empty();
+			}
+			if (!open) {
+				{
+					std::lock_guard<std::mutex> lock(connections_mutex_);
+					connections_.erase(connections[i].first);
+				}
+				::close(connection.socket);
+				connections[i].second.reset();
+			}
+		}
+		connections.erase(std::remove_if(connections.begin(), connections.end(),
+			[](const std::pair<uint64_t, std::shared_ptr<Connection>>& connection) { return !connection.second; }), connections.end());
+	}
+}
+
+//Reads the input of a connection and submits its complete requests, returns false if the connection failed or sent a
+//malformed request. At most 16 buffers are read at once, poll reports the rest again.
+bool ScoringServer::readRequests(uint64_t id, Connection& connection) {
+	char buffer[1 << 16];
+	for (int reads = 0; reads < 16; ++reads) {
+		ssize_t received = ::recv(connection.socket, buffer, sizeof(buffer), 0);
+		if (received == 0) {
+			connection.input_closed = true;
+			break;
+		}
+		if (received < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				break;
+			}
+			return false;
+		}
+		connection.input.insert(connection.input.end(), buffer, buffer + received);
+	}
+	return parseRequests(id, connection);
+}
+
+//Submits the complete requests of the input until the connection is backed up, returns false for a malformed request
+bool ScoringServer::parseRequests(uint64_t id, Connection& connection) {
+	size_t parsed = 0;
+	bool is_backed_up = false;
+	std::vector<uint32_t> tokens;
+	while (connection.input.size() - parsed >= scoring_request_header_size) {
+		const char* frame = connection.input.data() + parsed;
+		uint64_t request_id;
+		uint32_t token_count;
+		std::memcpy(&request_id, frame, sizeof(request_id));
+		std::memcpy(&token_count, frame + 8, sizeof(token_count));
+		if (token_count > max_scoring_request_tokens || token_count > options_.policy.max_tokens) {
+			return false;
+		}
+		size_t frame_size = scoring_request_header_size + token_count * sizeof(uint32_t);
+		if (connection.input.size() - parsed < frame_size) {
+			break;
+		}
+		if (isBackedUp(connection)) {
+			is_backed_up = true;
+			break;
+		}
+		tokens.resize(token_count);
+		std::memcpy(tokens.data(), frame + scoring_request_header_size, token_count * sizeof(uint32_t));
+		++connection.outstanding;
+		batcher_->submit(ScoringTicket{ id, request_id }, tokens.data(), tokens.size());
+		parsed += frame_size;
+	}
+	connection.input.erase(connection.input.begin(), connection.input.begin() + static_cast<std::ptrdiff_t>(parsed));
+	if (connection.input_closed && !is_backed_up) {
+		connection.input.clear(); //a truncated last request is dropped
+	}
+	return true;
+}
+
+bool ScoringServer::isBackedUp(Connection& connection) const {
+	std::lock_guard<std::mutex> lock(connection.output_mutex);
+	return connection.outstanding >= options_.max_outstanding || connection.output.size() >= options_.max_output_bytes;
+}
+
+bool ScoringServer::writeResponses(Connection& connection) {
+	std::lock_guard<std::mutex> lock(connection.output_mutex);
+	size_t written = 0;
+	while (written < connection.output.size()) {
+		ssize_t sent = ::send(connection.socket, connection.output.data() + written, connection.output.size() - written, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				break;
+			}
+			return false;
+		}
+		written += static_cast<size_t>(sent);
+	}
+	connection.output.erase(connection.output.begin(), connection.output.begin() + static_cast<std::ptrdiff_t>(written));
+	return true;
+}
+
+//Appends the responses to the output of their connections and wakes the I/O threads of these connections
+void ScoringServer::complete(const std::vector<ScoringTicket>& tickets, const std::vector<std::pair<double, double>>& scores) {
+	std::vector<IoThread*> woken;
+	std::lock_guard<std::mutex> lock(connections_mutex_);
+	for (size_t i = 0; i < tickets.size(); ++i) {
+		auto found = connections_.find(tickets[i].connection);
+		if (found == connections_.end()) {
+			continue;
+		}
+		Connection& connection = *found->second.first;
+		{
+			std::lock_guard<std::mutex> output_lock(connection.output_mutex);
+			appendScoringResponse(connection.output, tickets[i].request_id, scores[i]);
+		}
+		--connection.outstanding;
+		if (std::find(woken.begin(), woken.end(), found->second.second) == woken.end()) {
+			woken.push_back(found->second.second);
+		}
+	}
+	for (IoThread* io_thread : woken) {
+		wake(*io_thread);
+	}
+}
+
+ScoringClient::ScoringClient(const std::string& host, uint16_t port) {
+	if (!isLittleEndianHost()) {
+		throw std::runtime_error("ScoringClient: frames are only supported on little-endian hosts");
+	}
+	sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	socket_ = ::socket(AF_INET, SOCK_STREAM, 0);
+	if (socket_ < 0 || ::inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1 ||
+		::connect(socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+		if (socket_ >= 0) {
+			::close(socket_);
+		}
+		throw std::runtime_error("ScoringClient: cannot connect to " + host + ":" + std::to_string(port));
+	}
+	int no_delay = 1;
+	::setsockopt(socket_, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+}
+
+void ScoringClient::send(uint64_t request_id, const std::vector<uint32_t>& tokens) {
+	if (tokens.size() > max_scoring_request_tokens) {
+		throw std::invalid_argument("ScoringClient: too many tokens in a request");
+	}
+	std::vector<char> frame;
+	appendScoringRequest(frame, request_id, tokens.data(), static_cast<uint32_t>(tokens.size()));
+	for (size_t written = 0; written < frame.size();) {
+		ssize_t sent = ::send(socket_, frame.data() + written, frame.size() - written, MSG_NOSIGNAL);
+		if (sent <= 0) {
+			throw std::runtime_error("ScoringClient: sending failed");
+		}
+		written += static_cast<size_t>(sent);
+	}
+}
+
+std::pair<uint64_t, std::pair<double, double>> ScoringClient::receive() {
+	char frame[scoring_response_size];
+	for (size_t received = 0; received < sizeof(frame);) {
+		ssize_t result = ::recv(socket_, frame + received, sizeof(frame) - received, 0);
+		if (result <= 0) {
+			throw std::runtime_error("ScoringClient: connection closed");
+		}
+		received += static_cast<size_t>(result);
+	}
+	std::pair<uint64_t, std::pair<double, double>> response;
+	std::memcpy(&response.first, frame, sizeof(uint64_t));
+	std::memcpy(&response.second.first, frame + 8, sizeof(double));
+	std::memcpy(&response.second.second, frame + 16, sizeof(double));
+	return response;
+}